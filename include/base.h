@@ -20,7 +20,9 @@ along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
 #include <optional>
+#include <span>
 #include <string>
+#include <vector>
 
 #include "lib-common.h"
 
@@ -63,10 +65,19 @@ struct Scalar {
   bool is_valid() const;
   std::string hex() const;
   static Scalar FromHex(std::string_view view);
+  // Parses many values in one pass, with the checks of FromHex but without exceptions: out[i] is set to the value
+  // of in[i], or to zero if in[i] is not valid. Returns for every value whether it is valid. Throws
+  // std::invalid_argument if the spans have different sizes.
+  static std::vector<bool> FromHexBatch(std::span<const std::string_view> in, std::span<Scalar> out);
   // returns a scalar != 0
   static Scalar Random();
+  // out[i] = Random(), with the random bytes for many scalars drawn at once
+  static void RandomBatch(std::span<Scalar> out);
   // returns a scalar != 0
   static Scalar FromHash(uint8_t (&value)[64]);
+  // Inverts all scalars in place with one inversion and about 3n multiplications (Montgomery's trick).
+  // Zero scalars have no inverse: they are left zero (instead of throwing), and their number is returned.
+  static size_t BatchInvert(std::span<Scalar> values);
 };
 
 bool operator==(const Scalar& lhs, const Scalar& rhs);
@@ -92,6 +103,8 @@ struct GroupElement {
   bool is_valid() const;
   std::string hex() const;
   static GroupElement FromHex(std::string_view view);
+  // same as Scalar::FromHexBatch
+  static std::vector<bool> FromHexBatch(std::span<const std::string_view> in, std::span<GroupElement> out);
   // returns a group element which can be zero
   static GroupElement Random();
   // returns a group element which can be zero
@@ -151,6 +164,13 @@ void SHA512(HashSHA512& hash, const Args& ... args) {
 
 void RandomBytes(void* ptr, std::size_t length);
 
+// By default random bytes (and so random scalars and group elements) come from the OS, through libsodium, which is a
+// system call for every request on Linux. With SetBufferedRandom(true), every thread uses its own ChaCha20 generator
+// instead, seeded from the OS, reseeded from the OS after every MiB of output and after a fork. The generator
+// overwrites its key after every block of output (fast key erasure), so earlier output can not be reconstructed.
+void SetBufferedRandom(bool enabled);
+bool BufferedRandom();
+
 template <size_t N>
 void RandomBytes(char (&buffer)[N]) {
   RandomBytes(buffer, N);
@@ -177,7 +197,12 @@ void KDFGenerateSeedKey(KDFSeedKey& seedKey);
 void KDF(unsigned char *output, size_t outputLength, uint64_t subkey_id, const KDFContext& context, const KDFSeedKey& seedKey);
 
 std::string ToHex(std::string_view in);
+// writes 2 * in.size() lower case hex digits to out (not zero terminated)
+void ToHex(std::string_view in, char* out);
+// throws std::invalid_argument if in has not 2 * out_len characters, or contains a character that is not a hex digit
 void FromHex(uint8_t* out, size_t out_len, std::string_view in);
+// same as FromHex, but returns false instead of throwing
+bool TryFromHex(uint8_t* out, size_t out_len, std::string_view in);
 template <size_t N>
 void FromHex(uint8_t (&out)[N], std::string_view in) {
   FromHex(out, N, in);
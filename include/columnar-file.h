@@ -0,0 +1,116 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#pragma once
+
+#include "core.h"
+
+#include <fstream>
+#include <functional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace libpep {
+
+// Columnar file of ElGamal tuples (e.g. encrypted pseudonyms), for data sets too large to keep as hex text or
+// in memory. Layout (little endian):
+//   header     magic "LIBPEPC1", version, rows per chunk, number of rows, chunks and keys, offset of the footer
+//   chunks     per chunk the columns B (32 bytes per row), C (32 bytes), row id (8 bytes) and key index (4 bytes)
+//   footer     key dictionary (32 bytes per distinct Y), then per chunk its offset, number of rows and checksum
+// A row id is an opaque number of the caller (e.g. the primary key of the record), so results can be related
+// to their input. Every chunk has a BLAKE2b checksum over its columns, verified when the chunk is read.
+struct ColumnarHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t chunkRows;
+  uint64_t rows;
+  uint64_t chunks;
+  uint64_t keys;
+  uint64_t footerOffset;
+};
+
+struct ColumnarChunk {
+  uint64_t offset;
+  uint64_t rows;
+  uint8_t checksum[32];
+};
+
+// Maps the file in memory; the chunks are read (and checked) on demand, so opening is cheap. On Windows the file is
+// read in memory when opened instead. Throws std::runtime_error if the file can not be opened or is not a valid
+// columnar file. Reading chunks from multiple threads at the same time is safe.
+class ColumnarReader {
+ public:
+  explicit ColumnarReader(const std::string& path);
+  ~ColumnarReader();
+  ColumnarReader(const ColumnarReader&) = delete;
+  ColumnarReader& operator=(const ColumnarReader&) = delete;
+  uint64_t rows() const {
+    return header.rows;
+  }
+  size_t chunks() const {
+    return chunkTable.size();
+  }
+  size_t chunkRows(size_t chunk) const;
+  // distinct public keys (Y) of the tuples
+  const std::vector<GroupElement>& keys() const {
+    return dictionary;
+  }
+  // Copies chunk i into tuples and rowIds (resized to the rows of the chunk), and asks the kernel to read ahead
+  // the next chunk. Throws std::runtime_error if the checksum does not match. Group elements are not validated
+  // here, but when they are decoded by the transformations.
+  void read(size_t chunk, std::vector<ElGamal>& tuples, std::vector<uint64_t>& rowIds) const;
+ private:
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  ColumnarHeader header;
+  std::vector<GroupElement> dictionary;
+  std::vector<ColumnarChunk> chunkTable;
+};
+
+// Writes tuples in chunks of chunkRows rows; close() (or the destructor) writes the footer and header. Throws
+// std::runtime_error on I/O errors.
+class ColumnarWriter {
+ public:
+  explicit ColumnarWriter(const std::string& path, uint32_t chunkRows = 1 << 16);
+  ~ColumnarWriter();
+  ColumnarWriter(const ColumnarWriter&) = delete;
+  ColumnarWriter& operator=(const ColumnarWriter&) = delete;
+  // appends rows; throws std::invalid_argument if the spans have different sizes
+  void write(std::span<const ElGamal> tuples, std::span<const uint64_t> rowIds);
+  void close();
+ private:
+  void flush();
+  std::ofstream file;
+  ColumnarHeader header;
+  std::vector<ElGamal> pending;
+  std::vector<uint64_t> pendingRowIds;
+  std::vector<uint8_t> buffer;
+  std::vector<GroupElement> dictionary;
+  std::unordered_map<std::string, uint32_t> keyIndex;
+  std::vector<ColumnarChunk> chunkTable;
+  bool closed = false;
+};
+
+// Streams all chunks of in through transform (e.g. a lambda calling RKS of core.h) and writes the results
+// with the same row ids to out. The disk reads of the next chunk overlap with the transformation of the current.
+void TransformColumnar(const ColumnarReader& in, ColumnarWriter& out, const std::function<void(std::span<const ElGamal>, std::span<ElGamal>)>& transform);
+
+}
@@ -19,7 +19,9 @@ along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 
-#include "base.h"
+#include "executor.h"
+#include "ristretto.h"
+#include <span>
 
 namespace libpep {
 
@@ -33,16 +35,70 @@ struct ElGamal {
   bool operator!=(const ElGamal& rhs) const;
   std::string hex() const;
   static ElGamal FromHex(std::string_view view);
+  // same as Scalar::FromHexBatch; the check of Y is skipped when it equals the Y of the previous valid tuple, as
+  // tuples encrypted for the same key usually come together
+  static std::vector<bool> FromHexBatch(std::span<const std::string_view> in, std::span<ElGamal> out);
+  // Binary layout: B | C | Y, 96 bytes. The compact layout leaves out Y (64 bytes), for records of which the
+  // public key is known from the context (e.g. a key id stored once for many records).
+  static const constexpr size_t BYTES = 3 * GroupElement::BYTES;
+  static const constexpr size_t COMPACT_BYTES = 2 * GroupElement::BYTES;
+  void bytes(std::span<uint8_t, BYTES> out) const;
+  void compact(std::span<uint8_t, COMPACT_BYTES> out) const;
+  // throw std::invalid_argument if a group element is not valid or zero (same checks as FromHex)
+  static ElGamal FromBytes(std::span<const uint8_t, BYTES> in);
+  static ElGamal FromCompact(std::span<const uint8_t, COMPACT_BYTES> in, const GroupElement& Y);
 };
 
+// Non-owning view of an ElGamal tuple in the binary layout, in memory of the caller (e.g. a message or
+// database buffer). The in-place transformations below read from and write to that memory directly.
+class ElGamalView {
+ public:
+  explicit ElGamalView(std::span<uint8_t, ElGamal::BYTES> _data) : data(_data) { }
+  std::span<uint8_t, ElGamal::BYTES> bytes() const {
+    return data;
+  }
+  // throws std::invalid_argument if a group element is not valid or zero
+  ElGamal get() const {
+    return ElGamal::FromBytes(data);
+  }
+  void set(const ElGamal& value) const {
+    value.bytes(data);
+  }
+ private:
+  std::span<uint8_t, ElGamal::BYTES> data;
+};
+
+// ElGamal tuple with decoded group elements, so multiple operations can be chained
+// without encoding and decoding the intermediate results
+struct DecodedElGamal {
+  DecodedGroupElement B;
+  DecodedGroupElement C;
+  DecodedGroupElement Y;
+  DecodedElGamal() { }
+  DecodedElGamal(const DecodedGroupElement& _B, const DecodedGroupElement& _C, const DecodedGroupElement& _Y);
+  // throws std::invalid_argument if one of the group elements is not valid
+  explicit DecodedElGamal(const ElGamal& in);
+  ElGamal encode() const;
+};
+
+// public key with a precomputed table, for keys used for many encryptions or rerandomizations
+using PreparedPublicKey = PreparedGroupElement;
+
+// returns the prepared version of Y; a small number of recently used keys are cached (keyed by their encoding),
+// so this is cheap for the handful of long lived keys in a deployment
+PreparedPublicKey PreparePublicKey(const GroupElement& Y);
+
 // encrypt message M using public key Y
 ElGamal Encrypt(const GroupElement& M, const GroupElement& Y);
+ElGamal Encrypt(const GroupElement& M, const PreparedPublicKey& Y);
 
 // decrypt encrypted ElGamal tuple with secret key y
 GroupElement Decrypt(const ElGamal& in, const Scalar& y); 
 
 // randomize the encryption
 ElGamal Rerandomize(const ElGamal& in, const Scalar& s = Scalar::Random());
+// Y should be the public key of the tuple (in.Y), throws std::invalid_argument otherwise
+ElGamal Rerandomize(const ElGamal& in, const PreparedPublicKey& Y, const Scalar& s = Scalar::Random());
 
 // make it decryptable with another key k*y (with y the original private key)
 ElGamal Rekey(const ElGamal& in, const Scalar& k);
@@ -53,4 +109,54 @@ ElGamal Reshuffle(const ElGamal& in, const Scalar& n);
 // combination of Rekey(k) and Reshuffle(n) and Rerandomize(r)
 ElGamal RKS(const ElGamal& in, const Scalar& k, const Scalar& n);
 
+// combination of RKS(k, n) followed by Rerandomize(s), in one pass without intermediate encoding;
+// same result as Rerandomize(RKS(in, k, n), s)
+ElGamal RKSR(const ElGamal& in, const Scalar& k, const Scalar& n, const Scalar& s = Scalar::Random());
+
+// same operations on decoded ElGamal tuples
+DecodedElGamal Encrypt(const DecodedGroupElement& M, const DecodedGroupElement& Y);
+DecodedGroupElement Decrypt(const DecodedElGamal& in, const Scalar& y);
+DecodedElGamal Rerandomize(const DecodedElGamal& in, const Scalar& s = Scalar::Random());
+DecodedElGamal Rekey(const DecodedElGamal& in, const Scalar& k);
+DecodedElGamal Reshuffle(const DecodedElGamal& in, const Scalar& n);
+DecodedElGamal RKS(const DecodedElGamal& in, const Scalar& k, const Scalar& n);
+DecodedElGamal RKSR(const DecodedElGamal& in, const Scalar& k, const Scalar& n, const Scalar& s = Scalar::Random());
+
+// Batch versions: element i of the input is transformed into element i of the output.
+// Values shared by the whole batch (such as n / k, k^-1 or the decoded public key) are computed once.
+// Output must have the same size as the input (throws std::invalid_argument otherwise); in and out may
+// be the same span (in place), but should not partially overlap.
+// The batch is split in chunks that are processed by the executor, possibly in parallel; the output order
+// is always the input order.
+void Encrypt(std::span<const GroupElement> M, const GroupElement& Y, std::span<ElGamal> out, Executor& executor = DefaultExecutor());
+void Encrypt(std::span<const GroupElement> M, const PreparedPublicKey& Y, std::span<ElGamal> out, Executor& executor = DefaultExecutor());
+// with decoded messages (e.g. from DecodedGroupElement::FromHash), so these are not encoded and decoded again
+void Encrypt(std::span<const DecodedGroupElement> M, const PreparedPublicKey& Y, std::span<ElGamal> out, Executor& executor = DefaultExecutor());
+void Decrypt(std::span<const ElGamal> in, const Scalar& y, std::span<GroupElement> out, Executor& executor = DefaultExecutor());
+// every element is rerandomized with its own random scalar
+void Rerandomize(std::span<const ElGamal> in, std::span<ElGamal> out, Executor& executor = DefaultExecutor());
+void Rekey(std::span<const ElGamal> in, const Scalar& k, std::span<ElGamal> out, Executor& executor = DefaultExecutor());
+void Reshuffle(std::span<const ElGamal> in, const Scalar& n, std::span<ElGamal> out, Executor& executor = DefaultExecutor());
+void RKS(std::span<const ElGamal> in, const Scalar& k, const Scalar& n, std::span<ElGamal> out, Executor& executor = DefaultExecutor());
+// every element is rerandomized with its own random scalar
+void RKSR(std::span<const ElGamal> in, const Scalar& k, const Scalar& n, std::span<ElGamal> out, Executor& executor = DefaultExecutor());
+
+// In-place versions on a view: the result overwrites the tuple.
+void Rerandomize(ElGamalView x, const Scalar& s = Scalar::Random());
+void Rekey(ElGamalView x, const Scalar& k);
+void Reshuffle(ElGamalView x, const Scalar& n);
+void RKS(ElGamalView x, const Scalar& k, const Scalar& n);
+
+// In-place batch versions on consecutive records in the binary layout, such as a column of a database buffer,
+// without copying them into ElGamal structs first. Throws std::invalid_argument if the size is not a multiple
+// of ElGamal::BYTES or if a record is not valid (other records may be transformed already in that case).
+void Rerandomize(std::span<uint8_t> records, Executor& executor = DefaultExecutor());
+void Rekey(std::span<uint8_t> records, const Scalar& k, Executor& executor = DefaultExecutor());
+void Reshuffle(std::span<uint8_t> records, const Scalar& n, Executor& executor = DefaultExecutor());
+void RKS(std::span<uint8_t> records, const Scalar& k, const Scalar& n, Executor& executor = DefaultExecutor());
+
+// out[i] = 2 * in[i] (every component doubled) encoded, sharing one field inversion for the whole batch;
+// used by the batch functions above, see DoubleAndEncodeBatch for points
+void DoubleAndEncodeBatch(std::span<const DecodedElGamal> in, std::span<ElGamal> out);
+
 }
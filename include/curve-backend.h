@@ -0,0 +1,76 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#pragma once
+
+#include "ristretto.h"
+
+#include <vector>
+
+// The variable base scalar multiplications (of Scalar * GroupElement, and of DecodedGroupElement in ristretto.h) are
+// done by a curve backend, chosen at runtime based on the features of the CPU. All backends compute the same points,
+// so results are byte for byte identical; only the speed differs.
+
+namespace libpep {
+
+enum class CurveBackend {
+  // libsodium's ref10 code (for DecodedGroupElement its 64 bit port in ristretto.cpp), on every platform
+  Libsodium,
+  // x86-64 with AVX2: the four coordinates of a point in the four lanes of a vector, limbs of 25.5 bits
+  AVX2,
+  // x86-64 with AVX-512 IFMA (and VL): the same, with limbs of 51 bits and 52 bit multiply-add instructions
+  AVX512IFMA,
+};
+
+const char* Name(CurveBackend backend);
+// compiled in, and supported by this CPU
+bool Supported(CurveBackend backend);
+std::vector<CurveBackend> SupportedCurveBackends();
+// by default AVX512IFMA if supported, otherwise Libsodium (AVX2 is not consistently faster than Libsodium)
+CurveBackend ActiveCurveBackend();
+// for the whole process; throws std::invalid_argument if the backend is not supported
+void SetCurveBackend(CurveBackend backend);
+
+// The operations a backend implements, on scalars that are already recoded in digits: e[64] are the signed radix 16
+// digits of a constant time multiplication, e[256] the width 5 NAF of a variable time one (see ristretto.cpp).
+struct CurveBackendOperations {
+  // h = e * p
+  void (*scalarmult)(DecodedGroupElement& h, const signed char e[64], const DecodedGroupElement& p);
+  // h = e * p + f * q
+  void (*double_scalarmult)(DecodedGroupElement& h, const signed char e[64], const DecodedGroupElement& p, const signed char f[64], const DecodedGroupElement& q);
+  // h = e * p, variable time
+  void (*scalarmult_vartime)(DecodedGroupElement& h, const signed char e[256], const DecodedGroupElement& p);
+  // h = e * p + f * q, variable time
+  void (*double_scalarmult_vartime)(DecodedGroupElement& h, const signed char e[256], const DecodedGroupElement& p, const signed char f[256], const DecodedGroupElement& q);
+  // h = e * G + f * q, variable time; the multiples of G are precomputed once
+  void (*double_scalarmult_base_vartime)(DecodedGroupElement& h, const signed char e[256], const signed char f[256], const DecodedGroupElement& q);
+};
+
+// throws std::invalid_argument if the backend is not supported
+const CurveBackendOperations& Operations(CurveBackend backend);
+// operations of the active backend
+const CurveBackendOperations& ActiveCurveOperations();
+
+// implemented by the backends (ristretto.cpp, curve-avx2.cpp and curve-ifma.cpp); nullptr if not compiled in or
+// not supported by this CPU
+const CurveBackendOperations* LibsodiumCurveOperations();
+const CurveBackendOperations* AVX2CurveOperations();
+const CurveBackendOperations* AVX512IFMACurveOperations();
+
+}
@@ -0,0 +1,96 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace libpep {
+
+// Runs the parts of a batch operation, possibly in parallel. Implement this interface to run the batch
+// functions of libpep on an existing thread pool.
+class Executor {
+ public:
+  virtual ~Executor() = default;
+  // number of tasks that can run at the same time (used to decide how to split a batch)
+  virtual size_t concurrency() const = 0;
+  // Calls f(i) for every i in [0, count), in any order and possibly in parallel, and returns when all calls are
+  // finished. If calls throw, the first exception is rethrown (after all calls are finished).
+  virtual void run(size_t count, const std::function<void(size_t)>& f) = 0;
+};
+
+// runs everything on the calling thread
+class InlineExecutor : public Executor {
+ public:
+  size_t concurrency() const override;
+  void run(size_t count, const std::function<void(size_t)>& f) override;
+};
+
+// Thread pool where every worker has its own deque of tasks. A task is a range of indices: a worker splits
+// the range in halves, pushing the upper half to the back of its own deque, until one index is left. Workers
+// take tasks from the back of their own deque, and steal (the larger, older) tasks from the front of the deques
+// of others. The thread calling run() helps until its work is done, so nested calls to run() do not deadlock.
+class WorkStealingExecutor : public Executor {
+ public:
+  // threads == 0 uses the number of hardware threads
+  explicit WorkStealingExecutor(size_t threads = 0);
+  ~WorkStealingExecutor() override;
+  WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+  WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+
+  size_t concurrency() const override;
+  void run(size_t count, const std::function<void(size_t)>& f) override;
+
+ private:
+  struct Job;
+  struct Task {
+    Job* job;
+    size_t begin;
+    size_t end;
+  };
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+  void push(size_t queue, const Task& task);
+  bool pop(size_t queue, Task& task);
+  bool steal(size_t thief, Task& task);
+  void execute(size_t queue, Task task);
+  void worker(size_t index);
+
+  std::vector<std::unique_ptr<Queue>> queues; // one for every worker, and a last one for external threads
+  std::vector<std::thread> threads;
+  std::mutex sleepMutex;
+  std::condition_variable sleeping;
+  size_t queued = 0; // protected by sleepMutex
+  bool stopping = false; // protected by sleepMutex
+};
+
+// Executor used by the batch functions if none is given: a WorkStealingExecutor with a thread for every
+// hardware thread, started on first use.
+Executor& DefaultExecutor();
+
+}
@@ -0,0 +1,81 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#pragma once
+
+#include "base.h"
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace libpep {
+
+// factor derived from a secret and a context, together with its inverse
+struct Factor {
+  Scalar value;
+  Scalar inverse;
+};
+
+// Thread safe, size bounded cache of derived factors, so the SHA512 and the scalar inversion are only done once
+// for every (type, secret, context). The cache is split in shards, each with its own lock and LRU list, so threads
+// working on different contexts do not contend for the same mutex.
+class FactorCache {
+ public:
+  struct Statistics {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t size = 0;
+  };
+  explicit FactorCache(size_t capacity = 16384, size_t shards = 16);
+  ~FactorCache();
+  FactorCache(const FactorCache&) = delete;
+  FactorCache& operator=(const FactorCache&) = delete;
+
+  // returns the factor for SHA512(type | secret | context), computing (and caching) it on a miss
+  Factor get(std::string_view type, std::string_view secret, std::string_view context);
+  // out[i] = get(type, secret, contexts[i]), with one (batch) inversion for all the misses
+  void get(std::string_view type, std::string_view secret, std::span<const std::string_view> contexts, std::span<Factor> out);
+  // removes all entries (counters are kept)
+  void clear();
+  Statistics statistics() const;
+
+ private:
+  struct Shard {
+    using LRU = std::list<std::pair<std::string, Factor>>; // most recently used at the front
+    mutable std::mutex mutex;
+    LRU lru;
+    std::unordered_map<std::string_view, LRU::iterator> index; // keys point into the strings in lru
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> misses = 0;
+    std::atomic<uint64_t> evictions = 0;
+  };
+  static std::string MakeKey(std::string_view type, std::string_view secret, std::string_view context);
+  Shard& shardOf(const std::string& key);
+  bool lookup(const std::string& key, Factor& out);
+  void insert(std::string&& key, const Factor& factor);
+  size_t shardCapacity;
+  size_t shardCount;
+  std::unique_ptr<Shard[]> shards;
+};
+
+}
@@ -0,0 +1,104 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#pragma once
+
+#include "core.h"
+
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace libpep {
+
+// Dictionary file from identities to their point on the curve (the hash to the curve of GeneratePseudonym), so
+// identities that come again and again (e.g. in daily feeds) only need the encryption. Identities are not stored:
+// entries are found by a keyed BLAKE2b hash of the identity (with a secret key of the data owner), and carry a
+// row id of the caller (e.g. the primary key of the record), which is found back from a decrypted pseudonym with
+// findRowId. The identities can not be read back from the file, but it is as sensitive as the identities
+// themselves: the points are the unkeyed hash to the curve, so anyone with the file can confirm a guessed identity
+// with findRowId(GroupElement::FromHash(SHA512(guess))). Layout (little endian):
+//   header     magic "LIBPEPD1", version, number of buckets (a power of two) and entries, check value of the key
+//   forward    per bucket: keyed hash (24 bytes), row id (8 bytes) and point (32 bytes), open addressing
+//   reverse    per bucket: 1 + the forward bucket of the point, open addressing on the point
+struct IdentityDictionaryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t buckets;
+  uint64_t entries;
+  uint8_t keyCheck[32];
+};
+
+static const size_t IDENTITY_KEYBYTES = 32;
+using IdentityKey = uint8_t[IDENTITY_KEYBYTES];
+
+// Maps the file in memory (shared, read only), so all processes using the same dictionary share its pages. Throws
+// std::runtime_error if the file can not be opened, is not a valid dictionary or was built with another key.
+// Lookups from multiple threads at the same time are safe.
+class IdentityDictionary {
+ public:
+  IdentityDictionary(const std::string& path, const IdentityKey& key);
+  ~IdentityDictionary();
+  IdentityDictionary(const IdentityDictionary&) = delete;
+  IdentityDictionary& operator=(const IdentityDictionary&) = delete;
+  uint64_t size() const {
+    return header.entries;
+  }
+  // point of the identity (same as GroupElement::FromHash(SHA512(identity)))
+  std::optional<GroupElement> find(std::string_view identity) const;
+  // row id of the identity of a point, e.g. of a decrypted pseudonym
+  std::optional<uint64_t> findRowId(const GroupElement& point) const;
+ private:
+  const uint8_t* data = nullptr;
+  size_t length = 0;
+  IdentityDictionaryHeader header;
+  uint8_t key[IDENTITY_KEYBYTES];
+};
+
+// Builds a dictionary incrementally: the entries of an existing file are loaded, identities are added, and
+// commit() writes a new file next to it that replaces the old one atomically (rename), so readers that have the old
+// file mapped are not affected. Throws std::runtime_error on I/O errors, or if the existing file was built with
+// another key.
+class IdentityDictionaryBuilder {
+ public:
+  IdentityDictionaryBuilder(const std::string& path, const IdentityKey& key);
+  ~IdentityDictionaryBuilder();
+  IdentityDictionaryBuilder(const IdentityDictionaryBuilder&) = delete;
+  IdentityDictionaryBuilder& operator=(const IdentityDictionaryBuilder&) = delete;
+  uint64_t size() const {
+    return entries.size();
+  }
+  // adds identities with their row ids, hashing them on the executor; identities that are already present keep
+  // their row id. Throws std::invalid_argument if the spans have different sizes.
+  void add(std::span<const std::string_view> identities, std::span<const uint64_t> rowIds, Executor& executor = DefaultExecutor());
+  void commit();
+ private:
+  struct Entry {
+    uint64_t rowId;
+    GroupElement point;
+  };
+  std::string path;
+  uint8_t key[IDENTITY_KEYBYTES];
+  std::unordered_map<std::string, Entry> entries; // keyed by the keyed hash of the identity
+};
+
+}
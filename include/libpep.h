@@ -18,6 +18,11 @@ along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
 // Author: Bernard van Gastel
 
 #include "zkp.h"
+#include "curve-backend.h"
+#include "factor-cache.h"
+#include "identity-dictionary.h"
+#include "metrics.h"
+#include "randomizer-pool.h"
 
 namespace libpep {
 
@@ -31,13 +36,37 @@ using LocalDecryptionKey = Scalar;
 std::tuple<GlobalPublicKey, GlobalSecretKey> GenerateGlobalKeys();
 
 GlobalEncryptedPseudonym GeneratePseudonym(const std::string& identity, const GlobalPublicKey& pk);
+// faster when generating many pseudonyms, see PreparePublicKey()
+GlobalEncryptedPseudonym GeneratePseudonym(const std::string& identity, const PreparedPublicKey& pk);
+// out[i] = GeneratePseudonym(identities[i], pk), without copying the identities; hashing to the curve and
+// encrypting are done in chunks on the executor, output in input order
+void GeneratePseudonyms(std::span<const std::string_view> identities, const GlobalPublicKey& pk, std::span<GlobalEncryptedPseudonym> out, Executor& executor = DefaultExecutor());
+void GeneratePseudonyms(std::span<const std::string_view> identities, const PreparedPublicKey& pk, std::span<GlobalEncryptedPseudonym> out, Executor& executor = DefaultExecutor());
+// same, taking the points of the identities from the dictionary (identities not in it are hashed); throws
+// std::invalid_argument if a point in the dictionary is not valid
+void GeneratePseudonyms(std::span<const std::string_view> identities, const IdentityDictionary& dictionary, const PreparedPublicKey& pk, std::span<GlobalEncryptedPseudonym> out, Executor& executor = DefaultExecutor());
+
+// cache of the factors derived from the secrets and contexts, used by the functions below
+FactorCache& DefaultFactorCache();
 
 LocalEncryptedPseudonym ConvertToLocalPseudonym(const GlobalEncryptedPseudonym& p, const std::string_view& secret, const std::string_view& decryptionContext, const std::string_view& pseudonimisationContext);
+// same as RerandomizeLocal(ConvertToLocalPseudonym(...)), but in one pass
+LocalEncryptedPseudonym ConvertToRerandomizedLocalPseudonym(const GlobalEncryptedPseudonym& p, const std::string_view& secret, const std::string_view& decryptionContext, const std::string_view& pseudonimisationContext);
 GlobalEncryptedPseudonym ConvertFromLocalPseudonym(const LocalEncryptedPseudonym& p, const std::string_view& secret, const std::string_view& decryptionContext, const std::string_view& pseudonimisationContext);
+// batch versions, with the factors derived once; processed on the executor, output in input order
+void ConvertToLocalPseudonyms(std::span<const GlobalEncryptedPseudonym> p, const std::string_view& secret, const std::string_view& decryptionContext, const std::string_view& pseudonimisationContext, std::span<LocalEncryptedPseudonym> out, Executor& executor = DefaultExecutor());
+void ConvertToRerandomizedLocalPseudonyms(std::span<const GlobalEncryptedPseudonym> p, const std::string_view& secret, const std::string_view& decryptionContext, const std::string_view& pseudonimisationContext, std::span<LocalEncryptedPseudonym> out, Executor& executor = DefaultExecutor());
+void ConvertFromLocalPseudonyms(std::span<const LocalEncryptedPseudonym> p, const std::string_view& secret, const std::string_view& decryptionContext, const std::string_view& pseudonimisationContext, std::span<GlobalEncryptedPseudonym> out, Executor& executor = DefaultExecutor());
+
+// derives the factors of many contexts at once (with one batch inversion per kind of context) into DefaultFactorCache()
+void PrepareFactors(const std::string_view& secret, std::span<const std::string_view> decryptionContexts, std::span<const std::string_view> pseudonimisationContexts);
 
 LocalDecryptionKey MakeLocalDecryptionKey(const GlobalSecretKey& k, const std::string_view& secret, const std::string_view& decryptionContext);
+// out[i] = MakeLocalDecryptionKey(k, secret, decryptionContexts[i])
+void MakeLocalDecryptionKeys(const GlobalSecretKey& k, const std::string_view& secret, std::span<const std::string_view> decryptionContexts, std::span<LocalDecryptionKey> out);
 
 LocalPseudonym DecryptLocalPseudonym(const LocalEncryptedPseudonym& p, const LocalDecryptionKey& k);
+void DecryptLocalPseudonyms(std::span<const LocalEncryptedPseudonym> p, const LocalDecryptionKey& k, std::span<LocalPseudonym> out, Executor& executor = DefaultExecutor());
 
 GlobalEncryptedPseudonym RerandomizeGlobal(const GlobalEncryptedPseudonym& p);
 LocalEncryptedPseudonym RerandomizeLocal(const LocalEncryptedPseudonym& p);
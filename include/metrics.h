@@ -0,0 +1,197 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runtime metrics: counters of the work done by the library, and latency histograms of its operations. Every thread
+// counts in its own memory (no contention between threads), and a snapshot sums all threads. Collecting metrics
+// costs a few nanoseconds per counted event; define LIBPEP_NO_METRICS (cmake -DMETRICS=OFF) to compile it out, in
+// which case snapshots are always empty.
+
+namespace libpep {
+
+enum class Counter {
+  ScalarMultiplications, // variable base (a multiplication of two points in DoubleScalarMul counts as two)
+  FixedBaseMultiplications, // with a precomputed table: G or a PreparedPublicKey
+  MultiScalarMultiplications,
+  MultiScalarMultiplicationTerms,
+  Inversions, // of scalars
+  Decodings, // of DecodedGroupElement
+  Encodings,
+  Encryptions,
+  Decryptions,
+  Rerandomizations,
+  Rekeys,
+  Reshuffles,
+  RKSs,
+  RKSRs,
+  ProofsCreated,
+  ProofsVerified,
+  ProofVerificationFailures,
+  AggregateProofsCreated,
+  AggregateProofsVerified,
+  AggregateProofVerificationFailures,
+  PseudonymsGenerated,
+  PseudonymsConverted,
+  RandomizerPoolPairsProduced, // by the background threads of RandomizerPools
+  RandomizerPoolPairsTaken,
+  RandomizerPoolFallbacks, // pairs computed inline because the pool was empty
+  COUNT
+};
+
+// operations of which the latency is measured (batch versions measure the whole batch)
+enum class Operation {
+  Encrypt,
+  Decrypt,
+  Rerandomize,
+  Rekey,
+  Reshuffle,
+  RKS,
+  RKSR,
+  EncryptBatch,
+  DecryptBatch,
+  RerandomizeBatch,
+  RekeyBatch,
+  ReshuffleBatch,
+  RKSBatch,
+  RKSRBatch,
+  CreateProof,
+  VerifyProof,
+  VerifyProofBatch,
+  CreateAggregateProof,
+  VerifyAggregateProof,
+  GeneratePseudonym,
+  GeneratePseudonyms,
+  ConvertPseudonym,
+  ConvertPseudonyms,
+  COUNT
+};
+
+const char* Name(Counter counter);
+const char* Name(Operation operation);
+
+// Latencies in nanoseconds, in buckets with a relative width of at most 1/8 (like HDR histograms): values below 8
+// have their own bucket, larger values are grouped by their highest bit and the 3 bits below it.
+struct Histogram {
+  static const constexpr size_t SUB_BUCKETS = 8;
+  static const constexpr size_t MAX_EXPONENT = 40; // values from 2^41 ns (about 36 minutes) are counted in the last bucket
+  static const constexpr size_t BUCKETS = (MAX_EXPONENT - 1) * SUB_BUCKETS;
+  uint64_t buckets[BUCKETS] = {};
+  uint64_t count = 0;
+  uint64_t sum = 0; // nanoseconds
+  static size_t BucketOf(uint64_t nanoseconds);
+  // largest value counted in the bucket
+  static uint64_t UpperBound(size_t bucket);
+  // upper bound of the bucket of the q-th quantile (0 <= q <= 1), 0 if empty
+  uint64_t quantile(double q) const;
+};
+
+// gauges of a live RandomizerPool
+struct RandomizerPoolGauges {
+  uint64_t id = 0; // of the registration, tells the pools apart
+  size_t depth = 0; // pairs ready for use
+  size_t capacity = 0;
+};
+
+struct MetricsSnapshot {
+  uint64_t counters[size_t(Counter::COUNT)] = {};
+  Histogram latencies[size_t(Operation::COUNT)];
+  std::vector<RandomizerPoolGauges> randomizerPools; // ordered by id
+  uint64_t operator[](Counter counter) const {
+    return counters[size_t(counter)];
+  }
+  const Histogram& operator[](Operation operation) const {
+    return latencies[size_t(operation)];
+  }
+};
+
+// sum of the metrics of all threads (including threads that have ended) since the start or the last ResetMetrics()
+MetricsSnapshot Metrics();
+void ResetMetrics();
+
+// Every snapshot calls gauges (with the registry locked) for the depth and capacity of the pool, until it is
+// unregistered; a RandomizerPool registers itself. Returns the id of the registration (0 with LIBPEP_NO_METRICS).
+uint64_t RegisterRandomizerPool(std::function<RandomizerPoolGauges()> gauges);
+// after this returns gauges is no longer called
+void UnregisterRandomizerPool(uint64_t id);
+
+// Prometheus text exposition format: counters as libpep_<name>_total, latencies as the histogram
+// libpep_operation_duration_seconds{operation="<name>"} with a bucket per power of two (from about 1 µs to 17 s),
+// and the gauges libpep_randomizer_pool_depth{pool="<id>"} and libpep_randomizer_pool_capacity{pool="<id>"}
+std::string ToPrometheus(const MetricsSnapshot& snapshot);
+// writes ToPrometheus(snapshot) to a file atomically (write and rename), e.g. for the textfile collector of the
+// Prometheus node exporter; throws std::runtime_error on I/O errors
+void WriteMetrics(const std::string& path, const MetricsSnapshot& snapshot);
+// WriteMetrics(path, Metrics())
+void WriteMetrics(const std::string& path);
+
+// Calls callback with a snapshot every interval on a background thread, until destroyed.
+class MetricsExporter {
+ public:
+  MetricsExporter(std::chrono::milliseconds interval, std::function<void(const MetricsSnapshot&)> callback);
+  // writes the metrics to path every interval (errors are ignored, as there is no one to report them to)
+  MetricsExporter(std::chrono::milliseconds interval, const std::string& path);
+  ~MetricsExporter();
+  MetricsExporter(const MetricsExporter&) = delete;
+  MetricsExporter& operator=(const MetricsExporter&) = delete;
+ private:
+  struct State;
+  std::shared_ptr<State> state;
+  std::thread thread;
+};
+
+#if defined(LIBPEP_NO_METRICS)
+
+inline void Count(Counter, uint64_t = 1) {
+}
+
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Operation) {
+  }
+};
+
+#else
+
+void Count(Counter counter, uint64_t n = 1);
+// records the time from construction to destruction in the histogram of the operation
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Operation _operation) : operation(_operation), start(std::chrono::steady_clock::now()) {
+  }
+  ~ScopedTimer();
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+ private:
+  Operation operation;
+  std::chrono::steady_clock::time_point start;
+};
+
+#endif
+
+}
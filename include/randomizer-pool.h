@@ -0,0 +1,99 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#pragma once
+
+#include "core.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace libpep {
+
+// Precomputed randomness for one public key Y: pairs (r*G, r*Y) for random r, so Encrypt and Rerandomize do
+// not have to compute two scalar multiplications on the request path. A background thread keeps a lock free
+// ring of pairs filled; every pair is used once and wiped after use. When the ring is empty the pair is
+// computed inline (with a prepared Y), so a pool is never slower than not using one. Opt-in, as the
+// background thread uses a core.
+class RandomizerPool {
+ public:
+  struct Statistics {
+    size_t depth = 0; // pairs ready for use
+    size_t capacity = 0;
+    uint64_t produced = 0; // pairs computed by the background thread (the refill rate is its change over time)
+    uint64_t taken = 0; // pairs taken from the ring
+    uint64_t fallbacks = 0; // pairs computed inline because the ring was empty
+  };
+  // single use (r*G, r*Y), wiped when destroyed
+  struct Randomizer {
+    GroupElement B; // r*G encoded
+    DecodedGroupElement R; // r*G
+    DecodedGroupElement RY; // r*Y
+    Randomizer() = default;
+    Randomizer(const Randomizer& rhs) = default;
+    Randomizer& operator=(const Randomizer& rhs) = default;
+    ~Randomizer();
+  };
+  // capacity is rounded up to a power of two; throws std::invalid_argument if Y is zero or capacity is 0
+  explicit RandomizerPool(const GroupElement& Y, size_t capacity = 1024);
+  ~RandomizerPool();
+  RandomizerPool(const RandomizerPool&) = delete;
+  RandomizerPool& operator=(const RandomizerPool&) = delete;
+
+  const PreparedPublicKey& publicKey() const {
+    return Y;
+  }
+  // a pair from the ring, or computed inline if the ring is empty
+  Randomizer take();
+  Statistics statistics() const;
+
+ private:
+  // Bounded queue of Vyukov: the sequence number of a cell tells if it can be written (sequence == position) or
+  // read (sequence == position + 1), so producer and consumers only synchronise on the cell they use.
+  struct Cell {
+    std::atomic<size_t> sequence;
+    Randomizer value;
+  };
+  Randomizer compute() const;
+  bool push(const Randomizer& value);
+  bool pop(Randomizer& out);
+  size_t depth() const;
+  void fill();
+
+  PreparedPublicKey Y;
+  size_t mask;
+  std::unique_ptr<Cell[]> cells;
+  alignas(64) std::atomic<size_t> enqueuePosition = 0;
+  alignas(64) std::atomic<size_t> dequeuePosition = 0;
+  std::atomic<bool> full = false; // the background thread waits on this until a pair is taken
+  std::atomic<bool> stopping = false;
+  std::atomic<uint64_t> produced = 0;
+  std::atomic<uint64_t> taken = 0;
+  std::atomic<uint64_t> fallbacks = 0;
+  uint64_t metricsId; // registration of the depth gauge
+  std::thread thread;
+};
+
+// Encrypt and Rerandomize with a pair from the pool; Rerandomize throws std::invalid_argument if the public key of
+// the pool is not the public key of the tuple (in.Y)
+ElGamal Encrypt(const GroupElement& M, RandomizerPool& pool);
+ElGamal Rerandomize(const ElGamal& in, RandomizerPool& pool);
+
+}
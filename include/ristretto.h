@@ -0,0 +1,124 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#pragma once
+
+#include "base.h"
+
+#include <memory>
+#include <span>
+
+namespace libpep {
+
+// element of GF(2^255-19), five limbs of 51 bits (not necessarily fully reduced)
+struct FieldElement {
+  uint64_t v[5];
+};
+
+// A GroupElement in extended coordinates (X:Y:Z:T) on the underlying Edwards curve.
+// Every operation on a GroupElement decodes its arguments (an inverse square root)
+// and encodes the result again. A DecodedGroupElement skips that: only decode once,
+// and only encode when the bytes are needed (encode(), hex(), comparisons).
+struct DecodedGroupElement {
+  FieldElement X;
+  FieldElement Y;
+  FieldElement Z;
+  FieldElement T;
+  // identity (zero) element
+  DecodedGroupElement();
+  // throws std::invalid_argument if the encoding is not canonical
+  explicit DecodedGroupElement(const GroupElement& encoded);
+  // returns std::nullopt if the encoding is not canonical
+  static std::optional<DecodedGroupElement> Decode(const GroupElement& encoded);
+  GroupElement encode() const;
+  bool is_zero() const;
+  std::string hex() const;
+  static DecodedGroupElement FromHex(std::string_view view);
+  // returns a group element which can be zero
+  static DecodedGroupElement Random();
+  // returns a group element which can be zero, same result as GroupElement::FromHash
+  static DecodedGroupElement FromHash(uint8_t (&value)[64]);
+  // s * G, using a precomputed table for G
+  static DecodedGroupElement MultBase(const Scalar& s);
+  // Same as MultBase, but variable time and the result can be zero. Only for public scalars (verifying proofs):
+  // never for keys, factors or the random values of encryptions and proofs.
+  static DecodedGroupElement MultBaseVartime(const Scalar& s);
+};
+
+// compares the points without encoding them (four field multiplications)
+bool operator==(const DecodedGroupElement& lhs, const DecodedGroupElement& rhs);
+bool operator!=(const DecodedGroupElement& lhs, const DecodedGroupElement& rhs);
+
+DecodedGroupElement operator+(const DecodedGroupElement& lhs, const DecodedGroupElement& rhs);
+DecodedGroupElement operator-(const DecodedGroupElement& lhs, const DecodedGroupElement& rhs);
+DecodedGroupElement operator-(const DecodedGroupElement& rhs);
+// constant time
+DecodedGroupElement operator*(const Scalar& lhs, const DecodedGroupElement& rhs);
+DecodedGroupElement operator/(const DecodedGroupElement& lhs, const Scalar& rhs);
+// s * P, variable time (width 5 NAF) and the result can be zero. Like the other Vartime functions only for public
+// values, such as the scalars and points of a proof that is verified.
+DecodedGroupElement ScalarMulVartime(const Scalar& s, const DecodedGroupElement& P);
+
+// Group element together with a precomputed table of its multiples (in the same layout as the table for G,
+// about 30 KB), so s * P costs about the same as s * G. Worth it for long lived elements such as public keys.
+// Copies share the table.
+class PreparedGroupElement {
+ public:
+  explicit PreparedGroupElement(const GroupElement& P);
+  explicit PreparedGroupElement(const DecodedGroupElement& P);
+  const GroupElement& encoded() const {
+    return _encoded;
+  }
+  const DecodedGroupElement& decoded() const {
+    return _decoded;
+  }
+ private:
+  struct Table;
+  GroupElement _encoded;
+  DecodedGroupElement _decoded;
+  std::shared_ptr<const Table> table;
+  friend DecodedGroupElement operator*(const Scalar& lhs, const PreparedGroupElement& rhs);
+};
+
+// constant time
+DecodedGroupElement operator*(const Scalar& lhs, const PreparedGroupElement& rhs);
+
+// a*P + b*Q, constant time; cheaper than two separate multiplications because the doublings are shared
+DecodedGroupElement DoubleScalarMul(const Scalar& a, const DecodedGroupElement& P, const Scalar& b, const DecodedGroupElement& Q);
+// a*P + b*Q (or a*G + b*Q), variable time: Straus' method with interleaved width 5 NAFs, so both multiplications
+// share their doublings. Only for public values, like ScalarMulVartime.
+DecodedGroupElement DoubleScalarMulVartime(const Scalar& a, const DecodedGroupElement& P, const Scalar& b, const DecodedGroupElement& Q);
+DecodedGroupElement DoubleScalarMulVartime(const Scalar& a, const _G& G, const Scalar& b, const DecodedGroupElement& Q);
+
+// out[i] = (in[i] + in[i]).encode(). Encoding a doubled point needs no inverse square root, so the whole batch
+// shares one field inversion. To encode many points at once, compute them halved (e.g. by halving the scalar
+// they are multiplied with) and use this function.
+void DoubleAndEncodeBatch(std::span<const DecodedGroupElement> in, std::span<GroupElement> out);
+
+// Sum of scalars[i] * points[i] (can be zero), cheaper than separate multiplications as the doublings are shared.
+// Throws std::invalid_argument if the spans have different sizes, or (GroupElement version) if a point is not valid.
+// Constant time, using Straus' method with signed radix 16 digits.
+DecodedGroupElement MultiScalarMul(std::span<const Scalar> scalars, std::span<const DecodedGroupElement> points);
+GroupElement MultiScalarMul(std::span<const Scalar> scalars, std::span<const GroupElement> points);
+// Variable time, so only for public values (e.g. verifying proofs). Uses Straus' method with a width 5 NAF
+// for small inputs, and Pippenger's bucket method for larger inputs (from about 190 points).
+DecodedGroupElement MultiScalarMulVartime(std::span<const Scalar> scalars, std::span<const DecodedGroupElement> points);
+GroupElement MultiScalarMulVartime(std::span<const Scalar> scalars, std::span<const GroupElement> points);
+
+}
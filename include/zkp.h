@@ -19,6 +19,8 @@ along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "core.h"
 
+#include <vector>
+
 namespace libpep {
 
 // offline Schnorr proof
@@ -41,6 +43,45 @@ std::tuple<GroupElement,Proof> CreateProof(const Scalar& a /*secret*/, const Gro
 
 [[nodiscard]] bool VerifyProof(const GroupElement& A, const GroupElement& M, const Proof& p);
 
+// Verifies the proofs p[i] for (A[i], M[i]) at once, returns for every proof if it is valid.
+// All equations are combined with random weights into one multi scalar multiplication. Only if that
+// check fails, the batch is split in halves (recursively) to find the invalid proofs.
+// Decoding the proofs and the multiplication are split over the executor.
+// Throws std::invalid_argument if the spans have different sizes.
+[[nodiscard]] std::vector<bool> VerifyProofBatch(std::span<const GroupElement> A, std::span<const GroupElement> M, std::span<const Proof> p, Executor& executor = DefaultExecutor());
+
+// Proof without the commitments C1 and C2 (96 instead of 128 bytes), which the verifier recomputes as
+// C1 = s*G - e*A and C2 = s*M - e*N, before checking the challenge e. Can not be verified with VerifyProofBatch.
+struct CompactProof {
+  GroupElement N;
+  Scalar e;
+  Scalar s;
+
+  GroupElement value() const {
+    return N;
+  }
+};
+
+// compact form of proof p for (A, M) (recomputes its challenge)
+CompactProof Compact(const GroupElement& A, const GroupElement& M, const Proof& p);
+[[nodiscard]] bool VerifyProof(const GroupElement& A, const GroupElement& M, const CompactProof& p);
+
+// Aggregated proof that N[i] = a * M[i] for all i with the same secret a (and A = a*G). The points are combined,
+// with weights derived from all of them (Fiat-Shamir), into M* and N*, and one proof of equal discrete logarithms
+// is given for (G, A) and (M*, N*). The proof has a fixed size, and verifying it costs one multi scalar
+// multiplication over the (distinct) points instead of verifying a proof per point.
+struct AggregateProof {
+  GroupElement C1;
+  GroupElement C2;
+  Scalar s;
+};
+
+// returns <A=a*G, proof>; N[i] should be a*M[i], computed by the caller (e.g. with the batch functions of core.h).
+// Throws std::invalid_argument if the spans have different sizes or a point of M is not valid. For empty spans the
+// proof only shows knowledge of a (C2 is zero), and verifies as such.
+std::tuple<GroupElement,AggregateProof> CreateAggregateProof(const Scalar& a, std::span<const GroupElement> M, std::span<const GroupElement> N, Executor& executor = DefaultExecutor());
+[[nodiscard]] bool VerifyAggregateProof(const GroupElement& A, std::span<const GroupElement> M, std::span<const GroupElement> N, const AggregateProof& p, Executor& executor = DefaultExecutor());
+
 //// SIGNATURES
 
 using Signature = Proof;
@@ -58,6 +99,13 @@ ProvedRerandomize ProveRerandomize(const ElGamal& in, const Scalar& s = Scalar::
 
 [[nodiscard]] std::optional<ElGamal> VerifyRerandomize(const ElGamal& in, const ProvedRerandomize& p);
 [[nodiscard]] std::optional<ElGamal> VerifyRerandomize(const GroupElement& B, const GroupElement& C, const GroupElement& Y, const GroupElement& S, const Proof& p);
+// batch version, verifies all proofs with VerifyProofBatch
+[[nodiscard]] std::vector<std::optional<ElGamal>> VerifyRerandomize(std::span<const ElGamal> in, std::span<const ProvedRerandomize> p, Executor& executor = DefaultExecutor());
+
+// with compact proofs (see CompactProof); Compact(in, p) converts the result of the corresponding Prove function
+using CompactProvedRerandomize = std::tuple<GroupElement,CompactProof>;
+CompactProvedRerandomize Compact(const ElGamal& in, const ProvedRerandomize& p);
+[[nodiscard]] std::optional<ElGamal> VerifyRerandomize(const ElGamal& in, const CompactProvedRerandomize& p);
 
 //// RESHUFFLE
 
@@ -67,9 +115,22 @@ ProvedReshuffle ProveReshuffle(const ElGamal& in, const Scalar& n);
 
 [[nodiscard]] std::optional<ElGamal> VerifyReshuffle(const ElGamal& in, const ProvedReshuffle& p);
 [[nodiscard]] std::optional<ElGamal> VerifyReshuffle(const GroupElement& B, const GroupElement& C, const GroupElement& Y, const GroupElement& AB, const Proof& pb, const Proof& pc);
+[[nodiscard]] std::vector<std::optional<ElGamal>> VerifyReshuffle(std::span<const ElGamal> in, std::span<const ProvedReshuffle> p, Executor& executor = DefaultExecutor());
 
 GroupElement ReshuffledBy(const ProvedReshuffle& in);
 
+using CompactProvedReshuffle = std::tuple<GroupElement,CompactProof,CompactProof>;
+CompactProvedReshuffle Compact(const ElGamal& in, const ProvedReshuffle& p);
+[[nodiscard]] std::optional<ElGamal> VerifyReshuffle(const ElGamal& in, const CompactProvedReshuffle& p);
+
+// Reshuffle of a whole batch with the same n (out[i] = Reshuffle(in[i], n)), proven with one aggregated proof
+// instead of two proofs per tuple. Throws std::invalid_argument if the spans have different sizes.
+using ProvedReshuffleBatch = std::tuple<GroupElement,AggregateProof>;
+ProvedReshuffleBatch ProveReshuffleBatch(std::span<const ElGamal> in, const Scalar& n, std::span<ElGamal> out, Executor& executor = DefaultExecutor());
+// returns if out is the reshuffle of in with the factor of the proof
+[[nodiscard]] bool VerifyReshuffleBatch(std::span<const ElGamal> in, std::span<const ElGamal> out, const ProvedReshuffleBatch& p, Executor& executor = DefaultExecutor());
+GroupElement ReshuffledBy(const ProvedReshuffleBatch& in);
+
 //// REKEY
 
 using ProvedRekey = std::tuple<GroupElement,Proof,GroupElement,Proof>;
@@ -77,10 +138,21 @@ ProvedRekey ProveRekey(const ElGamal& in, const Scalar& k);
 
 [[nodiscard]] std::optional<ElGamal> VerifyRekey(const ElGamal& in, const ProvedRekey& p);
 [[nodiscard]] std::optional<ElGamal> VerifyRekey(const GroupElement& B, const GroupElement& C, const GroupElement& Y, const GroupElement& AB, const Proof& pb, const GroupElement& AY, const Proof& py);
+[[nodiscard]] std::vector<std::optional<ElGamal>> VerifyRekey(std::span<const ElGamal> in, std::span<const ProvedRekey> p, Executor& executor = DefaultExecutor());
 
 // return k.base() after ProveRekey(in, k)
 GroupElement RekeyBy(const ProvedRekey& in);
 
+using CompactProvedRekey = std::tuple<GroupElement,CompactProof,GroupElement,CompactProof>;
+CompactProvedRekey Compact(const ElGamal& in, const ProvedRekey& p);
+[[nodiscard]] std::optional<ElGamal> VerifyRekey(const ElGamal& in, const CompactProvedRekey& p);
+
+// Rekey of a whole batch with the same k, with one aggregated proof for all B and one for all Y
+using ProvedRekeyBatch = std::tuple<GroupElement,AggregateProof,GroupElement,AggregateProof>;
+ProvedRekeyBatch ProveRekeyBatch(std::span<const ElGamal> in, const Scalar& k, std::span<ElGamal> out, Executor& executor = DefaultExecutor());
+[[nodiscard]] bool VerifyRekeyBatch(std::span<const ElGamal> in, std::span<const ElGamal> out, const ProvedRekeyBatch& p, Executor& executor = DefaultExecutor());
+GroupElement RekeyBy(const ProvedRekeyBatch& in);
+
 //// RKS
 
 using ProvedRKS = std::tuple<GroupElement,Proof,GroupElement,Proof,GroupElement,Proof>;
@@ -89,10 +161,35 @@ ProvedRKS ProveRKS(const ElGamal& in, const Scalar& k, const Scalar& n);
 
 [[nodiscard]] std::optional<ElGamal> VerifyRKS(const ElGamal& in, const ProvedRKS& p);
 [[nodiscard]] std::optional<ElGamal> VerifyRKS(const GroupElement& B, const GroupElement& C, const GroupElement& Y, const GroupElement& AB, const Proof& pb, const GroupElement& AC, const Proof& pc, const GroupElement& AY, const Proof& py);
+[[nodiscard]] std::vector<std::optional<ElGamal>> VerifyRKS(std::span<const ElGamal> in, std::span<const ProvedRKS> p, Executor& executor = DefaultExecutor());
 
 // return n.base() after ProveRKS(in, k, n)
 GroupElement ReshuffledBy(const ProvedRKS& in);
 // return k.base() after ProveRKS(in, k, n)
 GroupElement RekeyBy(const ProvedRKS& in);
 
+using CompactProvedRKS = std::tuple<GroupElement,CompactProof,GroupElement,CompactProof,GroupElement,CompactProof>;
+CompactProvedRKS Compact(const ElGamal& in, const ProvedRKS& p);
+[[nodiscard]] std::optional<ElGamal> VerifyRKS(const ElGamal& in, const CompactProvedRKS& p);
+
+// RKS of a whole batch with the same k and n, with one aggregated proof for each of the components C, Y and B
+// (same order as ProvedRKS). When all tuples have the same public key, the proof for Y costs about as much as
+// for a single tuple.
+using ProvedRKSBatch = std::tuple<GroupElement,AggregateProof,GroupElement,AggregateProof,GroupElement,AggregateProof>;
+ProvedRKSBatch ProveRKSBatch(std::span<const ElGamal> in, const Scalar& k, const Scalar& n, std::span<ElGamal> out, Executor& executor = DefaultExecutor());
+[[nodiscard]] bool VerifyRKSBatch(std::span<const ElGamal> in, std::span<const ElGamal> out, const ProvedRKSBatch& p, Executor& executor = DefaultExecutor());
+GroupElement ReshuffledBy(const ProvedRKSBatch& in);
+GroupElement RekeyBy(const ProvedRKSBatch& in);
+
+//// SERIALISATION
+
+// Binary encoding of Proof, CompactProof, AggregateProof and all Proved* tuples (including the compact and batch
+// ones): the 32 byte encodings of their group elements and scalars, in order of declaration. Deserialize throws
+// std::invalid_argument if the size is wrong or a group element or scalar is not valid or zero (as FromHex), except
+// for C2 of an AggregateProof, which is zero for an empty batch.
+template <typename T>
+std::string Serialize(const T& value);
+template <typename T>
+T Deserialize(std::string_view in);
+
 }
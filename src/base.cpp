@@ -19,12 +19,25 @@ along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "base.h"
 
+#include <atomic>
+#include <cstring>
+#include <mutex>
 #include <type_traits>
 #include <random>
-#include <sstream>
+#include <vector>
 
+#include "curve-backend.h"
+#include "metrics.h"
 #include "sodium.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
 using namespace libpep;
 
 extern "C" [[noreturn]] void CrashAssert(const char* func, const char* file, int line, const char* condition, const char* explanation) {
@@ -37,13 +50,95 @@ static_assert(crypto_core_ristretto255_BYTES == GroupElement::BYTES);
 
 // documentation of libsodium primitives: https://libsodium.gitbook.io/doc/advanced/point-arithmetic/ristretto
 
+namespace {
+
+std::atomic<bool> bufferedRandom = false;
+// incremented in the child after a fork, so generators copied from the parent are reseeded before use
+std::atomic<uint64_t> forkGeneration = 0;
+
+// Per thread ChaCha20 generator. Every refill produces KEY + BUFFER bytes of key stream: the first KEY bytes are
+// the next key, the rest is handed out (and wiped when handed out).
+class ThreadRandom {
+ public:
+  ~ThreadRandom() {
+    sodium_memzero(this, sizeof(*this));
+  }
+  void get(uint8_t* out, size_t length) {
+    if (generation != forkGeneration.load(std::memory_order_relaxed))
+      reseed();
+    while (length > 0) {
+      if (position == sizeof(stream))
+        refill();
+      size_t n = std::min(length, sizeof(stream) - position);
+      memcpy(out, stream + position, n);
+      sodium_memzero(stream + position, n);
+      position += n;
+      out += n;
+      length -= n;
+    }
+  }
+ private:
+  static const size_t KEY = crypto_stream_chacha20_KEYBYTES;
+  static const size_t BUFFER = 1024;
+  static const uint64_t RESEED = (1 << 20) / BUFFER; // refills between reseeds
+  uint8_t key[KEY];
+  uint8_t stream[KEY + BUFFER];
+  size_t position = sizeof(stream);
+  uint64_t refills = 0;
+  uint64_t generation = ~uint64_t(0); // not seeded yet
+  void reseed() {
+    randombytes_buf(key, sizeof(key));
+    sodium_memzero(stream, sizeof(stream));
+    position = sizeof(stream);
+    refills = 0;
+    generation = forkGeneration.load(std::memory_order_relaxed);
+  }
+  void refill() {
+    if (++refills > RESEED)
+      reseed();
+    // a key is used for one stream only, so a fixed nonce is fine
+    static const uint8_t nonce[crypto_stream_chacha20_NONCEBYTES] = {};
+    crypto_stream_chacha20(stream, sizeof(stream), nonce, key);
+    memcpy(key, stream, KEY);
+    sodium_memzero(stream, KEY);
+    position = KEY;
+  }
+};
+
+thread_local ThreadRandom threadRandom;
+
+void RegisterForkHandler() {
+#if !defined(_WIN32)
+  static std::once_flag once;
+  std::call_once(once, [] {
+    pthread_atfork(nullptr, nullptr, [] {
+      forkGeneration.fetch_add(1, std::memory_order_relaxed);
+    });
+  });
+#endif
+}
+
+}
+
+void libpep::SetBufferedRandom(bool enabled) {
+  if (enabled)
+    RegisterForkHandler();
+  bufferedRandom = enabled;
+}
+
+bool libpep::BufferedRandom() {
+  return bufferedRandom.load(std::memory_order_relaxed);
+}
+
 GroupElement Scalar::mult_base() const {
+  Count(Counter::FixedBaseMultiplications);
   GroupElement r;
   if (crypto_scalarmult_ristretto255_base(r.value, value) != 0)
     throw std::invalid_argument("base of scalar gave error (probably scalar is 0)");
   return r;
 }
 Scalar Scalar::invert() const {
+  Count(Counter::Inversions);
   Scalar r;
   if (0 != crypto_core_ristretto255_scalar_invert(r.value, value)) {
     throw std::invalid_argument("Scalar::invert() on 0 scalar");
@@ -60,6 +155,32 @@ Scalar Scalar::complement() const {
   crypto_core_ristretto255_scalar_complement(r.value, value);
   return r;
 }
+size_t Scalar::BatchInvert(std::span<Scalar> values) {
+  // prefix[i] = product of the non zero values before i
+  std::vector<Scalar> prefix(values.size());
+  Scalar product;
+  product.value[0] = 1;
+  size_t zeros = 0;
+  for (size_t i = 0; i < values.size(); ++i) {
+    prefix[i] = product;
+    if (values[i].is_zero()) {
+      ++zeros;
+      continue;
+    }
+    product = product * values[i];
+  }
+  // inverse = (product of the values up to and including i)^-1, walking backwards
+  Scalar inverse = product.invert();
+  for (size_t i = values.size(); i-- > 0;) {
+    if (values[i].is_zero())
+      continue;
+    Scalar retval = inverse * prefix[i];
+    inverse = inverse * values[i];
+    values[i] = retval;
+  }
+  return zeros;
+}
+
 bool Scalar::is_zero() const {
   return sodium_is_zero(value, sizeof(value));
 }
@@ -97,14 +218,46 @@ Scalar Scalar::FromHex(std::string_view view) {
     throw std::invalid_argument("Scalar::FromHex produced invalid or zero Scalar");
   return retval;
 }
+std::vector<bool> Scalar::FromHexBatch(std::span<const std::string_view> in, std::span<Scalar> out) {
+  if (in.size() != out.size())
+    throw std::invalid_argument("Scalar::FromHexBatch expected output of the same size as the input");
+  std::vector<bool> retval(in.size());
+  for (size_t i = 0; i < in.size(); ++i) {
+    retval[i] = TryFromHex(out[i].value, sizeof(out[i].value), in[i]) && out[i].is_valid() && !out[i].is_zero();
+    if (!retval[i])
+      out[i] = Scalar();
+  }
+  return retval;
+}
 Scalar Scalar::Random() {
   Scalar r;
+  if (BufferedRandom()) {
+    RandomBatch({&r, 1});
+    return r;
+  }
   // does random bytes, and check if it is canonical and != zero
   crypto_core_ristretto255_scalar_random(r.value);
   EXPECT(r.is_valid());
   EXPECT(!r.is_zero());
   return r;
 }
+void Scalar::RandomBatch(std::span<Scalar> out) {
+  // 64 random bytes reduced modulo L are uniform (as in FromHash, without the fix for zero)
+  const size_t CHUNK = 16;
+  uint8_t random[CHUNK][64];
+  for (size_t begin = 0; begin < out.size(); begin += CHUNK) {
+    size_t n = std::min(CHUNK, out.size() - begin);
+    RandomBytes(random, n * sizeof(random[0]));
+    for (size_t i = 0; i < n; ++i) {
+      crypto_core_ristretto255_scalar_reduce(out[begin + i].value, random[i]);
+      while (out[begin + i].is_zero()) {
+        RandomBytes(random[i]);
+        crypto_core_ristretto255_scalar_reduce(out[begin + i].value, random[i]);
+      }
+    }
+  }
+  sodium_memzero(random, sizeof(random));
+}
 Scalar Scalar::FromHash(uint8_t (&value)[64]) {
   Scalar r;
   crypto_core_ristretto255_scalar_reduce(r.value, value);
@@ -136,12 +289,75 @@ GroupElement GroupElement::FromHash(uint8_t (&value)[64]) {
   crypto_core_ristretto255_from_hash(r.value, value);
   return r;
 }
+std::vector<bool> GroupElement::FromHexBatch(std::span<const std::string_view> in, std::span<GroupElement> out) {
+  if (in.size() != out.size())
+    throw std::invalid_argument("GroupElement::FromHexBatch expected output of the same size as the input");
+  std::vector<bool> retval(in.size());
+  for (size_t i = 0; i < in.size(); ++i) {
+    retval[i] = TryFromHex(out[i].value, sizeof(out[i].value), in[i]) && out[i].is_valid() && !out[i].is_zero();
+    if (!retval[i])
+      out[i] = GroupElement();
+  }
+  return retval;
+}
 GroupElement GroupElement::Random() {
   GroupElement r;
+  if (BufferedRandom()) {
+    uint8_t random[64];
+    RandomBytes(random);
+    crypto_core_ristretto255_from_hash(r.value, random);
+    sodium_memzero(random, sizeof(random));
+    return r;
+  }
   // random bytes and calls *_from_hash(...)
   crypto_core_ristretto255_random(r.value);
   return r;
 }
+namespace {
+
+// Hex encoding and decoding without branches on the data (keys are secret), as in libsodium. With SSE2, which all
+// x86-64 processors have, 16 bytes are handled at once; the values encoded are at most 96 bytes, so wider vectors
+// would not pay off.
+
+// hex digit of x (0 to 15)
+char HexDigit(unsigned x) {
+  // 9 - x wraps around for x > 9, adding 'a' - '0' - 10
+  return char('0' + x + (((9 - x) >> 8) & 39));
+}
+
+// value of hex digit c, with bits above the lowest 8 set if c is not a hex digit
+unsigned HexValue(uint8_t c) {
+  unsigned num = c ^ 48U;
+  unsigned numMask = ((num - 10U) >> 8) & 0xFF; // 0xFF for '0' to '9'
+  unsigned alpha = (c & ~32U) - 55U;
+  unsigned alphaMask = (((alpha - 10U) ^ (alpha - 16U)) >> 8) & 0xFF; // 0xFF for 'a' to 'f' and 'A' to 'F'
+  return (numMask & num) | (alphaMask & alpha) | ((numMask | alphaMask) ^ 0xFF) << 8;
+}
+
+#if defined(__SSE2__)
+__m128i HexDigits(__m128i nibbles) {
+  __m128i alpha = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+  return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), _mm_and_si128(alpha, _mm_set1_epi8(39)));
+}
+
+// values of 16 hex digits; marks the characters that are not hex digits in invalid
+__m128i HexValues(__m128i chars, __m128i& invalid) {
+  __m128i num = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+  __m128i isNum = _mm_and_si128(_mm_cmpgt_epi8(num, _mm_set1_epi8(-1)), _mm_cmplt_epi8(num, _mm_set1_epi8(10)));
+  __m128i alpha = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+  __m128i isAlpha = _mm_and_si128(_mm_cmpgt_epi8(alpha, _mm_set1_epi8(-1)), _mm_cmplt_epi8(alpha, _mm_set1_epi8(6)));
+  invalid = _mm_or_si128(invalid, _mm_xor_si128(_mm_or_si128(isNum, isAlpha), _mm_set1_epi8(-1)));
+  return _mm_or_si128(_mm_and_si128(isNum, num), _mm_and_si128(isAlpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+}
+
+// pairs of values (high nibble first) to bytes, in the low byte of every 16 bit lane
+__m128i HexPack(__m128i values) {
+  return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(values, _mm_set1_epi16(0xFF)), 4), _mm_srli_epi16(values, 8));
+}
+#endif
+
+}
+
 namespace libpep {
 
 GroupElement operator+(const GroupElement& lhs, const GroupElement& rhs) {
@@ -185,12 +401,19 @@ Scalar operator/(const Scalar& lhs, const Scalar& rhs) {
   return !operator==(lhs, rhs);
 }
 GroupElement operator*(const Scalar& lhs, const GroupElement& rhs) {
+  // the SIMD backends only work on decoded points (same result, and counted there)
+  if (ActiveCurveBackend() != CurveBackend::Libsodium)
+    return (lhs * DecodedGroupElement(rhs)).encode();
+  Count(Counter::ScalarMultiplications);
   GroupElement r;
   if (0 != crypto_scalarmult_ristretto255(r.value, lhs.value, rhs.value))
     throw std::invalid_argument("Scalar*GroupElement gave error (one of them is 0)");
   return r;
 }
 GroupElement operator/(const GroupElement& lhs, const Scalar& rhs) {
+  if (ActiveCurveBackend() != CurveBackend::Libsodium)
+    return (DecodedGroupElement(lhs) / rhs).encode();
+  Count(Counter::ScalarMultiplications);
   GroupElement r;
   if (0 != crypto_scalarmult_ristretto255(r.value, rhs.invert().value, lhs.value))
     throw std::invalid_argument("GroupElement/Scalar gave error (one of them is 0)");
@@ -208,6 +431,9 @@ GroupElement operator*(const Scalar& lhs, const _G&) {
 }
 
 void RandomBytes(void* ptr, std::size_t length) {
+  if (BufferedRandom())
+    threadRandom.get(static_cast<uint8_t*>(ptr), length);
+  else
     ::randombytes_buf(ptr, length);
 }
 
@@ -236,13 +462,51 @@ void SHA512State::finish(HashSHA512& out) && {
 }
 
 std::string ToHex(std::string_view in) {
-  std::stringstream output;
-  output << std::hex;
-  for (auto sc : in) {
-    auto c = uint8_t(sc);
-    output << int(c >> 4) << int(c & 0xF);
+  std::string retval(2 * in.size(), '\0');
+  ToHex(in, retval.data());
+  return retval;
+}
+
+void ToHex(std::string_view in, char* out) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i mask = _mm_set1_epi8(0x0F);
+  for (; i + 16 <= in.size(); i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in.data() + i));
+    __m128i high = HexDigits(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+    __m128i low = HexDigits(_mm_and_si128(v, mask));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 16), _mm_unpackhi_epi8(high, low));
+  }
+#endif
+  for (; i < in.size(); ++i) {
+    auto c = uint8_t(in[i]);
+    out[2 * i] = HexDigit(c >> 4);
+    out[2 * i + 1] = HexDigit(c & 0xF);
   }
-  return output.str();
+}
+
+bool TryFromHex(uint8_t* out, size_t out_len, std::string_view in) {
+  if (out_len * 2 != in.size())
+    return false;
+  size_t i = 0;
+  unsigned invalid = 0;
+#if defined(__SSE2__)
+  __m128i invalidDigits = _mm_setzero_si128();
+  for (; i + 16 <= out_len; i += 16) {
+    __m128i first = HexValues(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in.data() + 2 * i)), invalidDigits);
+    __m128i second = HexValues(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in.data() + 2 * i + 16)), invalidDigits);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(HexPack(first), HexPack(second)));
+  }
+  invalid = unsigned(_mm_movemask_epi8(invalidDigits));
+#endif
+  for (; i < out_len; ++i) {
+    unsigned high = HexValue(uint8_t(in[2 * i]));
+    unsigned low = HexValue(uint8_t(in[2 * i + 1]));
+    invalid |= (high | low) >> 8;
+    out[i] = uint8_t((high << 4) | (low & 0xF));
+  }
+  return invalid == 0;
 }
 
 uint8_t FromDigit(char _c) {
@@ -259,11 +523,11 @@ uint8_t FromDigit(char _c) {
 void FromHex(uint8_t* out, size_t out_len, std::string_view in) {
   if (out_len*2 != in.length())
     throw std::invalid_argument("FromHex expected different size");
-  for (auto it = in.begin(); it < in.end() && it+1 < in.end(); it += 2) {
-    uint8_t l = FromDigit(*it);
-    uint8_t r = FromDigit(*(it+1));
-    *(out++) = uint8_t(l<<4) | r;
-  }
+  if (TryFromHex(out, out_len, in))
+    return;
+  // only to report which character is wrong
+  for (auto c : in)
+    FromDigit(c);
 }
 
 }
@@ -18,14 +18,184 @@ along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
 // Author: Bernard van Gastel
 
 #include "libpep.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <vector>
+
+using namespace libpep;
+
+namespace {
+
+// number of records read, transformed and written at once in batch mode
+const size_t BATCH_BLOCK = 1 << 14;
+// number of records parsed or formatted by one task of the executor
+const size_t RECORD_CHUNK = 256;
+
+struct Options {
+  bool batch = false;
+  bool binary = false;
+  std::string input = "-";
+};
+
+// size of a record in binary batch mode; 0 for records that are always lines (identities and contexts)
+template <typename T> constexpr size_t BINARY_SIZE = 0;
+template <> constexpr size_t BINARY_SIZE<GroupElement> = GroupElement::BYTES;
+template <> constexpr size_t BINARY_SIZE<Scalar> = Scalar::BYTES;
+template <> constexpr size_t BINARY_SIZE<ElGamal> = ElGamal::BYTES;
+
+void Parse(std::string_view record, bool, std::string& out) {
+  out = record;
+}
+
+void Parse(std::string_view record, bool binary, ElGamal& out) {
+  if (!binary) {
+    out = ElGamal::FromHex(record);
+    return;
+  }
+  out = ElGamal::FromBytes(std::span<const uint8_t, ElGamal::BYTES>(reinterpret_cast<const uint8_t*>(record.data()), ElGamal::BYTES));
+}
+
+// records have a fixed size (hex plus newline, or raw bytes), so every record is formatted at its own offset
+template <typename T>
+constexpr size_t FormattedSize(bool binary) {
+  return binary ? BINARY_SIZE<T> : 2 * BINARY_SIZE<T> + 1;
+}
+
+void Format(const GroupElement& x, bool binary, char* out) {
+  if (binary) {
+    memcpy(out, x.value, GroupElement::BYTES);
+    return;
+  }
+  auto hex = x.hex();
+  memcpy(out, hex.data(), hex.size());
+  out[hex.size()] = '\n';
+}
+
+void Format(const Scalar& x, bool binary, char* out) {
+  if (binary) {
+    memcpy(out, x.value, Scalar::BYTES);
+    return;
+  }
+  auto hex = x.hex();
+  memcpy(out, hex.data(), hex.size());
+  out[hex.size()] = '\n';
+}
+
+void Format(const ElGamal& x, bool binary, char* out) {
+  if (binary) {
+    x.bytes(std::span<uint8_t, ElGamal::BYTES>(reinterpret_cast<uint8_t*>(out), ElGamal::BYTES));
+    return;
+  }
+  auto hex = x.hex();
+  memcpy(out, hex.data(), hex.size());
+  out[hex.size()] = '\n';
+}
+
+// Reads up to BATCH_BLOCK records: lines, or blocks of size bytes if size != 0. Returns false at the end of the input.
+bool ReadRecords(std::istream& in, size_t size, std::vector<std::string>& records) {
+  records.clear();
+  std::string record;
+  while (records.size() < BATCH_BLOCK) {
+    if (size == 0) {
+      if (!std::getline(in, record))
+        break;
+      if (!record.empty() && record.back() == '\r')
+        record.pop_back();
+    } else {
+      record.resize(size);
+      in.read(record.data(), std::streamsize(size));
+      if (in.gcount() == 0)
+        break;
+      if (size_t(in.gcount()) != size)
+        throw std::invalid_argument("input ends with a partial record of " + std::to_string(in.gcount()) + " bytes");
+    }
+    records.push_back(std::move(record));
+  }
+  return !records.empty();
+}
+
+// calls f(i) for every i in [0, size), in parallel
+template <typename F>
+void ForEachRecord(size_t size, F&& f) {
+  DefaultExecutor().run((size + RECORD_CHUNK - 1) / RECORD_CHUNK, [&](size_t c) {
+    for (size_t i = c * RECORD_CHUNK; i < std::min(size, (c + 1) * RECORD_CHUNK); ++i)
+      f(i);
+  });
+}
+
+// Reads records of type In from the input, transforms them in blocks with transform(span<const In>, span<Out>),
+// and writes them to stdout in the same order. Keys and factors are parsed or derived once by the caller.
+template <typename In, typename Out, typename Transform>
+void RunBatch(const Options& options, Transform&& transform) {
+  std::ifstream file;
+  std::istream* in = &std::cin;
+  if (options.input != "-") {
+    file.open(options.input, std::ios::binary);
+    if (!file)
+      throw std::invalid_argument("could not open " + options.input);
+    in = &file;
+  }
+  std::ios::sync_with_stdio(false);
+  const size_t recordSize = options.binary ? BINARY_SIZE<In> : 0;
+  const size_t formattedSize = FormattedSize<Out>(options.binary);
+  std::vector<std::string> records;
+  std::vector<In> input;
+  std::vector<Out> output;
+  std::string buffer;
+  size_t offset = 0;
+  while (ReadRecords(*in, recordSize, records)) {
+    input.resize(records.size());
+    output.resize(records.size());
+    ForEachRecord(records.size(), [&](size_t i) {
+      try {
+        Parse(records[i], options.binary, input[i]);
+      } catch (std::exception& e) {
+        throw std::invalid_argument("record " + std::to_string(offset + i + 1) + ": " + e.what());
+      }
+    });
+    transform(std::span<const In>(input), std::span<Out>(output));
+    buffer.resize(output.size() * formattedSize);
+    ForEachRecord(output.size(), [&](size_t i) {
+      Format(output[i], options.binary, buffer.data() + i * formattedSize);
+    });
+    std::cout.write(buffer.data(), std::streamsize(buffer.size()));
+    offset += records.size();
+  }
+  std::cout.flush();
+}
+
+}
 
 int main(int argc, char** argv) {
+  // options can be given anywhere after the subcommand; "--" ends the options
+  Options options;
+  std::vector<std::string> args;
+  bool parseOptions = true;
+  for (int i = 0; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (parseOptions && i >= 2 && arg == "--") {
+      parseOptions = false;
+    } else if (parseOptions && i >= 2 && arg == "--batch") {
+      options.batch = true;
+    } else if (parseOptions && i >= 2 && arg == "--binary") {
+      options.binary = true;
+    } else if (parseOptions && i >= 2 && arg == "--input" && i + 1 < argc) {
+      options.input = argv[++i];
+    } else {
+      args.push_back(std::move(arg));
+    }
+  }
   std::string subcommand;
-  if (argc >= 2)
-    subcommand = argv[1];
+  if (args.size() >= 2)
+    subcommand = args[1];
   try {
+    if ((options.binary || options.input != "-") && !options.batch)
+      throw std::invalid_argument("--binary and --input can only be used together with --batch");
     if (subcommand == "generate-global-keys") {
+      if (options.batch)
+        throw std::invalid_argument("generate-global-keys has no batch mode");
       auto [pk, sk] = libpep::GenerateGlobalKeys();
       std::cerr << "Public global key: " << std::endl;
       std::cout << pk.hex() << std::endl;
@@ -34,49 +204,81 @@ int main(int argc, char** argv) {
       return 0;
     }
     if (subcommand == "generate-pseudonym") {
-      if (argc != 4) {
+      if (args.size() != (options.batch ? 3 : 4)) {
         std::cerr << "wrong number of arguments" << std::endl;
         return -1;
       }
-      std::string identity = argv[2];
-      auto pk = libpep::GlobalPublicKey::FromHex(argv[3]);
+      if (options.batch) {
+        auto pk = libpep::PreparePublicKey(libpep::GlobalPublicKey::FromHex(args[2]));
+        std::vector<std::string_view> views;
+        RunBatch<std::string, libpep::GlobalEncryptedPseudonym>(options, [&](std::span<const std::string> identities, std::span<libpep::GlobalEncryptedPseudonym> out) {
+          views.assign(identities.begin(), identities.end());
+          libpep::GeneratePseudonyms(views, pk, out);
+        });
+        return 0;
+      }
+      std::string identity = args[2];
+      auto pk = libpep::GlobalPublicKey::FromHex(args[3]);
       auto local = libpep::GeneratePseudonym(identity, pk);
       std::cerr << local.hex() << std::endl;
       return 0;
     }
     if (subcommand == "convert-to-local-pseudonym") {
-      if (argc != 6) {
+      if (args.size() != (options.batch ? 5 : 6)) {
         std::cerr << "wrong number of arguments" << std::endl;
         return -1;
       }
-      auto p = libpep::GlobalEncryptedPseudonym::FromHex(argv[2]);
-      std::string serverSecret = argv[3];
-      std::string decryptionContext = argv[4];
-      std::string pContext = argv[5];
-      auto local = libpep::ConvertToLocalPseudonym(p, serverSecret, decryptionContext, pContext);
-      local = libpep::RerandomizeLocal(local);
+      if (options.batch) {
+        std::string serverSecret = args[2];
+        std::string decryptionContext = args[3];
+        std::string pContext = args[4];
+        RunBatch<libpep::GlobalEncryptedPseudonym, libpep::LocalEncryptedPseudonym>(options, [&](std::span<const libpep::GlobalEncryptedPseudonym> p, std::span<libpep::LocalEncryptedPseudonym> out) {
+          libpep::ConvertToRerandomizedLocalPseudonyms(p, serverSecret, decryptionContext, pContext, out);
+        });
+        return 0;
+      }
+      auto p = libpep::GlobalEncryptedPseudonym::FromHex(args[2]);
+      std::string serverSecret = args[3];
+      std::string decryptionContext = args[4];
+      std::string pContext = args[5];
+      auto local = libpep::ConvertToRerandomizedLocalPseudonym(p, serverSecret, decryptionContext, pContext);
       std::cerr << local.hex() << std::endl;
       return 0;
     }
     if (subcommand == "make-local-decryption-key") {
-      if (argc != 5) {
+      if (args.size() != (options.batch ? 4 : 5)) {
         std::cerr << "wrong number of arguments" << std::endl;
         return -1;
       }
-      auto sk = libpep::GlobalSecretKey::FromHex(argv[2]);
-      std::string serverSecret = argv[3];
-      std::string decryptionContext = argv[4];
+      auto sk = libpep::GlobalSecretKey::FromHex(args[2]);
+      std::string serverSecret = args[3];
+      if (options.batch) {
+        std::vector<std::string_view> contexts;
+        RunBatch<std::string, libpep::LocalDecryptionKey>(options, [&](std::span<const std::string> decryptionContexts, std::span<libpep::LocalDecryptionKey> out) {
+          contexts.assign(decryptionContexts.begin(), decryptionContexts.end());
+          libpep::MakeLocalDecryptionKeys(sk, serverSecret, contexts, out);
+        });
+        return 0;
+      }
+      std::string decryptionContext = args[4];
       auto localSk = libpep::MakeLocalDecryptionKey(sk, serverSecret, decryptionContext);
       std::cerr << localSk.hex() << std::endl;
       return 0;
     }
     if (subcommand == "decrypt-local-pseudonym") {
-      if (argc != 4) {
+      if (args.size() != (options.batch ? 3 : 4)) {
         std::cerr << "wrong number of arguments" << std::endl;
         return -1;
       }
-      auto local = libpep::LocalEncryptedPseudonym::FromHex(argv[2]);
-      auto sk = libpep::LocalDecryptionKey::FromHex(argv[3]);
+      if (options.batch) {
+        auto sk = libpep::LocalDecryptionKey::FromHex(args[2]);
+        RunBatch<libpep::LocalEncryptedPseudonym, libpep::LocalPseudonym>(options, [&](std::span<const libpep::LocalEncryptedPseudonym> local, std::span<libpep::LocalPseudonym> out) {
+          libpep::DecryptLocalPseudonyms(local, sk, out);
+        });
+        return 0;
+      }
+      auto local = libpep::LocalEncryptedPseudonym::FromHex(args[2]);
+      auto sk = libpep::LocalDecryptionKey::FromHex(args[3]);
       auto p = libpep::DecryptLocalPseudonym(local, sk);
       std::cerr << p.hex() << std::endl;
       return 0;
@@ -103,5 +305,10 @@ int main(int argc, char** argv) {
   std::cerr << argv[0] << " decrypt-local-pseudonym [pseudonym] [local-decryption-key]" << std::endl;
   std::cerr << "  Decrypts the local encrypted pseudonym with a local decryption key as generated by make-local-decryption-key." << std::endl;
   std::cerr << std::endl;
+  std::cerr << "Options for all subcommands except generate-global-keys:" << std::endl;
+  std::cerr << "  --batch        Leave out the first argument (the identity, pseudonym or decryption context), and read these as records from the input instead. Results are written to stdout, in input order. Keys and factors are parsed once, and records are processed by multiple threads." << std::endl;
+  std::cerr << "  --input [file] Read the records from a file instead of stdin." << std::endl;
+  std::cerr << "  --binary       Pseudonyms (input and output) and keys (output) are fixed size binary records (32 bytes per group element or key, 96 bytes per encrypted pseudonym) instead of hex lines. Identities and decryption contexts are always lines." << std::endl;
+  std::cerr << std::endl;
   return -1;
 }
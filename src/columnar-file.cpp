@@ -0,0 +1,222 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#include "columnar-file.h"
+
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+#include "mapped-file.h"
+#include "sodium.h"
+
+using namespace libpep;
+
+namespace {
+
+static_assert(std::endian::native == std::endian::little, "columnar files are only supported on little endian hosts");
+static_assert(sizeof(ColumnarHeader) == 48 && sizeof(ColumnarChunk) == 48);
+
+const char MAGIC[8] = {'L', 'I', 'B', 'P', 'E', 'P', 'C', '1'};
+const uint32_t VERSION = 1;
+// header and chunks start at multiples of this
+const size_t ALIGNMENT = 64;
+// B, C, row id and key index
+const size_t ROW_BYTES = 2 * GroupElement::BYTES + sizeof(uint64_t) + sizeof(uint32_t);
+
+size_t Align(size_t offset) {
+  return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+void Checksum(uint8_t (&out)[32], const uint8_t* data, size_t size) {
+  crypto_generichash(out, sizeof(out), data, size, nullptr, 0);
+}
+
+}
+
+libpep::ColumnarReader::ColumnarReader(const std::string& path) {
+  data = MapFile(path, sizeof(ColumnarHeader), size, FileAccess::Sequential, "a columnar file");
+
+  try {
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION)
+      throw std::runtime_error(path + " is not a columnar file (version " + std::to_string(VERSION) + ")");
+    if (header.footerOffset > size || header.keys > (size - header.footerOffset) / GroupElement::BYTES
+        || header.chunks > (size - header.footerOffset - header.keys * GroupElement::BYTES) / sizeof(ColumnarChunk))
+      throw std::runtime_error(path + " is truncated");
+    const uint8_t* footer = data + header.footerOffset;
+    dictionary.resize(header.keys);
+    for (auto& key : dictionary) {
+      memcpy(key.value, footer, GroupElement::BYTES);
+      footer += GroupElement::BYTES;
+      if (!key.is_valid() || key.is_zero())
+        throw std::runtime_error(path + " contains an invalid key");
+    }
+    chunkTable.resize(header.chunks);
+    uint64_t rows = 0;
+    for (auto& chunk : chunkTable) {
+      memcpy(&chunk, footer, sizeof(chunk));
+      footer += sizeof(chunk);
+      if (chunk.rows > header.chunkRows || chunk.offset > header.footerOffset || chunk.rows * ROW_BYTES > header.footerOffset - chunk.offset)
+        throw std::runtime_error(path + " contains an invalid chunk");
+      rows += chunk.rows;
+    }
+    if (rows != header.rows)
+      throw std::runtime_error(path + " has an inconsistent number of rows");
+  } catch (...) {
+    UnmapFile(data, size);
+    throw;
+  }
+}
+
+libpep::ColumnarReader::~ColumnarReader() {
+  UnmapFile(data, size);
+}
+
+size_t libpep::ColumnarReader::chunkRows(size_t chunk) const {
+  return chunkTable.at(chunk).rows;
+}
+
+void libpep::ColumnarReader::read(size_t chunk, std::vector<ElGamal>& tuples, std::vector<uint64_t>& rowIds) const {
+  const auto& entry = chunkTable.at(chunk);
+  if (chunk + 1 < chunkTable.size()) {
+    const auto& next = chunkTable[chunk + 1];
+    PrefetchFile(data, next.offset, next.offset + next.rows * ROW_BYTES);
+  }
+  const uint8_t* columns = data + entry.offset;
+  uint8_t checksum[32];
+  Checksum(checksum, columns, entry.rows * ROW_BYTES);
+  if (sodium_memcmp(checksum, entry.checksum, sizeof(checksum)) != 0)
+    throw std::runtime_error("columnar file chunk " + std::to_string(chunk) + " has an invalid checksum");
+
+  const uint8_t* B = columns;
+  const uint8_t* C = B + entry.rows * GroupElement::BYTES;
+  const uint8_t* ids = C + entry.rows * GroupElement::BYTES;
+  const uint8_t* keys = ids + entry.rows * sizeof(uint64_t);
+  tuples.resize(entry.rows);
+  rowIds.resize(entry.rows);
+  for (size_t i = 0; i < entry.rows; ++i) {
+    memcpy(tuples[i].B.value, B + i * GroupElement::BYTES, GroupElement::BYTES);
+    memcpy(tuples[i].C.value, C + i * GroupElement::BYTES, GroupElement::BYTES);
+    memcpy(&rowIds[i], ids + i * sizeof(uint64_t), sizeof(uint64_t));
+    uint32_t key;
+    memcpy(&key, keys + i * sizeof(uint32_t), sizeof(uint32_t));
+    if (key >= dictionary.size())
+      throw std::runtime_error("columnar file chunk " + std::to_string(chunk) + " refers to an unknown key");
+    tuples[i].Y = dictionary[key];
+  }
+}
+
+libpep::ColumnarWriter::ColumnarWriter(const std::string& path, uint32_t chunkRows) : file(path, std::ios::binary | std::ios::trunc) {
+  if (chunkRows == 0)
+    throw std::invalid_argument("ColumnarWriter expects a non zero number of rows per chunk");
+  if (!file)
+    throw std::runtime_error("could not create " + path);
+  header = {};
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.chunkRows = chunkRows;
+  // the header is written by close(), when all counts are known
+  std::vector<char> zero(ALIGNMENT);
+  file.write(zero.data(), std::streamsize(zero.size()));
+}
+
+libpep::ColumnarWriter::~ColumnarWriter() {
+  try {
+    close();
+  } catch (...) {
+    // close() explicitly to get errors
+  }
+}
+
+void libpep::ColumnarWriter::write(std::span<const ElGamal> tuples, std::span<const uint64_t> rowIds) {
+  if (tuples.size() != rowIds.size())
+    throw std::invalid_argument("ColumnarWriter::write expected the same number of tuples and row ids");
+  if (closed)
+    throw std::runtime_error("ColumnarWriter::write called after close");
+  for (size_t i = 0; i < tuples.size(); ++i) {
+    pending.push_back(tuples[i]);
+    pendingRowIds.push_back(rowIds[i]);
+    if (pending.size() == header.chunkRows)
+      flush();
+  }
+}
+
+void libpep::ColumnarWriter::flush() {
+  if (pending.empty())
+    return;
+  size_t rows = pending.size();
+  buffer.resize(rows * ROW_BYTES);
+  uint8_t* B = buffer.data();
+  uint8_t* C = B + rows * GroupElement::BYTES;
+  uint8_t* ids = C + rows * GroupElement::BYTES;
+  uint8_t* keys = ids + rows * sizeof(uint64_t);
+  for (size_t i = 0; i < rows; ++i) {
+    memcpy(B + i * GroupElement::BYTES, pending[i].B.value, GroupElement::BYTES);
+    memcpy(C + i * GroupElement::BYTES, pending[i].C.value, GroupElement::BYTES);
+    memcpy(ids + i * sizeof(uint64_t), &pendingRowIds[i], sizeof(uint64_t));
+    auto [it, inserted] = keyIndex.emplace(pending[i].Y.raw(), uint32_t(dictionary.size()));
+    if (inserted)
+      dictionary.push_back(pending[i].Y);
+    memcpy(keys + i * sizeof(uint32_t), &it->second, sizeof(uint32_t));
+  }
+  ColumnarChunk chunk = {};
+  chunk.offset = uint64_t(file.tellp());
+  chunk.rows = rows;
+  Checksum(chunk.checksum, buffer.data(), buffer.size());
+  buffer.resize(Align(buffer.size()));
+  file.write(reinterpret_cast<const char*>(buffer.data()), std::streamsize(buffer.size()));
+  if (!file)
+    throw std::runtime_error("could not write columnar file");
+  chunkTable.push_back(chunk);
+  header.rows += rows;
+  pending.clear();
+  pendingRowIds.clear();
+}
+
+void libpep::ColumnarWriter::close() {
+  if (closed)
+    return;
+  closed = true;
+  flush();
+  header.chunks = chunkTable.size();
+  header.keys = dictionary.size();
+  header.footerOffset = uint64_t(file.tellp());
+  for (const auto& key : dictionary)
+    file.write(reinterpret_cast<const char*>(key.value), GroupElement::BYTES);
+  for (const auto& chunk : chunkTable)
+    file.write(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+  file.seekp(0);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.close();
+  if (!file)
+    throw std::runtime_error("could not write columnar file");
+}
+
+void libpep::TransformColumnar(const ColumnarReader& in, ColumnarWriter& out, const std::function<void(std::span<const ElGamal>, std::span<ElGamal>)>& transform) {
+  std::vector<ElGamal> tuples;
+  std::vector<ElGamal> results;
+  std::vector<uint64_t> rowIds;
+  for (size_t chunk = 0; chunk < in.chunks(); ++chunk) {
+    in.read(chunk, tuples, rowIds);
+    results.resize(tuples.size());
+    transform(tuples, results);
+    out.write(results, rowIds);
+  }
+}
@@ -18,26 +18,319 @@ along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
 // Author: Bernard van Gastel
 
 #include "core.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
 #include <stdexcept>
+#include <vector>
+
+#include "metrics.h"
 
 using namespace libpep;
 
+namespace {
+
+void CheckBatchSize(size_t inSize, size_t outSize, const char* func) {
+  if (inSize != outSize)
+    throw std::invalid_argument(std::string(func) + " expected output of the same size as the input");
+}
+
+// Chunks of a batch are processed together (e.g. sharing one inversion when encoding), and are the unit of work
+// for the executor. They are small enough to keep all threads busy, but not smaller than MIN_CHUNK elements
+// (to keep the benefit of sharing) or larger than MAX_CHUNK (to bound the temporary memory).
+const size_t MIN_CHUNK = 16;
+const size_t MAX_CHUNK = 256;
+
+// Calls f(begin, end) for consecutive chunks of a batch, on the executor. Results are written to the
+// positions of the inputs, so the output order does not depend on the order in which chunks finish.
+template <typename F>
+void ForEachChunk(size_t size, Executor& executor, F&& f) {
+  if (size == 0)
+    return;
+  size_t chunk = std::clamp(size / (4 * executor.concurrency()), MIN_CHUNK, MAX_CHUNK);
+  size_t chunks = (size + chunk - 1) / chunk;
+  if (chunks == 1) {
+    f(size_t(0), size);
+    return;
+  }
+  executor.run(chunks, [&](size_t c) {
+    f(c * chunk, std::min(size, (c + 1) * chunk));
+  });
+}
+
+// 1/2 (mod L): a point computed as (s/2) * P can be encoded as 2 * ((s/2) * P) by DoubleAndEncodeBatch
+const Scalar& Half() {
+  static const Scalar half = [] {
+    Scalar two;
+    two.value[0] = 2;
+    return two.invert();
+  }();
+  return half;
+}
+
+// reads a group element in the binary layout, with the same checks as GroupElement::FromHex
+GroupElement ReadGroupElement(const uint8_t* in, const char* func) {
+  GroupElement retval;
+  memcpy(retval.value, in, GroupElement::BYTES);
+  if (!retval.is_valid() || retval.is_zero())
+    throw std::invalid_argument(std::string(func) + " produced invalid or zero GroupElement");
+  return retval;
+}
+
+// Input and output of a batch transformation: a component of element i is read with decode(i, &ElGamal::B) when
+// it is transformed, or with pass(i, &ElGamal::B) when it is copied to the result unchanged; encoded(i, ...) gives
+// the encoding of a component that is also decoded. Results are written with set(i, ...). Either separate spans of
+// tuples, or records in the binary layout that are transformed in place.
+using Component = GroupElement ElGamal::*;
+
+struct TupleBatch {
+  std::span<const ElGamal> in;
+  std::span<ElGamal> out;
+  size_t size() const {
+    return in.size();
+  }
+  DecodedGroupElement decode(size_t i, Component component) const {
+    return DecodedGroupElement(in[i].*component);
+  }
+  const GroupElement& pass(size_t i, Component component) const {
+    return in[i].*component;
+  }
+  const GroupElement& encoded(size_t i, Component component) const {
+    return in[i].*component;
+  }
+  void set(size_t i, const ElGamal& value) const {
+    out[i] = value;
+  }
+};
+
+// records are checked as ElGamal::FromBytes does, but every transformed group element is decoded only once
+struct RecordBatch {
+  std::span<uint8_t> records;
+  const char* func;
+  RecordBatch(std::span<uint8_t> _records, const char* _func) : records(_records), func(_func) {
+    if (records.size() % ElGamal::BYTES != 0)
+      throw std::invalid_argument(std::string(func) + " expected a multiple of " + std::to_string(ElGamal::BYTES) + " bytes");
+  }
+  size_t size() const {
+    return records.size() / ElGamal::BYTES;
+  }
+  const uint8_t* bytes(size_t i, Component component) const {
+    size_t offset = component == &ElGamal::B ? 0 : component == &ElGamal::C ? GroupElement::BYTES : ElGamal::COMPACT_BYTES;
+    return records.data() + i * ElGamal::BYTES + offset;
+  }
+  DecodedGroupElement decode(size_t i, Component component) const {
+    auto retval = DecodedGroupElement::Decode(encoded(i, component));
+    if (!retval || retval->is_zero())
+      throw std::invalid_argument(std::string(func) + " produced invalid or zero GroupElement");
+    return *retval;
+  }
+  GroupElement pass(size_t i, Component component) const {
+    return ReadGroupElement(bytes(i, component), func);
+  }
+  GroupElement encoded(size_t i, Component component) const {
+    GroupElement retval;
+    memcpy(retval.value, bytes(i, component), GroupElement::BYTES);
+    return retval;
+  }
+  void set(size_t i, const ElGamal& value) const {
+    value.bytes(records.subspan(i * ElGamal::BYTES).first<ElGamal::BYTES>());
+  }
+};
+
+// Decrypt and Rerandomize without metrics, so the batch versions count their tuples once
+GroupElement DecryptTuple(const ElGamal& in, const Scalar& y) {
+  return (DecodedGroupElement(in.C) - y * DecodedGroupElement(in.B)).encode();
+}
+
+ElGamal RerandomizeTuple(const ElGamal& in, const Scalar& s) {
+  return {(DecodedGroupElement::MultBase(s) + DecodedGroupElement(in.B)).encode(), (s * DecodedGroupElement(in.Y) + DecodedGroupElement(in.C)).encode(), in.Y};
+}
+
+// Message is GroupElement or DecodedGroupElement
+template <typename Message>
+void EncryptBatch(std::span<const Message> M, const PreparedPublicKey& Y, std::span<ElGamal> out, Executor& executor) {
+  CheckBatchSize(M.size(), out.size(), "Encrypt");
+  ENSURE(!Y.encoded().is_zero()); // we should not encrypt anything with an empty public key, as this will result in plain text send over the line
+  ScopedTimer timer(Operation::EncryptBatch);
+  Count(Counter::Encryptions, M.size());
+  ForEachChunk(M.size(), executor, [&](size_t begin, size_t end) {
+    // r = 2 * r' is as random as r', and B = 2 * (r' * G) can be encoded in bulk
+    std::vector<DecodedGroupElement> halfB(end - begin);
+    std::vector<GroupElement> B(end - begin);
+    std::vector<Scalar> random(end - begin);
+    Scalar::RandomBatch(random);
+    for (size_t i = begin; i < end; ++i) {
+      const Scalar& r = random[i - begin];
+      halfB[i - begin] = DecodedGroupElement::MultBase(r);
+      out[i].C = (DecodedGroupElement(M[i]) + (r + r) * Y).encode();
+      out[i].Y = Y.encoded();
+    }
+    DoubleAndEncodeBatch(halfB, B);
+    for (size_t i = begin; i < end; ++i)
+      out[i].B = B[i - begin];
+  });
+}
+
+template <typename Batch>
+void RerandomizeBatch(const Batch& batch, Executor& executor) {
+  ScopedTimer timer(Operation::RerandomizeBatch);
+  Count(Counter::Rerandomizations, batch.size());
+  ForEachChunk(batch.size(), executor, [&](size_t begin, size_t end) {
+    std::vector<Scalar> s(end - begin);
+    Scalar::RandomBatch(s);
+    for (size_t i = begin; i < end; ++i) {
+      const Scalar& r = s[i - begin];
+      auto B = DecodedGroupElement::MultBase(r) + batch.decode(i, &ElGamal::B);
+      auto C = r * batch.decode(i, &ElGamal::Y) + batch.decode(i, &ElGamal::C);
+      batch.set(i, {B.encode(), C.encode(), batch.encoded(i, &ElGamal::Y)});
+    }
+  });
+}
+
+template <typename Batch>
+void RekeyBatch(const Batch& batch, const Scalar& k, Executor& executor) {
+  ScopedTimer timer(Operation::RekeyBatch);
+  Count(Counter::Rekeys, batch.size());
+  auto halfKInverse = k.invert() * Half();
+  auto halfK = k * Half();
+  ForEachChunk(batch.size(), executor, [&](size_t begin, size_t end) {
+    std::vector<DecodedGroupElement> half(2 * (end - begin));
+    std::vector<GroupElement> encoded(half.size());
+    std::vector<GroupElement> C(end - begin);
+    for (size_t i = begin; i < end; ++i) {
+      half[2 * (i - begin)] = halfKInverse * batch.decode(i, &ElGamal::B);
+      half[2 * (i - begin) + 1] = halfK * batch.decode(i, &ElGamal::Y);
+      C[i - begin] = batch.pass(i, &ElGamal::C);
+    }
+    DoubleAndEncodeBatch(half, encoded);
+    for (size_t i = begin; i < end; ++i)
+      batch.set(i, {encoded[2 * (i - begin)], C[i - begin], encoded[2 * (i - begin) + 1]});
+  });
+}
+
+template <typename Batch>
+void ReshuffleBatch(const Batch& batch, const Scalar& n, Executor& executor) {
+  ScopedTimer timer(Operation::ReshuffleBatch);
+  Count(Counter::Reshuffles, batch.size());
+  auto halfN = n * Half();
+  ForEachChunk(batch.size(), executor, [&](size_t begin, size_t end) {
+    std::vector<DecodedGroupElement> half(2 * (end - begin));
+    std::vector<GroupElement> encoded(half.size());
+    std::vector<GroupElement> Y(end - begin);
+    for (size_t i = begin; i < end; ++i) {
+      half[2 * (i - begin)] = halfN * batch.decode(i, &ElGamal::B);
+      half[2 * (i - begin) + 1] = halfN * batch.decode(i, &ElGamal::C);
+      Y[i - begin] = batch.pass(i, &ElGamal::Y);
+    }
+    DoubleAndEncodeBatch(half, encoded);
+    for (size_t i = begin; i < end; ++i)
+      batch.set(i, {encoded[2 * (i - begin)], encoded[2 * (i - begin) + 1], Y[i - begin]});
+  });
+}
+
+template <typename Batch>
+void RKSBatch(const Batch& batch, const Scalar& k, const Scalar& n, Executor& executor) {
+  ScopedTimer timer(Operation::RKSBatch);
+  Count(Counter::RKSs, batch.size());
+  auto halfNK = n / k * Half();
+  auto halfN = n * Half();
+  auto halfK = k * Half();
+  ForEachChunk(batch.size(), executor, [&](size_t begin, size_t end) {
+    std::vector<DecodedElGamal> half(end - begin);
+    std::vector<ElGamal> encoded(end - begin);
+    for (size_t i = begin; i < end; ++i) {
+      half[i - begin] = {halfNK * batch.decode(i, &ElGamal::B), halfN * batch.decode(i, &ElGamal::C), halfK * batch.decode(i, &ElGamal::Y)};
+    }
+    DoubleAndEncodeBatch(half, encoded);
+    for (size_t i = begin; i < end; ++i)
+      batch.set(i, encoded[i - begin]);
+  });
+}
+
+template <typename Batch>
+void RKSRBatch(const Batch& batch, const Scalar& k, const Scalar& n, Executor& executor) {
+  ScopedTimer timer(Operation::RKSRBatch);
+  Count(Counter::RKSRs, batch.size());
+  auto halfNK = n / k * Half();
+  auto halfN = n * Half();
+  auto halfK = k * Half();
+  ForEachChunk(batch.size(), executor, [&](size_t begin, size_t end) {
+    // RKSR(in, k, n, 2 * s') / 2 = {(n / 2k) * B + s' * G, (n / 2) * C + 2s' * (k / 2) * Y, (k / 2) * Y}
+    std::vector<DecodedElGamal> half(end - begin);
+    std::vector<ElGamal> encoded(end - begin);
+    std::vector<Scalar> random(end - begin);
+    Scalar::RandomBatch(random);
+    for (size_t i = begin; i < end; ++i) {
+      const Scalar& s = random[i - begin];
+      auto Y = halfK * batch.decode(i, &ElGamal::Y);
+      half[i - begin] = {halfNK * batch.decode(i, &ElGamal::B) + DecodedGroupElement::MultBase(s), DoubleScalarMul(halfN, batch.decode(i, &ElGamal::C), s + s, Y), Y};
+    }
+    DoubleAndEncodeBatch(half, encoded);
+    for (size_t i = begin; i < end; ++i)
+      batch.set(i, encoded[i - begin]);
+  });
+}
+
+}
+
 libpep::ElGamal::ElGamal(GroupElement _B, const GroupElement& _C, const GroupElement& _Y) : B(_B), C(_C), Y(_Y) {
 }
 
+void ElGamal::bytes(std::span<uint8_t, BYTES> out) const {
+  compact(out.first<COMPACT_BYTES>());
+  memcpy(out.data() + COMPACT_BYTES, Y.value, GroupElement::BYTES);
+}
+
+void ElGamal::compact(std::span<uint8_t, COMPACT_BYTES> out) const {
+  memcpy(out.data(), B.value, GroupElement::BYTES);
+  memcpy(out.data() + GroupElement::BYTES, C.value, GroupElement::BYTES);
+}
+
+ElGamal ElGamal::FromBytes(std::span<const uint8_t, BYTES> in) {
+  return {ReadGroupElement(in.data(), __func__), ReadGroupElement(in.data() + GroupElement::BYTES, __func__), ReadGroupElement(in.data() + COMPACT_BYTES, __func__)};
+}
+
+ElGamal ElGamal::FromCompact(std::span<const uint8_t, COMPACT_BYTES> in, const GroupElement& Y) {
+  return {ReadGroupElement(in.data(), __func__), ReadGroupElement(in.data() + GroupElement::BYTES, __func__), Y};
+}
+
 std::string ElGamal::hex() const {
-  return B.hex() + C.hex() + Y.hex();
+  uint8_t raw[BYTES];
+  bytes(raw);
+  return ToHex({reinterpret_cast<const char*>(raw), sizeof(raw)});
 }
 
 ElGamal ElGamal::FromHex(std::string_view view) {
-  if (view.size() != 192)
+  if (view.size() != 2 * BYTES)
     throw std::invalid_argument("ElGamal::FromHex expected different size");
-  ElGamal retval;
-  retval.B = GroupElement::FromHex(view.substr(0, 64));
-  retval.C = GroupElement::FromHex(view.substr(64, 64));
-  retval.Y = GroupElement::FromHex(view.substr(128, 64));
+  uint8_t raw[BYTES];
+  ::FromHex(raw, view);
+  return FromBytes(raw);
+}
+std::vector<bool> ElGamal::FromHexBatch(std::span<const std::string_view> in, std::span<ElGamal> out) {
+  if (in.size() != out.size())
+    throw std::invalid_argument("ElGamal::FromHexBatch expected output of the same size as the input");
+  std::vector<bool> retval(in.size());
+  auto valid = [](const GroupElement& x) {
+    return x.is_valid() && !x.is_zero();
+  };
+  std::optional<GroupElement> lastY;
+  for (size_t i = 0; i < in.size(); ++i) {
+    uint8_t raw[BYTES];
+    if (TryFromHex(raw, sizeof(raw), in[i])) {
+      memcpy(out[i].B.value, raw, GroupElement::BYTES);
+      memcpy(out[i].C.value, raw + GroupElement::BYTES, GroupElement::BYTES);
+      memcpy(out[i].Y.value, raw + COMPACT_BYTES, GroupElement::BYTES);
+      retval[i] = valid(out[i].B) && valid(out[i].C) && ((lastY && *lastY == out[i].Y) || valid(out[i].Y));
+    }
+    if (retval[i])
+      lastY = out[i].Y;
+    else
+      out[i] = ElGamal();
+  }
   return retval;
 }
+
 bool libpep::ElGamal::operator==(const ElGamal& rhs) const {
   return B == rhs.B && C == rhs.C && Y == rhs.Y;
 }
@@ -46,35 +339,241 @@ bool libpep::ElGamal::operator!=(const ElGamal& rhs) const {
   return B != rhs.B || C != rhs.C || Y != rhs.Y;
 }
 
+libpep::DecodedElGamal::DecodedElGamal(const DecodedGroupElement& _B, const DecodedGroupElement& _C, const DecodedGroupElement& _Y) : B(_B), C(_C), Y(_Y) {
+}
+
+libpep::DecodedElGamal::DecodedElGamal(const ElGamal& in) : B(in.B), C(in.C), Y(in.Y) {
+}
+
+ElGamal DecodedElGamal::encode() const {
+  return {B.encode(), C.encode(), Y.encode()};
+}
+
+PreparedPublicKey libpep::PreparePublicKey(const GroupElement& Y) {
+  static const size_t CACHE_SIZE = 8;
+  static std::mutex mutex;
+  static std::vector<PreparedPublicKey> cache; // most recently used at the front
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+      if (it->encoded() == Y) {
+        std::rotate(cache.begin(), it, it + 1);
+        return cache.front();
+      }
+    }
+  }
+  // building the table takes a while, do it without holding the lock
+  PreparedPublicKey retval(Y);
+  std::lock_guard<std::mutex> lock(mutex);
+  if (cache.size() >= CACHE_SIZE)
+    cache.pop_back();
+  cache.insert(cache.begin(), retval);
+  return retval;
+}
+
+// The ElGamal versions decode their input once, and only encode the group elements that changed. Their latency is
+// measured; the DecodedElGamal versions are used in chains of operations, and are only counted.
+
 // encrypt message M using public key Y
 ElGamal libpep::Encrypt(const GroupElement& M, const GroupElement& Y) {
+  ScopedTimer timer(Operation::Encrypt);
+  Count(Counter::Encryptions);
   auto r = Scalar::Random();
   EXPECT(!r.is_zero()); // Random() does never return a zero scalar
   ENSURE(!Y.is_zero()); // we should not encrypt anything with an empty public key, as this will result in plain text send over the line
-  return {r * G, M + r*Y, Y};
+  return {DecodedGroupElement::MultBase(r).encode(), (DecodedGroupElement(M) + r*DecodedGroupElement(Y)).encode(), Y};
+}
+
+ElGamal libpep::Encrypt(const GroupElement& M, const PreparedPublicKey& Y) {
+  ScopedTimer timer(Operation::Encrypt);
+  Count(Counter::Encryptions);
+  auto r = Scalar::Random();
+  ENSURE(!Y.encoded().is_zero()); // we should not encrypt anything with an empty public key, as this will result in plain text send over the line
+  return {DecodedGroupElement::MultBase(r).encode(), (DecodedGroupElement(M) + r*Y).encode(), Y.encoded()};
 }
 
 // decrypt encrypted ElGamal tuple with secret key y
 GroupElement libpep::Decrypt(const ElGamal& in, const Scalar& y) {
-  return in.C - y * in.B;
+  ScopedTimer timer(Operation::Decrypt);
+  Count(Counter::Decryptions);
+  return DecryptTuple(in, y);
 }
 
 // randomize the encryption
 ElGamal libpep::Rerandomize(const ElGamal& in, const Scalar& s) {
-  return {s * G + in.B, s * in.Y + in.C, in.Y};
+  ScopedTimer timer(Operation::Rerandomize);
+  Count(Counter::Rerandomizations);
+  return RerandomizeTuple(in, s);
+}
+
+ElGamal libpep::Rerandomize(const ElGamal& in, const PreparedPublicKey& Y, const Scalar& s) {
+  if (in.Y != Y.encoded())
+    throw std::invalid_argument("Rerandomize with a prepared public key that is not the public key of the ElGamal tuple");
+  ScopedTimer timer(Operation::Rerandomize);
+  Count(Counter::Rerandomizations);
+  return {(DecodedGroupElement::MultBase(s) + DecodedGroupElement(in.B)).encode(), (s * Y + DecodedGroupElement(in.C)).encode(), in.Y};
 }
 
 // make it decryptable with another key k*y (with y the original private key)
 ElGamal libpep::Rekey(const ElGamal& in, const Scalar& k) {
-  return {in.B / k, in.C, k * in.Y};
+  ScopedTimer timer(Operation::Rekey);
+  Count(Counter::Rekeys);
+  return {(DecodedGroupElement(in.B) / k).encode(), in.C, (k * DecodedGroupElement(in.Y)).encode()};
 }
 
 // adjust the encrypted cypher text to be n*M (with M the original text being encrypted)
 ElGamal libpep::Reshuffle(const ElGamal& in, const Scalar& n) {
-  return {n * in.B, n * in.C, in.Y};
+  ScopedTimer timer(Operation::Reshuffle);
+  Count(Counter::Reshuffles);
+  return {(n * DecodedGroupElement(in.B)).encode(), (n * DecodedGroupElement(in.C)).encode(), in.Y};
 }
 
 // combination of Rekey(k) and Reshuffle(n)
 ElGamal libpep::RKS(const ElGamal& in, const Scalar& k, const Scalar& n) {
+  ScopedTimer timer(Operation::RKS);
+  Count(Counter::RKSs);
+  return {((n / k) * DecodedGroupElement(in.B)).encode(), (n * DecodedGroupElement(in.C)).encode(), (k * DecodedGroupElement(in.Y)).encode()};
+}
+
+// combination of RKS(k, n) and Rerandomize(s)
+ElGamal libpep::RKSR(const ElGamal& in, const Scalar& k, const Scalar& n, const Scalar& s) {
+  ScopedTimer timer(Operation::RKSR); // counted by the DecodedElGamal version
+  return RKSR(DecodedElGamal(in), k, n, s).encode();
+}
+
+DecodedElGamal libpep::Encrypt(const DecodedGroupElement& M, const DecodedGroupElement& Y) {
+  Count(Counter::Encryptions);
+  auto r = Scalar::Random();
+  ENSURE(!Y.is_zero()); // we should not encrypt anything with an empty public key, as this will result in plain text send over the line
+  return {DecodedGroupElement::MultBase(r), M + r*Y, Y};
+}
+
+DecodedGroupElement libpep::Decrypt(const DecodedElGamal& in, const Scalar& y) {
+  Count(Counter::Decryptions);
+  return in.C - y * in.B;
+}
+
+DecodedElGamal libpep::Rerandomize(const DecodedElGamal& in, const Scalar& s) {
+  Count(Counter::Rerandomizations);
+  return {DecodedGroupElement::MultBase(s) + in.B, s * in.Y + in.C, in.Y};
+}
+
+DecodedElGamal libpep::Rekey(const DecodedElGamal& in, const Scalar& k) {
+  Count(Counter::Rekeys);
+  return {in.B / k, in.C, k * in.Y};
+}
+
+DecodedElGamal libpep::Reshuffle(const DecodedElGamal& in, const Scalar& n) {
+  Count(Counter::Reshuffles);
+  return {n * in.B, n * in.C, in.Y};
+}
+
+DecodedElGamal libpep::RKS(const DecodedElGamal& in, const Scalar& k, const Scalar& n) {
+  Count(Counter::RKSs);
   return {(n / k) * in.B, n * in.C, k * in.Y};
 }
+
+DecodedElGamal libpep::RKSR(const DecodedElGamal& in, const Scalar& k, const Scalar& n, const Scalar& s) {
+  Count(Counter::RKSRs);
+  // Rerandomize(RKS(in, k, n), s) = {(n / k) * in.B + s * G, n * in.C + s * (k * in.Y), k * in.Y}
+  // s * G uses the fixed base table, and n * in.C + s * Y shares the doublings of both multiplications
+  auto Y = k * in.Y;
+  return {(n / k) * in.B + DecodedGroupElement::MultBase(s), DoubleScalarMul(n, in.C, s, Y), Y};
+}
+
+void libpep::Encrypt(std::span<const GroupElement> M, const GroupElement& Y, std::span<ElGamal> out, Executor& executor) {
+  Encrypt(M, PreparePublicKey(Y), out, executor);
+}
+
+void libpep::Encrypt(std::span<const GroupElement> M, const PreparedPublicKey& Y, std::span<ElGamal> out, Executor& executor) {
+  EncryptBatch(M, Y, out, executor);
+}
+
+void libpep::Encrypt(std::span<const DecodedGroupElement> M, const PreparedPublicKey& Y, std::span<ElGamal> out, Executor& executor) {
+  EncryptBatch(M, Y, out, executor);
+}
+
+// Decrypt and Rerandomize add points that are not the result of a multiplication, so these can not be
+// halved to be encoded in bulk
+
+void libpep::Decrypt(std::span<const ElGamal> in, const Scalar& y, std::span<GroupElement> out, Executor& executor) {
+  CheckBatchSize(in.size(), out.size(), __func__);
+  ScopedTimer timer(Operation::DecryptBatch);
+  Count(Counter::Decryptions, in.size());
+  ForEachChunk(in.size(), executor, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i)
+      out[i] = DecryptTuple(in[i], y);
+  });
+}
+
+void libpep::Rerandomize(std::span<const ElGamal> in, std::span<ElGamal> out, Executor& executor) {
+  CheckBatchSize(in.size(), out.size(), __func__);
+  RerandomizeBatch(TupleBatch{in, out}, executor);
+}
+
+void libpep::Rekey(std::span<const ElGamal> in, const Scalar& k, std::span<ElGamal> out, Executor& executor) {
+  CheckBatchSize(in.size(), out.size(), __func__);
+  RekeyBatch(TupleBatch{in, out}, k, executor);
+}
+
+void libpep::Reshuffle(std::span<const ElGamal> in, const Scalar& n, std::span<ElGamal> out, Executor& executor) {
+  CheckBatchSize(in.size(), out.size(), __func__);
+  ReshuffleBatch(TupleBatch{in, out}, n, executor);
+}
+
+void libpep::RKS(std::span<const ElGamal> in, const Scalar& k, const Scalar& n, std::span<ElGamal> out, Executor& executor) {
+  CheckBatchSize(in.size(), out.size(), __func__);
+  RKSBatch(TupleBatch{in, out}, k, n, executor);
+}
+
+void libpep::RKSR(std::span<const ElGamal> in, const Scalar& k, const Scalar& n, std::span<ElGamal> out, Executor& executor) {
+  CheckBatchSize(in.size(), out.size(), __func__);
+  RKSRBatch(TupleBatch{in, out}, k, n, executor);
+}
+
+void libpep::Rerandomize(ElGamalView x, const Scalar& s) {
+  x.set(Rerandomize(x.get(), s));
+}
+
+void libpep::Rekey(ElGamalView x, const Scalar& k) {
+  x.set(Rekey(x.get(), k));
+}
+
+void libpep::Reshuffle(ElGamalView x, const Scalar& n) {
+  x.set(Reshuffle(x.get(), n));
+}
+
+void libpep::RKS(ElGamalView x, const Scalar& k, const Scalar& n) {
+  x.set(RKS(x.get(), k, n));
+}
+
+void libpep::Rerandomize(std::span<uint8_t> records, Executor& executor) {
+  RerandomizeBatch(RecordBatch(records, __func__), executor);
+}
+
+void libpep::Rekey(std::span<uint8_t> records, const Scalar& k, Executor& executor) {
+  RekeyBatch(RecordBatch(records, __func__), k, executor);
+}
+
+void libpep::Reshuffle(std::span<uint8_t> records, const Scalar& n, Executor& executor) {
+  ReshuffleBatch(RecordBatch(records, __func__), n, executor);
+}
+
+void libpep::RKS(std::span<uint8_t> records, const Scalar& k, const Scalar& n, Executor& executor) {
+  RKSBatch(RecordBatch(records, __func__), k, n, executor);
+}
+
+void libpep::DoubleAndEncodeBatch(std::span<const DecodedElGamal> in, std::span<ElGamal> out) {
+  CheckBatchSize(in.size(), out.size(), __func__);
+  std::vector<DecodedGroupElement> points;
+  points.reserve(3 * in.size());
+  for (const auto& x : in) {
+    points.push_back(x.B);
+    points.push_back(x.C);
+    points.push_back(x.Y);
+  }
+  std::vector<GroupElement> encoded(points.size());
+  DoubleAndEncodeBatch(points, encoded);
+  for (size_t i = 0; i < in.size(); ++i)
+    out[i] = {encoded[3 * i], encoded[3 * i + 1], encoded[3 * i + 2]};
+}
@@ -0,0 +1,257 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#include "curve-backend.h"
+
+// Curve backend for x86-64 CPUs with AVX2, see curve-simd.h. A field element is ten limbs of alternately 26 and 25
+// bits (radix 2^25.5, as in ref10), so the products of two limbs fit the 32 x 32 -> 64 bit multiplications of AVX2;
+// limb i of the four lanes is one vector.
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LIBPEP_CURVE_AVX2
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+namespace {
+
+using libpep::FieldElement;
+
+const uint64_t MASK26 = (uint64_t(1) << 26) - 1;
+const uint64_t MASK25 = (uint64_t(1) << 25) - 1;
+
+struct Avx2Field4 {
+  __m256i v[10];
+
+  static Avx2Field4 Zero() {
+    Avx2Field4 r;
+#pragma GCC unroll 10
+    for (auto& limb : r.v)
+      limb = _mm256_setzero_si256();
+    return r;
+  }
+
+  static Avx2Field4 Load(const FieldElement& a, const FieldElement& b, const FieldElement& c, const FieldElement& d) {
+    Avx2Field4 r;
+#pragma GCC unroll 5
+    for (int k = 0; k < 5; ++k) {
+      r.v[2 * k] = _mm256_set_epi64x(static_cast<long long>(d.v[k] & MASK26), static_cast<long long>(c.v[k] & MASK26), static_cast<long long>(b.v[k] & MASK26), static_cast<long long>(a.v[k] & MASK26));
+      r.v[2 * k + 1] = _mm256_set_epi64x(static_cast<long long>(d.v[k] >> 26), static_cast<long long>(c.v[k] >> 26), static_cast<long long>(b.v[k] >> 26), static_cast<long long>(a.v[k] >> 26));
+    }
+    return r.Reduce();
+  }
+
+  void Store(FieldElement& a, FieldElement& b, FieldElement& c, FieldElement& d) const {
+    alignas(32) uint64_t lanes[10][4];
+#pragma GCC unroll 10
+    for (int i = 0; i < 10; ++i)
+      _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[i]), v[i]);
+    FieldElement* out[4] = {&a, &b, &c, &d};
+#pragma GCC unroll 4
+    for (int lane = 0; lane < 4; ++lane)
+#pragma GCC unroll 5
+      for (int k = 0; k < 5; ++k)
+        out[lane]->v[k] = lanes[2 * k][lane] + (lanes[2 * k + 1][lane] << 26);
+  }
+
+  [[gnu::always_inline]] Avx2Field4 operator+(const Avx2Field4& g) const {
+    Avx2Field4 r;
+#pragma GCC unroll 10
+    for (int i = 0; i < 10; ++i)
+      r.v[i] = _mm256_add_epi64(v[i], g.v[i]);
+    return r;
+  }
+
+  // adds 2p, so the limbs stay positive
+  [[gnu::always_inline]] Avx2Field4 operator-(const Avx2Field4& g) const {
+    const __m256i p0 = _mm256_set1_epi64x(2 * ((int64_t(1) << 26) - 19));
+    const __m256i even = _mm256_set1_epi64x(2 * ((int64_t(1) << 26) - 1));
+    const __m256i odd = _mm256_set1_epi64x(2 * ((int64_t(1) << 25) - 1));
+    Avx2Field4 r;
+#pragma GCC unroll 10
+    for (int i = 0; i < 10; ++i)
+      r.v[i] = _mm256_sub_epi64(_mm256_add_epi64(v[i], i == 0 ? p0 : (i & 1) ? odd : even), g.v[i]);
+    return r;
+  }
+
+  [[gnu::always_inline]] Avx2Field4 operator*(const Avx2Field4& g) const {
+    const __m256i nineteen = _mm256_set1_epi64x(19);
+    __m256i g19[10];
+    __m256i f2[10];
+    __m256i h[10];
+#pragma GCC unroll 10
+    for (int i = 0; i < 10; ++i) {
+      g19[i] = _mm256_mul_epu32(g.v[i], nineteen);
+      f2[i] = _mm256_add_epi64(v[i], v[i]);
+      h[i] = _mm256_setzero_si256();
+    }
+    // limb i has weight 2^ceil(25.5 i): the product of two odd limbs counts twice, and 2^255 = 19; one output limb
+    // at a time, so only the sum is kept in a register
+#pragma GCC unroll 10
+    for (int k = 0; k < 10; ++k) {
+#pragma GCC unroll 10
+      for (int i = 0; i < 10; ++i) {
+        int j = (k - i + 10) % 10;
+        __m256i f = (i & j & 1) ? f2[i] : v[i];
+        h[k] = _mm256_add_epi64(h[k], _mm256_mul_epu32(f, i + j < 10 ? g.v[j] : g19[j]));
+      }
+    }
+    Avx2Field4 r;
+#pragma GCC unroll 10
+    for (int i = 0; i < 10; ++i)
+      r.v[i] = h[i];
+    return r.Reduce();
+  }
+
+  // same as *this * *this, but the products of two different limbs are computed once
+  [[gnu::always_inline]] Avx2Field4 Square() const {
+    const __m256i nineteen = _mm256_set1_epi64x(19);
+    __m256i f19[10];
+    __m256i f2[10];
+    __m256i f4[10];
+    __m256i h[10];
+#pragma GCC unroll 10
+    for (int i = 0; i < 10; ++i) {
+      f19[i] = _mm256_mul_epu32(v[i], nineteen);
+      f2[i] = _mm256_add_epi64(v[i], v[i]);
+      f4[i] = _mm256_add_epi64(f2[i], f2[i]);
+      h[i] = _mm256_setzero_si256();
+    }
+#pragma GCC unroll 10
+    for (int k = 0; k < 10; ++k) {
+#pragma GCC unroll 10
+      for (int i = 0; i < 10; ++i) {
+        int j = (k - i + 10) % 10;
+        if (j < i)
+          continue;
+        __m256i f = i == j ? ((i & 1) ? f2[i] : v[i]) : ((i & j & 1) ? f4[i] : f2[i]);
+        h[k] = _mm256_add_epi64(h[k], _mm256_mul_epu32(f, i + j < 10 ? v[j] : f19[j]));
+      }
+    }
+    Avx2Field4 r;
+#pragma GCC unroll 10
+    for (int i = 0; i < 10; ++i)
+      r.v[i] = h[i];
+    return r.Reduce();
+  }
+
+  // two rounds of carries, all limbs at once: for inputs below 2^64 the limbs end below 2^26 + 2^22 (even) and
+  // 2^25 + 2^18 (odd)
+  [[gnu::always_inline]] Avx2Field4 Reduce() const {
+    const __m256i mask26 = _mm256_set1_epi64x(static_cast<long long>(MASK26));
+    const __m256i mask25 = _mm256_set1_epi64x(static_cast<long long>(MASK25));
+    Avx2Field4 r = *this;
+#pragma GCC unroll 2
+    for (int round = 0; round < 2; ++round) {
+      __m256i c[10];
+#pragma GCC unroll 10
+      for (int i = 0; i < 10; ++i) {
+        c[i] = _mm256_srli_epi64(r.v[i], i & 1 ? 25 : 26);
+        r.v[i] = _mm256_and_si256(r.v[i], i & 1 ? mask25 : mask26);
+      }
+      // 2^255 = 19
+      r.v[0] = _mm256_add_epi64(r.v[0], _mm256_add_epi64(_mm256_add_epi64(c[9], _mm256_slli_epi64(c[9], 1)), _mm256_slli_epi64(c[9], 4)));
+#pragma GCC unroll 9
+      for (int i = 1; i < 10; ++i)
+        r.v[i] = _mm256_add_epi64(r.v[i], c[i - 1]);
+    }
+    return r;
+  }
+
+  template <int a, int b, int c, int d>
+  [[gnu::always_inline]] Avx2Field4 Shuffle() const {
+    // lanes that stay in their 128 bit half use the cheaper in-lane shuffles and blends
+    constexpr bool inLane = a < 2 && b < 2 && c >= 2 && d >= 2;
+    // 32 bit words of lanes B and D taking the low half, and of lanes A and C taking the high half (others stay)
+    constexpr int low = (b == 0 ? 0x0c : 0) | (d == 2 ? 0xc0 : 0);
+    constexpr int high = (a == 1 ? 0x03 : 0) | (c == 3 ? 0x30 : 0);
+    Avx2Field4 r;
+#pragma GCC unroll 10
+    for (int i = 0; i < 10; ++i) {
+      if constexpr (!inLane) {
+        r.v[i] = _mm256_permute4x64_epi64(v[i], a | (b << 2) | (c << 4) | (d << 6));
+      } else if constexpr (a == c - 2 && b == d - 2) {
+        r.v[i] = _mm256_shuffle_epi32(v[i], (2 * a) | ((2 * a + 1) << 2) | ((2 * b) << 4) | ((2 * b + 1) << 6));
+      } else {
+        r.v[i] = v[i];
+        if constexpr (low != 0)
+          r.v[i] = _mm256_blend_epi32(r.v[i], _mm256_unpacklo_epi64(v[i], v[i]), low);
+        if constexpr (high != 0)
+          r.v[i] = _mm256_blend_epi32(r.v[i], _mm256_unpackhi_epi64(v[i], v[i]), high);
+      }
+    }
+    return r;
+  }
+
+  template <int lanes>
+  [[gnu::always_inline]] Avx2Field4 Blend(const Avx2Field4& other) const {
+    // two 32 bit words per lane
+    const int mask = (lanes & 1 ? 0x03 : 0) | (lanes & 2 ? 0x0c : 0) | (lanes & 4 ? 0x30 : 0) | (lanes & 8 ? 0xc0 : 0);
+    Avx2Field4 r;
+#pragma GCC unroll 10
+    for (int i = 0; i < 10; ++i)
+      r.v[i] = _mm256_blend_epi32(v[i], other.v[i], mask);
+    return r;
+  }
+
+  [[gnu::always_inline]] Avx2Field4 Select(const Avx2Field4& other, uint64_t mask) const {
+    const __m256i m = _mm256_set1_epi64x(static_cast<long long>(mask));
+    Avx2Field4 r;
+#pragma GCC unroll 10
+    for (int i = 0; i < 10; ++i)
+      r.v[i] = _mm256_or_si256(_mm256_andnot_si256(m, v[i]), _mm256_and_si256(m, other.v[i]));
+    return r;
+  }
+};
+
+}
+
+#include "curve-simd.h"
+
+namespace {
+
+const libpep::CurveBackendOperations avx2Operations = {ScalarMult<Avx2Field4>, DoubleScalarMult<Avx2Field4>, ScalarMultVartime<Avx2Field4>, DoubleScalarMultVartime<Avx2Field4>, DoubleScalarMultBaseVartime<Avx2Field4>};
+
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif
+
+const libpep::CurveBackendOperations* libpep::AVX2CurveOperations() {
+#ifdef LIBPEP_CURVE_AVX2
+  static const bool supported = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+  }();
+  return supported ? &avx2Operations : nullptr;
+#else
+  return nullptr;
+#endif
+}
@@ -0,0 +1,223 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#include "curve-backend.h"
+
+// Curve backend for x86-64 CPUs with AVX-512 IFMA, see curve-simd.h. A field element is five limbs of 51 bits, like
+// FieldElement; the 52 bit multiply-add instructions give the low and high halves of the products of two limbs
+// (below 2^52). Only 256 bit vectors are used (with AVX-512 VL): limb i of the four lanes is one vector.
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LIBPEP_CURVE_IFMA
+
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f,avx512vl,avx512ifma"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512vl,avx512ifma")
+#endif
+
+namespace {
+
+using libpep::FieldElement;
+
+const uint64_t MASK51 = (uint64_t(1) << 51) - 1;
+
+// c * 19
+inline __m256i Mul19(__m256i c) {
+  return _mm256_add_epi64(_mm256_add_epi64(c, _mm256_slli_epi64(c, 1)), _mm256_slli_epi64(c, 4));
+}
+
+// Every result is reduced (limbs below 2^52), so it can be multiplied.
+struct IfmaField4 {
+  __m256i v[5];
+
+  static IfmaField4 Zero() {
+    IfmaField4 r;
+#pragma GCC unroll 5
+    for (auto& limb : r.v)
+      limb = _mm256_setzero_si256();
+    return r;
+  }
+
+  static IfmaField4 Load(const FieldElement& a, const FieldElement& b, const FieldElement& c, const FieldElement& d) {
+    IfmaField4 r;
+#pragma GCC unroll 5
+    for (int k = 0; k < 5; ++k)
+      r.v[k] = _mm256_set_epi64x(static_cast<long long>(d.v[k]), static_cast<long long>(c.v[k]), static_cast<long long>(b.v[k]), static_cast<long long>(a.v[k]));
+    return r.Reduce();
+  }
+
+  void Store(FieldElement& a, FieldElement& b, FieldElement& c, FieldElement& d) const {
+    alignas(32) uint64_t lanes[5][4];
+#pragma GCC unroll 5
+    for (int k = 0; k < 5; ++k)
+      _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[k]), v[k]);
+    FieldElement* out[4] = {&a, &b, &c, &d};
+#pragma GCC unroll 4
+    for (int lane = 0; lane < 4; ++lane)
+#pragma GCC unroll 5
+      for (int k = 0; k < 5; ++k)
+        out[lane]->v[k] = lanes[k][lane];
+  }
+
+  [[gnu::always_inline]] IfmaField4 operator+(const IfmaField4& g) const {
+    IfmaField4 r;
+#pragma GCC unroll 5
+    for (int k = 0; k < 5; ++k)
+      r.v[k] = _mm256_add_epi64(v[k], g.v[k]);
+    return r.Reduce();
+  }
+
+  // adds 2p, so the limbs stay positive
+  [[gnu::always_inline]] IfmaField4 operator-(const IfmaField4& g) const {
+    const __m256i p0 = _mm256_set1_epi64x(2 * ((int64_t(1) << 51) - 19));
+    const __m256i pi = _mm256_set1_epi64x(2 * ((int64_t(1) << 51) - 1));
+    IfmaField4 r;
+#pragma GCC unroll 5
+    for (int k = 0; k < 5; ++k)
+      r.v[k] = _mm256_sub_epi64(_mm256_add_epi64(v[k], k == 0 ? p0 : pi), g.v[k]);
+    return r.Reduce();
+  }
+
+  [[gnu::always_inline]] IfmaField4 operator*(const IfmaField4& g) const {
+    // the product of limbs i and j is lo + 2^52 hi: lo counts for limb i+j, 2 * hi for limb i+j+1
+    __m256i lo[9];
+    __m256i hi[9];
+#pragma GCC unroll 9
+    for (int k = 0; k < 9; ++k) {
+      lo[k] = _mm256_setzero_si256();
+      hi[k] = _mm256_setzero_si256();
+    }
+#pragma GCC unroll 5
+    for (int i = 0; i < 5; ++i) {
+#pragma GCC unroll 5
+      for (int j = 0; j < 5; ++j) {
+        lo[i + j] = _mm256_madd52lo_epu64(lo[i + j], v[i], g.v[j]);
+        hi[i + j] = _mm256_madd52hi_epu64(hi[i + j], v[i], g.v[j]);
+      }
+    }
+    __m256i z[10];
+    z[0] = lo[0];
+#pragma GCC unroll 9
+    for (int k = 1; k < 9; ++k)
+      z[k] = _mm256_add_epi64(lo[k], _mm256_add_epi64(hi[k - 1], hi[k - 1]));
+    z[9] = _mm256_add_epi64(hi[8], hi[8]);
+    // 2^255 = 19
+    IfmaField4 r;
+#pragma GCC unroll 5
+    for (int k = 0; k < 5; ++k)
+      r.v[k] = _mm256_add_epi64(z[k], Mul19(z[k + 5]));
+    return r.Reduce();
+  }
+
+  [[gnu::always_inline]] IfmaField4 Square() const {
+    return *this * *this;
+  }
+
+  // one round of carries, all limbs at once: for inputs below 2^64 the limbs end below 2^51 + 19 * 2^13
+  [[gnu::always_inline]] IfmaField4 Reduce() const {
+    const __m256i mask = _mm256_set1_epi64x(static_cast<long long>(MASK51));
+    __m256i c[5];
+#pragma GCC unroll 5
+    for (int k = 0; k < 5; ++k)
+      c[k] = _mm256_srli_epi64(v[k], 51);
+    IfmaField4 r;
+    r.v[0] = _mm256_add_epi64(_mm256_and_si256(v[0], mask), Mul19(c[4]));
+#pragma GCC unroll 4
+    for (int k = 1; k < 5; ++k)
+      r.v[k] = _mm256_add_epi64(_mm256_and_si256(v[k], mask), c[k - 1]);
+    return r;
+  }
+
+  template <int a, int b, int c, int d>
+  [[gnu::always_inline]] IfmaField4 Shuffle() const {
+    // lanes that stay in their 128 bit half use the cheaper in-lane shuffles and blends
+    constexpr bool inLane = a < 2 && b < 2 && c >= 2 && d >= 2;
+    // 32 bit words of lanes B and D taking the low half, and of lanes A and C taking the high half (others stay)
+    constexpr int low = (b == 0 ? 0x0c : 0) | (d == 2 ? 0xc0 : 0);
+    constexpr int high = (a == 1 ? 0x03 : 0) | (c == 3 ? 0x30 : 0);
+    IfmaField4 r;
+#pragma GCC unroll 5
+    for (int k = 0; k < 5; ++k) {
+      if constexpr (!inLane) {
+        r.v[k] = _mm256_permute4x64_epi64(v[k], a | (b << 2) | (c << 4) | (d << 6));
+      } else if constexpr (a == c - 2 && b == d - 2) {
+        r.v[k] = _mm256_shuffle_epi32(v[k], (2 * a) | ((2 * a + 1) << 2) | ((2 * b) << 4) | ((2 * b + 1) << 6));
+      } else {
+        r.v[k] = v[k];
+        if constexpr (low != 0)
+          r.v[k] = _mm256_blend_epi32(r.v[k], _mm256_unpacklo_epi64(v[k], v[k]), low);
+        if constexpr (high != 0)
+          r.v[k] = _mm256_blend_epi32(r.v[k], _mm256_unpackhi_epi64(v[k], v[k]), high);
+      }
+    }
+    return r;
+  }
+
+  template <int lanes>
+  [[gnu::always_inline]] IfmaField4 Blend(const IfmaField4& other) const {
+    IfmaField4 r;
+#pragma GCC unroll 5
+    for (int k = 0; k < 5; ++k)
+      r.v[k] = _mm256_mask_blend_epi64(static_cast<__mmask8>(lanes), v[k], other.v[k]);
+    return r;
+  }
+
+  [[gnu::always_inline]] IfmaField4 Select(const IfmaField4& other, uint64_t mask) const {
+    const __m256i m = _mm256_set1_epi64x(static_cast<long long>(mask));
+    IfmaField4 r;
+#pragma GCC unroll 5
+    for (int k = 0; k < 5; ++k)
+      r.v[k] = _mm256_or_si256(_mm256_andnot_si256(m, v[k]), _mm256_and_si256(m, other.v[k]));
+    return r;
+  }
+};
+
+}
+
+#include "curve-simd.h"
+
+namespace {
+
+const libpep::CurveBackendOperations ifmaOperations = {ScalarMult<IfmaField4>, DoubleScalarMult<IfmaField4>, ScalarMultVartime<IfmaField4>, DoubleScalarMultVartime<IfmaField4>, DoubleScalarMultBaseVartime<IfmaField4>};
+
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif
+
+const libpep::CurveBackendOperations* libpep::AVX512IFMACurveOperations() {
+#ifdef LIBPEP_CURVE_IFMA
+  static const bool supported = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512ifma") && __builtin_cpu_supports("avx512vl");
+  }();
+  return supported ? &ifmaOperations : nullptr;
+#else
+  return nullptr;
+#endif
+}
@@ -0,0 +1,249 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+// Point arithmetic of the SIMD curve backends (curve-avx2.cpp and curve-ifma.cpp), generic in the type F4 of four
+// field elements, one in every lane of a vector. Included by a backend after it selected its instruction set, so
+// everything is in an anonymous namespace (no code compiled for one instruction set ends up in another translation
+// unit) and no standard library headers are included here.
+//
+// A point in extended coordinates (X:Y:Z:T) is one F4 with X, Y, Z and T in lanes A, B, C and D, and a point ready
+// to be added ("cached") is (Y-X, Y+X, 2Z, 2dT). With the formulas of Hisil, Wong, Carter and Dawson ("Twisted
+// Edwards curves revisited", 2008) both an addition and a doubling are then two multiplications of F4, four field
+// multiplications at once, instead of eight or nine separate ones.
+//
+// F4 provides Zero(), Load(a, b, c, d) and Store(a, b, c, d) to convert from and to FieldElement, +, -, * and
+// Square(), Reduce(), Shuffle<a, b, c, d>() (lane i of the result is lane a/b/c/d of the input), Blend<lanes>(other)
+// (the lanes in the bit mask are taken from other) and Select(other, mask) (other if mask is all ones, constant
+// time). Results of *, Square() and Reduce() are reduced, and reduced values, their sums and their differences can
+// be multiplied; the value subtracted must always be reduced.
+
+namespace {
+
+using libpep::DecodedGroupElement;
+using libpep::FieldElement;
+
+enum : int { LANE_A = 1, LANE_B = 2, LANE_C = 4, LANE_D = 8 };
+
+const FieldElement simd_zero = {{0, 0, 0, 0, 0}};
+const FieldElement simd_one = {{1, 0, 0, 0, 0}};
+const FieldElement simd_two = {{2, 0, 0, 0, 0}};
+// 2 * d, with d = -121665/121666
+const FieldElement simd_d2 = {{0x69b9426b2f159, 0x35050762add7a, 0x3cf44c0038052, 0x6738cc7407977, 0x2406d9dc56dff}};
+
+template <typename F4>
+struct Curve {
+  F4 zero = F4::Zero();
+  F4 identity = F4::Load(simd_zero, simd_one, simd_one, simd_zero);
+  F4 cachedIdentity = F4::Load(simd_one, simd_one, simd_two, simd_zero);
+  F4 cachedFactor = F4::Load(simd_one, simd_one, simd_one, simd_d2);
+
+  // (E, H, F, G) to (EF, GH, FG, EH) = (X3, Y3, Z3, T3)
+  [[gnu::always_inline]] static F4 Finish(const F4& w) {
+    return w.template Shuffle<0, 3, 2, 0>() * w.template Shuffle<2, 1, 3, 1>();
+  }
+
+  // p + q, with q cached
+  [[gnu::always_inline]] static F4 Add(const F4& p, const F4& q) {
+    F4 s1 = p.template Shuffle<1, 1, 2, 3>(); // (Y1, Y1, Z1, T1)
+    F4 s2 = p.template Shuffle<0, 0, 2, 3>(); // (X1, X1, Z1, T1)
+    F4 t = p.template Blend<LANE_A>(s1 - s2).template Blend<LANE_B>(s1 + s2); // (Y1-X1, Y1+X1, Z1, T1)
+    F4 m = t * q; // (A, B, D, C) = ((Y1-X1)(Y2-X2), (Y1+X1)(Y2+X2), 2Z1Z2, 2dT1T2)
+    F4 u1 = m.template Shuffle<1, 1, 2, 2>(); // (B, B, D, D)
+    F4 u2 = m.template Shuffle<0, 0, 3, 3>(); // (A, A, C, C)
+    return Finish((u1 - u2).template Blend<LANE_B | LANE_D>(u1 + u2)); // (E, H, F, G) = (B-A, B+A, D-C, D+C)
+  }
+
+  // 2 * p; computes the negation of all of E, F, G and H, which leaves the products the same
+  [[gnu::always_inline]] F4 Double(const F4& p) const {
+    // only the swaps of the 128 bit halves cross lanes, all other shuffles stay within a half
+    F4 h = p.template Shuffle<2, 3, 0, 1>(); // (Z, T, X, Y)
+    F4 t = p.template Blend<LANE_D>(h + h.template Shuffle<1, 0, 3, 2>()); // (X, Y, Z, X+Y)
+    F4 q = t.Square(); // (A, B, Z^2, S)
+    F4 qs = q.template Shuffle<1, 0, 3, 2>(); // (B, A, S, Z^2)
+    F4 u = q.template Shuffle<2, 3, 0, 1>(); // (Z^2, S, A, B)
+    F4 us = u.template Shuffle<1, 0, 3, 2>(); // (S, Z^2, B, A)
+    F4 pos = q.template Blend<LANE_B>(qs).template Blend<LANE_C>(u).template Blend<LANE_D>(us) + qs.template Blend<LANE_B>(q).template Blend<LANE_C>(q + q).template Blend<LANE_D>(zero); // (A, A, A, A) + (B, B, 2Z^2, 0)
+    F4 neg = us.template Blend<LANE_B>(zero).template Blend<LANE_D>(u); // (S, 0, B, B)
+    return Finish((pos - neg).Reduce());
+  }
+
+  [[gnu::always_inline]] F4 ToCached(const F4& p) const {
+    F4 s1 = p.template Shuffle<1, 1, 2, 3>(); // (Y, Y, Z, T)
+    F4 s2 = p.template Shuffle<0, 0, 2, 3>(); // (X, X, Z, T)
+    F4 t = (s1 + s2).template Blend<LANE_A>(s1 - s2).template Blend<LANE_D>(p); // (Y-X, Y+X, 2Z, T)
+    return t * cachedFactor;
+  }
+
+  // -q for q cached
+  [[gnu::always_inline]] F4 Negate(const F4& q) const {
+    return q.template Shuffle<1, 0, 2, 3>().template Blend<LANE_D>(zero - q);
+  }
+
+  // pi[i] = (i+1) * p
+  void Precompute8(F4 pi[8], const F4& p) const {
+    pi[0] = ToCached(p);
+    F4 u = p;
+    for (int i = 1; i < 8; ++i) {
+      u = Add(u, pi[0]);
+      pi[i] = ToCached(u);
+    }
+  }
+
+  // pi[i] = (2i+1) * p
+  void PrecomputeOdd8(F4 pi[8], const F4& p) const {
+    F4 p2 = ToCached(Double(p));
+    pi[0] = ToCached(p);
+    F4 u = p;
+    for (int i = 1; i < 8; ++i) {
+      u = Add(u, p2);
+      pi[i] = ToCached(u);
+    }
+  }
+
+  // all ones if a == b, otherwise zero; constant time
+  static uint64_t EqualMask(unsigned int a, unsigned int b) {
+    uint64_t x = a ^ b;
+    return 0 - ((x - 1) >> 63);
+  }
+
+  // b * p with pi[i] = (i+1) * p and -8 <= b <= 8, constant time
+  [[gnu::always_inline]] F4 Select(const F4 pi[8], signed char b) const {
+    const unsigned int ub = static_cast<unsigned char>(b);
+    const unsigned int bnegative = ub >> 7;
+    const unsigned int babs = (ub ^ ((0 - bnegative) & (ub ^ (0 - ub)))) & 0xff;
+    F4 t = cachedIdentity;
+    for (unsigned int i = 0; i < 8; ++i)
+      t = t.Select(pi[i], EqualMask(babs, i + 1));
+    return t.Select(Negate(t), 0 - uint64_t(bnegative));
+  }
+
+  F4 Load(const DecodedGroupElement& p) const {
+    return F4::Load(p.X, p.Y, p.Z, p.T);
+  }
+
+  static void Store(DecodedGroupElement& h, const F4& p) {
+    p.Store(h.X, h.Y, h.Z, h.T);
+  }
+};
+
+template <typename F4>
+void ScalarMult(DecodedGroupElement& h, const signed char e[64], const DecodedGroupElement& p) {
+  Curve<F4> curve;
+  F4 pi[8];
+  curve.Precompute8(pi, curve.Load(p));
+  F4 r = curve.identity;
+  for (int i = 63; i != 0; i--) {
+    r = curve.Add(r, curve.Select(pi, e[i]));
+    // not unrolled: four inlined doublings make the loop too large for the instruction caches
+#pragma GCC unroll 1
+    for (int j = 0; j < 4; ++j)
+      r = curve.Double(r);
+  }
+  curve.Store(h, curve.Add(r, curve.Select(pi, e[0])));
+}
+
+template <typename F4>
+void DoubleScalarMult(DecodedGroupElement& h, const signed char e[64], const DecodedGroupElement& p, const signed char f[64], const DecodedGroupElement& q) {
+  Curve<F4> curve;
+  F4 pi[8];
+  F4 qi[8];
+  curve.Precompute8(pi, curve.Load(p));
+  curve.Precompute8(qi, curve.Load(q));
+  F4 r = curve.identity;
+  for (int i = 63; i != 0; i--) {
+    r = curve.Add(r, curve.Select(pi, e[i]));
+    r = curve.Add(r, curve.Select(qi, f[i]));
+#pragma GCC unroll 1
+    for (int j = 0; j < 4; ++j)
+      r = curve.Double(r);
+  }
+  r = curve.Add(r, curve.Select(pi, e[0]));
+  curve.Store(h, curve.Add(r, curve.Select(qi, f[0])));
+}
+
+// r + d * p for a NAF digit d, with pi the odd multiples of p, variable time
+template <typename F4>
+[[gnu::always_inline]] inline F4 AddDigitVartime(const Curve<F4>& curve, const F4& r, const F4 pi[8], signed char d) {
+  if (d > 0)
+    return curve.Add(r, pi[d / 2]);
+  if (d < 0)
+    return curve.Add(r, curve.Negate(pi[-d / 2]));
+  return r;
+}
+
+template <typename F4>
+void ScalarMultVartime(DecodedGroupElement& h, const signed char e[256], const DecodedGroupElement& p) {
+  Curve<F4> curve;
+  int i = 255;
+  while (i >= 0 && !e[i])
+    --i;
+  if (i < 0) {
+    curve.Store(h, curve.identity);
+    return;
+  }
+  F4 pi[8];
+  curve.PrecomputeOdd8(pi, curve.Load(p));
+  F4 r = curve.identity;
+  for (; i >= 0; --i)
+    r = AddDigitVartime(curve, curve.Double(r), pi, e[i]);
+  curve.Store(h, r);
+}
+
+// h = e * p + f * q with pi and qi the odd multiples of p and q, variable time
+template <typename F4>
+void DoubleScalarMultVartime(const Curve<F4>& curve, DecodedGroupElement& h, const signed char e[256], const F4 pi[8], const signed char f[256], const F4 qi[8]) {
+  int i = 255;
+  while (i >= 0 && !e[i] && !f[i])
+    --i;
+  F4 r = curve.identity;
+  for (; i >= 0; --i)
+    r = AddDigitVartime(curve, AddDigitVartime(curve, curve.Double(r), pi, e[i]), qi, f[i]);
+  curve.Store(h, r);
+}
+
+template <typename F4>
+void DoubleScalarMultVartime(DecodedGroupElement& h, const signed char e[256], const DecodedGroupElement& p, const signed char f[256], const DecodedGroupElement& q) {
+  Curve<F4> curve;
+  F4 pi[8];
+  F4 qi[8];
+  curve.PrecomputeOdd8(pi, curve.Load(p));
+  curve.PrecomputeOdd8(qi, curve.Load(q));
+  DoubleScalarMultVartime(curve, h, e, pi, f, qi);
+}
+
+template <typename F4>
+void DoubleScalarMultBaseVartime(DecodedGroupElement& h, const signed char e[256], const signed char f[256], const DecodedGroupElement& q) {
+  Curve<F4> curve;
+  // the odd multiples of G, computed once
+  struct Table {
+    F4 gi[8];
+  };
+  static const Table table = [&curve] {
+    libpep::Scalar one;
+    one.value[0] = 1;
+    Table retval;
+    curve.PrecomputeOdd8(retval.gi, curve.Load(DecodedGroupElement::MultBase(one)));
+    return retval;
+  }();
+  F4 qi[8];
+  curve.PrecomputeOdd8(qi, curve.Load(q));
+  DoubleScalarMultVartime(curve, h, e, table.gi, f, qi);
+}
+
+}
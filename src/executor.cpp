@@ -0,0 +1,192 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#include "executor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+using namespace libpep;
+
+namespace {
+
+// the executor and queue of the current thread, if it is a worker thread
+thread_local const WorkStealingExecutor* currentExecutor = nullptr;
+thread_local size_t currentQueue = 0;
+
+}
+
+size_t libpep::InlineExecutor::concurrency() const {
+  return 1;
+}
+
+void libpep::InlineExecutor::run(size_t count, const std::function<void(size_t)>& f) {
+  std::exception_ptr error;
+  for (size_t i = 0; i < count; ++i) {
+    try {
+      f(i);
+    } catch (...) {
+      if (!error)
+        error = std::current_exception();
+    }
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+struct WorkStealingExecutor::Job {
+  const std::function<void(size_t)>& f;
+  std::atomic<size_t> remaining;
+  std::exception_ptr error; // protected by sleepMutex
+};
+
+libpep::WorkStealingExecutor::WorkStealingExecutor(size_t _threads) {
+  if (_threads == 0)
+    _threads = std::max(1U, std::thread::hardware_concurrency());
+  // the thread calling run() helps, so one less worker is needed
+  for (size_t i = 0; i < _threads; ++i)
+    queues.push_back(std::make_unique<Queue>());
+  for (size_t i = 0; i + 1 < _threads; ++i)
+    threads.emplace_back([this, i]() { worker(i); });
+}
+
+libpep::WorkStealingExecutor::~WorkStealingExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    stopping = true;
+  }
+  sleeping.notify_all();
+  for (auto& thread : threads)
+    thread.join();
+}
+
+size_t libpep::WorkStealingExecutor::concurrency() const {
+  return queues.size();
+}
+
+void libpep::WorkStealingExecutor::push(size_t queue, const Task& task) {
+  {
+    std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+    queues[queue]->tasks.push_back(task);
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    ++queued;
+  }
+  sleeping.notify_one();
+}
+
+bool libpep::WorkStealingExecutor::pop(size_t queue, Task& task) {
+  {
+    std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+    if (queues[queue]->tasks.empty())
+      return false;
+    task = queues[queue]->tasks.back();
+    queues[queue]->tasks.pop_back();
+  }
+  std::lock_guard<std::mutex> lock(sleepMutex);
+  --queued;
+  return true;
+}
+
+bool libpep::WorkStealingExecutor::steal(size_t thief, Task& task) {
+  for (size_t i = 1; i < queues.size(); ++i) {
+    Queue& victim = *queues[(thief + i) % queues.size()];
+    {
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (victim.tasks.empty())
+        continue;
+      task = victim.tasks.front();
+      victim.tasks.pop_front();
+    }
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    --queued;
+    return true;
+  }
+  return false;
+}
+
+void libpep::WorkStealingExecutor::execute(size_t queue, Task task) {
+  // keep the lower half, and make the upper half available for other threads
+  while (task.end - task.begin > 1) {
+    size_t middle = task.begin + (task.end - task.begin) / 2;
+    push(queue, {task.job, middle, task.end});
+    task.end = middle;
+  }
+  Job& job = *task.job;
+  std::exception_ptr error;
+  try {
+    job.f(task.begin);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  std::lock_guard<std::mutex> lock(sleepMutex);
+  if (error && !job.error)
+    job.error = error;
+  // after this the job can be destroyed by the thread waiting in run()
+  if (--job.remaining == 0)
+    sleeping.notify_all();
+}
+
+void libpep::WorkStealingExecutor::worker(size_t index) {
+  currentExecutor = this;
+  currentQueue = index;
+  for (;;) {
+    Task task;
+    if (pop(index, task) || steal(index, task)) {
+      execute(index, task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    sleeping.wait(lock, [this] { return queued > 0 || stopping; });
+    if (stopping && queued == 0)
+      return;
+  }
+}
+
+void libpep::WorkStealingExecutor::run(size_t count, const std::function<void(size_t)>& f) {
+  if (count == 0)
+    return;
+  // external threads share the last queue
+  size_t queue = currentExecutor == this ? currentQueue : queues.size() - 1;
+  Job job{f, {count}, nullptr};
+  push(queue, {&job, 0, count});
+  while (job.remaining > 0) {
+    Task task;
+    if (pop(queue, task) || steal(queue, task)) {
+      execute(queue, task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    sleeping.wait(lock, [&job, this] { return queued > 0 || job.remaining == 0; });
+  }
+  std::exception_ptr error;
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    error = job.error;
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+Executor& libpep::DefaultExecutor() {
+  static WorkStealingExecutor executor;
+  return executor;
+}
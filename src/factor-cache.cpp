@@ -0,0 +1,164 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#include "factor-cache.h"
+
+#include <stdexcept>
+#include <vector>
+
+#include "sodium.h"
+
+using namespace libpep;
+
+namespace {
+
+// wipe the key (containing the secret) before it is released
+void Wipe(std::string& key) {
+  sodium_memzero(key.data(), key.size());
+}
+
+// factor = SHA512(key), reduced to a scalar
+Scalar Derive(const std::string& key) {
+  HashSHA512 hash;
+  SHA512(hash, key);
+  Scalar retval = Scalar::FromHash(hash);
+  sodium_memzero(hash, sizeof(hash));
+  return retval;
+}
+
+}
+
+libpep::FactorCache::FactorCache(size_t capacity, size_t _shards) : shardCapacity(0), shardCount(_shards), shards(nullptr) {
+  if (capacity == 0 || shardCount == 0)
+    throw std::invalid_argument("FactorCache expects a non zero capacity and number of shards");
+  shardCapacity = (capacity + shardCount - 1) / shardCount;
+  shards = std::make_unique<Shard[]>(shardCount);
+}
+
+libpep::FactorCache::~FactorCache() {
+  clear();
+}
+
+FactorCache::Shard& libpep::FactorCache::shardOf(const std::string& key) {
+  return shards[std::hash<std::string_view>()(key) % shardCount];
+}
+
+std::string libpep::FactorCache::MakeKey(std::string_view type, std::string_view secret, std::string_view context) {
+  // same input as the hash, so equal keys result in equal factors
+  std::string key;
+  key.reserve(type.size() + secret.size() + context.size() + 2);
+  key.append(type).append("|").append(secret).append("|").append(context);
+  return key;
+}
+
+bool libpep::FactorCache::lookup(const std::string& key, Factor& out) {
+  Shard& shard = shardOf(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(key);
+  if (it == shard.index.end()) {
+    shard.misses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  shard.hits.fetch_add(1, std::memory_order_relaxed);
+  out = it->second->second;
+  return true;
+}
+
+void libpep::FactorCache::insert(std::string&& key, const Factor& factor) {
+  Shard& shard = shardOf(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.index.find(key) != shard.index.end()) {
+    // inserted by another thread in the meantime
+    Wipe(key);
+    return;
+  }
+  shard.lru.emplace_front(std::move(key), factor);
+  shard.index.emplace(shard.lru.front().first, shard.lru.begin());
+  while (shard.lru.size() > shardCapacity) {
+    auto& last = shard.lru.back();
+    shard.index.erase(last.first);
+    Wipe(last.first);
+    shard.lru.pop_back();
+    shard.evictions.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+Factor libpep::FactorCache::get(std::string_view type, std::string_view secret, std::string_view context) {
+  std::string key = MakeKey(type, secret, context);
+  Factor factor;
+  if (lookup(key, factor)) {
+    Wipe(key);
+    return factor;
+  }
+  // derive outside the lock, so a miss does not block other threads using the same shard
+  factor.value = Derive(key);
+  factor.inverse = factor.value.invert();
+  insert(std::move(key), factor);
+  return factor;
+}
+
+void libpep::FactorCache::get(std::string_view type, std::string_view secret, std::span<const std::string_view> contexts, std::span<Factor> out) {
+  if (contexts.size() != out.size())
+    throw std::invalid_argument("FactorCache::get expected output of the same size as the contexts");
+  std::vector<size_t> missed;
+  std::vector<std::string> keys;
+  std::vector<Scalar> inverses;
+  for (size_t i = 0; i < contexts.size(); ++i) {
+    std::string key = MakeKey(type, secret, contexts[i]);
+    if (lookup(key, out[i])) {
+      Wipe(key);
+      continue;
+    }
+    out[i].value = Derive(key);
+    missed.push_back(i);
+    keys.push_back(std::move(key));
+    inverses.push_back(out[i].value);
+  }
+  // factors are never zero, so all of them have an inverse
+  ENSURE(Scalar::BatchInvert(inverses) == 0);
+  for (size_t j = 0; j < missed.size(); ++j) {
+    out[missed[j]].inverse = inverses[j];
+    insert(std::move(keys[j]), out[missed[j]]);
+  }
+}
+
+void libpep::FactorCache::clear() {
+  for (size_t i = 0; i < shardCount; ++i) {
+    Shard& shard = shards[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.index.clear();
+    for (auto& entry : shard.lru)
+      Wipe(entry.first);
+    shard.lru.clear();
+  }
+}
+
+FactorCache::Statistics libpep::FactorCache::statistics() const {
+  Statistics retval;
+  for (size_t i = 0; i < shardCount; ++i) {
+    const Shard& shard = shards[i];
+    retval.hits += shard.hits.load(std::memory_order_relaxed);
+    retval.misses += shard.misses.load(std::memory_order_relaxed);
+    retval.evictions += shard.evictions.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    retval.size += shard.lru.size();
+  }
+  return retval;
+}
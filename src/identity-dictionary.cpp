@@ -0,0 +1,234 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#include "identity-dictionary.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "mapped-file.h"
+#include "sodium.h"
+
+using namespace libpep;
+
+namespace {
+
+static_assert(std::endian::native == std::endian::little, "identity dictionaries are only supported on little endian hosts");
+static_assert(sizeof(IdentityDictionaryHeader) == 64);
+
+const char MAGIC[8] = {'L', 'I', 'B', 'P', 'E', 'P', 'D', '1'};
+const uint32_t VERSION = 1;
+// keyed hash, row id and point
+const size_t TAG_BYTES = 24;
+const size_t BUCKET_BYTES = TAG_BYTES + sizeof(uint64_t) + GroupElement::BYTES;
+const size_t MIN_BUCKETS = 16;
+
+using Tag = uint8_t[TAG_BYTES];
+
+void IdentityHash(Tag& out, const IdentityKey& key, std::string_view identity) {
+  crypto_generichash(out, sizeof(out), reinterpret_cast<const uint8_t*>(identity.data()), identity.size(), key, IDENTITY_KEYBYTES);
+}
+
+void KeyCheck(uint8_t (&out)[32], const IdentityKey& key) {
+  static const char label[] = "libpep identity dictionary";
+  crypto_generichash(out, sizeof(out), reinterpret_cast<const uint8_t*>(label), sizeof(label) - 1, key, IDENTITY_KEYBYTES);
+}
+
+// the tags and points are (pseudo) random, so their first bytes are used as the position in the table
+uint64_t Position(const uint8_t* bytes) {
+  uint64_t retval;
+  memcpy(&retval, bytes, sizeof(retval));
+  return retval;
+}
+
+size_t ReverseOffset(uint64_t buckets) {
+  return sizeof(IdentityDictionaryHeader) + buckets * BUCKET_BYTES;
+}
+
+size_t FileSize(uint64_t buckets) {
+  return ReverseOffset(buckets) + buckets * sizeof(uint64_t);
+}
+
+// checks the header against the size of the file and the key
+void Validate(const IdentityDictionaryHeader& header, size_t size, const IdentityKey& key, const std::string& path) {
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION)
+    throw std::runtime_error(path + " is not an identity dictionary (version " + std::to_string(VERSION) + ")");
+  if (!std::has_single_bit(header.buckets) || header.buckets > size / BUCKET_BYTES || FileSize(header.buckets) != size || header.entries >= header.buckets)
+    throw std::runtime_error(path + " is truncated");
+  uint8_t check[32];
+  KeyCheck(check, key);
+  if (sodium_memcmp(check, header.keyCheck, sizeof(check)) != 0)
+    throw std::runtime_error(path + " was built with another key");
+}
+
+const uint8_t* Bucket(const uint8_t* data, uint64_t i) {
+  return data + sizeof(IdentityDictionaryHeader) + i * BUCKET_BYTES;
+}
+
+}
+
+libpep::IdentityDictionary::IdentityDictionary(const std::string& path, const IdentityKey& _key) {
+  memcpy(key, _key, sizeof(key));
+  data = MapFile(path, sizeof(IdentityDictionaryHeader), length, FileAccess::Random, "an identity dictionary");
+  memcpy(&header, data, sizeof(header));
+  try {
+    Validate(header, length, key, path);
+  } catch (...) {
+    UnmapFile(data, length);
+    throw;
+  }
+}
+
+libpep::IdentityDictionary::~IdentityDictionary() {
+  UnmapFile(data, length);
+  sodium_memzero(key, sizeof(key));
+}
+
+std::optional<GroupElement> libpep::IdentityDictionary::find(std::string_view identity) const {
+  Tag tag;
+  IdentityHash(tag, key, identity);
+  uint64_t mask = header.buckets - 1;
+  // the builder keeps the table at most half full, but a corrupt file may have no empty bucket to stop at
+  uint64_t i = Position(tag) & mask;
+  for (uint64_t probes = 0; probes < header.buckets; ++probes, i = (i + 1) & mask) {
+    const uint8_t* bucket = Bucket(data, i);
+    if (sodium_is_zero(bucket, TAG_BYTES))
+      return std::nullopt;
+    if (memcmp(bucket, tag, TAG_BYTES) == 0) {
+      GroupElement retval;
+      memcpy(retval.value, bucket + TAG_BYTES + sizeof(uint64_t), GroupElement::BYTES);
+      return retval;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<uint64_t> libpep::IdentityDictionary::findRowId(const GroupElement& point) const {
+  const uint8_t* reverse = data + ReverseOffset(header.buckets);
+  uint64_t mask = header.buckets - 1;
+  uint64_t i = Position(point.value) & mask;
+  for (uint64_t probes = 0; probes < header.buckets; ++probes, i = (i + 1) & mask) {
+    uint64_t forward;
+    memcpy(&forward, reverse + i * sizeof(uint64_t), sizeof(forward));
+    if (forward == 0 || forward > header.buckets)
+      return std::nullopt;
+    const uint8_t* bucket = Bucket(data, forward - 1);
+    if (memcmp(bucket + TAG_BYTES + sizeof(uint64_t), point.value, GroupElement::BYTES) == 0) {
+      uint64_t rowId;
+      memcpy(&rowId, bucket + TAG_BYTES, sizeof(rowId));
+      return rowId;
+    }
+  }
+  return std::nullopt;
+}
+
+libpep::IdentityDictionaryBuilder::IdentityDictionaryBuilder(const std::string& _path, const IdentityKey& _key) : path(_path) {
+  memcpy(key, _key, sizeof(key));
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return; // new dictionary
+  std::vector<uint8_t> existing((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  if (file.bad())
+    throw std::runtime_error("could not read " + path);
+  IdentityDictionaryHeader header;
+  if (existing.size() < sizeof(header))
+    throw std::runtime_error(path + " is not an identity dictionary");
+  memcpy(&header, existing.data(), sizeof(header));
+  Validate(header, existing.size(), key, path);
+  entries.reserve(header.entries);
+  for (uint64_t i = 0; i < header.buckets; ++i) {
+    const uint8_t* bucket = Bucket(existing.data(), i);
+    if (sodium_is_zero(bucket, TAG_BYTES))
+      continue;
+    Entry entry;
+    memcpy(&entry.rowId, bucket + TAG_BYTES, sizeof(entry.rowId));
+    memcpy(entry.point.value, bucket + TAG_BYTES + sizeof(uint64_t), GroupElement::BYTES);
+    entries.emplace(std::string(reinterpret_cast<const char*>(bucket), TAG_BYTES), entry);
+  }
+}
+
+libpep::IdentityDictionaryBuilder::~IdentityDictionaryBuilder() {
+  sodium_memzero(key, sizeof(key));
+}
+
+void libpep::IdentityDictionaryBuilder::add(std::span<const std::string_view> identities, std::span<const uint64_t> rowIds, Executor& executor) {
+  if (identities.size() != rowIds.size())
+    throw std::invalid_argument("IdentityDictionaryBuilder::add expected the same number of identities and row ids");
+  // hashing is the expensive part, and is done in parallel; inserting is done afterwards, in input order
+  std::vector<std::string> tags(identities.size());
+  std::vector<GroupElement> points(identities.size());
+  const size_t CHUNK = 256;
+  executor.run((identities.size() + CHUNK - 1) / CHUNK, [&](size_t c) {
+    for (size_t i = c * CHUNK; i < std::min(identities.size(), (c + 1) * CHUNK); ++i) {
+      Tag tag;
+      IdentityHash(tag, key, identities[i]);
+      tags[i].assign(reinterpret_cast<const char*>(tag), sizeof(tag));
+      HashSHA512 hash;
+      SHA512(hash, identities[i]);
+      points[i] = GroupElement::FromHash(hash);
+    }
+  });
+  for (size_t i = 0; i < identities.size(); ++i)
+    entries.try_emplace(std::move(tags[i]), Entry{rowIds[i], points[i]});
+}
+
+void libpep::IdentityDictionaryBuilder::commit() {
+  IdentityDictionaryHeader header = {};
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.buckets = std::bit_ceil(std::max<uint64_t>(MIN_BUCKETS, 2 * entries.size()));
+  header.entries = entries.size();
+  KeyCheck(header.keyCheck, key);
+
+  std::vector<uint8_t> buffer(FileSize(header.buckets));
+  memcpy(buffer.data(), &header, sizeof(header));
+  uint8_t* reverse = buffer.data() + ReverseOffset(header.buckets);
+  uint64_t mask = header.buckets - 1;
+  for (const auto& [tag, entry] : entries) {
+    uint64_t i = Position(reinterpret_cast<const uint8_t*>(tag.data())) & mask;
+    while (!sodium_is_zero(Bucket(buffer.data(), i), TAG_BYTES))
+      i = (i + 1) & mask;
+    uint8_t* bucket = const_cast<uint8_t*>(Bucket(buffer.data(), i));
+    memcpy(bucket, tag.data(), TAG_BYTES);
+    memcpy(bucket + TAG_BYTES, &entry.rowId, sizeof(entry.rowId));
+    memcpy(bucket + TAG_BYTES + sizeof(uint64_t), entry.point.value, GroupElement::BYTES);
+    uint64_t j = Position(entry.point.value) & mask;
+    uint64_t forward;
+    for (;; j = (j + 1) & mask) {
+      memcpy(&forward, reverse + j * sizeof(uint64_t), sizeof(forward));
+      if (forward == 0)
+        break;
+    }
+    forward = i + 1;
+    memcpy(reverse + j * sizeof(uint64_t), &forward, sizeof(forward));
+  }
+
+  std::string temporary = path + ".tmp";
+  std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(buffer.data()), std::streamsize(buffer.size()));
+  file.close();
+  if (!file || std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    throw std::runtime_error("could not write " + path);
+  }
+}
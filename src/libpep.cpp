@@ -19,6 +19,10 @@ along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "libpep.h"
 
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
 using namespace libpep;
 
 std::tuple<GlobalPublicKey, GlobalSecretKey> libpep::GenerateGlobalKeys() {
@@ -28,47 +32,159 @@ std::tuple<GlobalPublicKey, GlobalSecretKey> libpep::GenerateGlobalKeys() {
 }
 
 GlobalEncryptedPseudonym libpep::GeneratePseudonym(const std::string& identity, const GlobalPublicKey& pk) {
+  ScopedTimer timer(Operation::GeneratePseudonym);
+  Count(Counter::PseudonymsGenerated);
   HashSHA512 hash;
   SHA512(hash, identity);
   auto p = GroupElement::FromHash(hash);
   return Encrypt(p, pk);
 }
 
-Scalar MakeFactor(const std::string_view& type, const std::string_view& secret, const std::string_view& context) {
-  HashSHA512 uhash;
-  SHA512(uhash, type, "|", secret, "|", context);
-  return Scalar::FromHash(uhash);
+GlobalEncryptedPseudonym libpep::GeneratePseudonym(const std::string& identity, const PreparedPublicKey& pk) {
+  ScopedTimer timer(Operation::GeneratePseudonym);
+  Count(Counter::PseudonymsGenerated);
+  HashSHA512 hash;
+  SHA512(hash, identity);
+  auto p = GroupElement::FromHash(hash);
+  return Encrypt(p, pk);
+}
+
+namespace {
+
+DecodedGroupElement HashToPoint(std::string_view identity) {
+  HashSHA512 hash;
+  SHA512(hash, identity);
+  return DecodedGroupElement::FromHash(hash);
+}
+
+// every chunk maps its identities to points with toPoint and encrypts them in one go, so the points stay decoded
+// (and in cache)
+template <typename F>
+void GeneratePseudonymsBatch(std::span<const std::string_view> identities, const PreparedPublicKey& pk, std::span<GlobalEncryptedPseudonym> out, Executor& executor, F&& toPoint) {
+  if (identities.size() != out.size())
+    throw std::invalid_argument("GeneratePseudonyms expected output of the same size as the identities");
+  ScopedTimer timer(Operation::GeneratePseudonyms);
+  Count(Counter::PseudonymsGenerated, identities.size());
+  const size_t CHUNK = 256;
+  executor.run((identities.size() + CHUNK - 1) / CHUNK, [&](size_t c) {
+    size_t begin = c * CHUNK;
+    size_t end = std::min(identities.size(), begin + CHUNK);
+    std::vector<DecodedGroupElement> points(end - begin);
+    for (size_t i = begin; i < end; ++i)
+      points[i - begin] = toPoint(identities[i]);
+    InlineExecutor inlineExecutor;
+    Encrypt(points, pk, out.subspan(begin, end - begin), inlineExecutor);
+  });
+}
+
+}
+
+void libpep::GeneratePseudonyms(std::span<const std::string_view> identities, const GlobalPublicKey& pk, std::span<GlobalEncryptedPseudonym> out, Executor& executor) {
+  GeneratePseudonyms(identities, PreparePublicKey(pk), out, executor);
+}
+
+void libpep::GeneratePseudonyms(std::span<const std::string_view> identities, const PreparedPublicKey& pk, std::span<GlobalEncryptedPseudonym> out, Executor& executor) {
+  GeneratePseudonymsBatch(identities, pk, out, executor, [](std::string_view identity) {
+    return HashToPoint(identity);
+  });
 }
 
-Scalar MakePseudonymisationFactor(const std::string_view& secret, const std::string_view& context) {
-  return MakeFactor("pseudonym", secret, context);
+void libpep::GeneratePseudonyms(std::span<const std::string_view> identities, const IdentityDictionary& dictionary, const PreparedPublicKey& pk, std::span<GlobalEncryptedPseudonym> out, Executor& executor) {
+  GeneratePseudonymsBatch(identities, pk, out, executor, [&dictionary](std::string_view identity) {
+    auto point = dictionary.find(identity);
+    return point ? DecodedGroupElement(*point) : HashToPoint(identity);
+  });
 }
 
-Scalar MakeDecryptionFactor(const std::string_view& secret, const std::string_view& context) {
-  return MakeFactor("decryption", secret, context);
+FactorCache& libpep::DefaultFactorCache() {
+  static FactorCache cache;
+  return cache;
+}
+
+// factors are SHA512(type | secret | context), cached together with their inverse
+Factor MakePseudonymisationFactor(const std::string_view& secret, const std::string_view& context) {
+  return DefaultFactorCache().get("pseudonym", secret, context);
+}
+
+Factor MakeDecryptionFactor(const std::string_view& secret, const std::string_view& context) {
+  return DefaultFactorCache().get("decryption", secret, context);
 }
 
 LocalEncryptedPseudonym libpep::ConvertToLocalPseudonym(const GlobalEncryptedPseudonym& p, const std::string_view& secret, const std::string_view& decryptionContext, const std::string_view& pseudonimisationContext) {
-  Scalar u = MakePseudonymisationFactor(secret, pseudonimisationContext);
-  Scalar t = MakeDecryptionFactor(secret, decryptionContext);
-  return RKS(p, t, u);
+  ScopedTimer timer(Operation::ConvertPseudonym);
+  Count(Counter::PseudonymsConverted);
+  auto u = MakePseudonymisationFactor(secret, pseudonimisationContext);
+  auto t = MakeDecryptionFactor(secret, decryptionContext);
+  return RKS(p, t.value, u.value);
+}
+
+LocalEncryptedPseudonym libpep::ConvertToRerandomizedLocalPseudonym(const GlobalEncryptedPseudonym& p, const std::string_view& secret, const std::string_view& decryptionContext, const std::string_view& pseudonimisationContext) {
+  ScopedTimer timer(Operation::ConvertPseudonym);
+  Count(Counter::PseudonymsConverted);
+  auto u = MakePseudonymisationFactor(secret, pseudonimisationContext);
+  auto t = MakeDecryptionFactor(secret, decryptionContext);
+  return RKSR(p, t.value, u.value, Scalar::Random());
 }
 
 GlobalEncryptedPseudonym libpep::ConvertFromLocalPseudonym(const LocalEncryptedPseudonym& p, const std::string_view& secret, const std::string_view& decryptionContext, const std::string_view& pseudonimisationContext) {
-  Scalar u = MakePseudonymisationFactor(secret, pseudonimisationContext);
-  Scalar t = MakeDecryptionFactor(secret, decryptionContext);
-  return RKS(p, t.invert(), u.invert());
+  ScopedTimer timer(Operation::ConvertPseudonym);
+  Count(Counter::PseudonymsConverted);
+  auto u = MakePseudonymisationFactor(secret, pseudonimisationContext);
+  auto t = MakeDecryptionFactor(secret, decryptionContext);
+  return RKS(p, t.inverse, u.inverse);
+}
+
+void libpep::ConvertToLocalPseudonyms(std::span<const GlobalEncryptedPseudonym> p, const std::string_view& secret, const std::string_view& decryptionContext, const std::string_view& pseudonimisationContext, std::span<LocalEncryptedPseudonym> out, Executor& executor) {
+  ScopedTimer timer(Operation::ConvertPseudonyms);
+  Count(Counter::PseudonymsConverted, p.size());
+  auto u = MakePseudonymisationFactor(secret, pseudonimisationContext);
+  auto t = MakeDecryptionFactor(secret, decryptionContext);
+  RKS(p, t.value, u.value, out, executor);
+}
+
+void libpep::ConvertToRerandomizedLocalPseudonyms(std::span<const GlobalEncryptedPseudonym> p, const std::string_view& secret, const std::string_view& decryptionContext, const std::string_view& pseudonimisationContext, std::span<LocalEncryptedPseudonym> out, Executor& executor) {
+  ScopedTimer timer(Operation::ConvertPseudonyms);
+  Count(Counter::PseudonymsConverted, p.size());
+  auto u = MakePseudonymisationFactor(secret, pseudonimisationContext);
+  auto t = MakeDecryptionFactor(secret, decryptionContext);
+  RKSR(p, t.value, u.value, out, executor);
+}
+
+void libpep::ConvertFromLocalPseudonyms(std::span<const LocalEncryptedPseudonym> p, const std::string_view& secret, const std::string_view& decryptionContext, const std::string_view& pseudonimisationContext, std::span<GlobalEncryptedPseudonym> out, Executor& executor) {
+  ScopedTimer timer(Operation::ConvertPseudonyms);
+  Count(Counter::PseudonymsConverted, p.size());
+  auto u = MakePseudonymisationFactor(secret, pseudonimisationContext);
+  auto t = MakeDecryptionFactor(secret, decryptionContext);
+  RKS(p, t.inverse, u.inverse, out, executor);
+}
+
+void libpep::PrepareFactors(const std::string_view& secret, std::span<const std::string_view> decryptionContexts, std::span<const std::string_view> pseudonimisationContexts) {
+  std::vector<Factor> factors(std::max(decryptionContexts.size(), pseudonimisationContexts.size()));
+  DefaultFactorCache().get("decryption", secret, decryptionContexts, std::span(factors).first(decryptionContexts.size()));
+  DefaultFactorCache().get("pseudonym", secret, pseudonimisationContexts, std::span(factors).first(pseudonimisationContexts.size()));
 }
 
 LocalDecryptionKey libpep::MakeLocalDecryptionKey(const GlobalSecretKey& k, const std::string_view& secret, const std::string_view& decryptionContext) {
-  Scalar t = MakeDecryptionFactor(secret, decryptionContext);
-  return t * k;
+  return MakeDecryptionFactor(secret, decryptionContext).value * k;
+}
+
+void libpep::MakeLocalDecryptionKeys(const GlobalSecretKey& k, const std::string_view& secret, std::span<const std::string_view> decryptionContexts, std::span<LocalDecryptionKey> out) {
+  if (decryptionContexts.size() != out.size())
+    throw std::invalid_argument("MakeLocalDecryptionKeys expected output of the same size as the contexts");
+  std::vector<Factor> factors(decryptionContexts.size());
+  DefaultFactorCache().get("decryption", secret, decryptionContexts, factors);
+  for (size_t i = 0; i < factors.size(); ++i)
+    out[i] = factors[i].value * k;
 }
 
 LocalPseudonym libpep::DecryptLocalPseudonym(const LocalEncryptedPseudonym& p, const LocalDecryptionKey& k) {
   return Decrypt(p, k);
 }
 
+void libpep::DecryptLocalPseudonyms(std::span<const LocalEncryptedPseudonym> p, const LocalDecryptionKey& k, std::span<LocalPseudonym> out, Executor& executor) {
+  Decrypt(p, k, out, executor);
+}
+
 GlobalEncryptedPseudonym libpep::RerandomizeGlobal(const GlobalEncryptedPseudonym& p) {
   return Rerandomize(p, Scalar::Random());
 }
@@ -0,0 +1,105 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#pragma once
+
+// Read only view of a whole file, for columnar-file.cpp and identity-dictionary.cpp: mapped in memory with mmap on
+// POSIX systems, and read in memory on Windows (which has no mmap). Private to the library, so everything is in an
+// anonymous namespace.
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// expected access pattern, passed on to the kernel as a hint
+enum class FileAccess { Sequential, Random };
+
+// returns the contents of path and sets length to its size; throws std::runtime_error if path can not be opened or
+// is smaller than minimum ("[path] is not [kind]")
+inline const uint8_t* MapFile(const std::string& path, size_t minimum, size_t& length, FileAccess access, const char* kind) {
+#if defined(_WIN32)
+  (void)access;
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file)
+    throw std::runtime_error("could not open " + path);
+  length = size_t(file.tellg());
+  if (length < minimum)
+    throw std::runtime_error(path + " is not " + kind);
+  auto* retval = new uint8_t[length];
+  file.seekg(0);
+  if (!file.read(reinterpret_cast<char*>(retval), std::streamsize(length))) {
+    delete[] retval;
+    throw std::runtime_error("could not read " + path);
+  }
+  return retval;
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("could not open " + path);
+  struct stat info;
+  if (fstat(fd, &info) != 0 || size_t(info.st_size) < minimum) {
+    ::close(fd);
+    throw std::runtime_error(path + " is not " + kind);
+  }
+  length = size_t(info.st_size);
+  void* mapped = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED)
+    throw std::runtime_error("could not map " + path);
+  madvise(mapped, length, access == FileAccess::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+  return static_cast<const uint8_t*>(mapped);
+#endif
+}
+
+inline void UnmapFile(const uint8_t* data, size_t length) {
+#if defined(_WIN32)
+  (void)length;
+  delete[] data;
+#else
+  munmap(const_cast<uint8_t*>(data), length);
+#endif
+}
+
+// hint that bytes [begin, end) of a file from MapFile are read soon
+inline void PrefetchFile(const uint8_t* data, size_t begin, size_t end) {
+#if defined(_WIN32)
+  (void)data;
+  (void)begin;
+  (void)end;
+#else
+  // madvise expects a page aligned address
+  size_t page = size_t(sysconf(_SC_PAGESIZE));
+  size_t aligned = begin / page * page;
+  madvise(const_cast<uint8_t*>(data) + aligned, end - aligned, MADV_WILLNEED);
+#endif
+}
+
+}
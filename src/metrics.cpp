@@ -0,0 +1,364 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#include "metrics.h"
+
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+using namespace libpep;
+
+namespace {
+
+const char* const COUNTER_NAMES[] = {
+  "scalar_multiplications",
+  "fixed_base_multiplications",
+  "multi_scalar_multiplications",
+  "multi_scalar_multiplication_terms",
+  "inversions",
+  "decodings",
+  "encodings",
+  "encryptions",
+  "decryptions",
+  "rerandomizations",
+  "rekeys",
+  "reshuffles",
+  "rks",
+  "rksr",
+  "proofs_created",
+  "proofs_verified",
+  "proof_verification_failures",
+  "aggregate_proofs_created",
+  "aggregate_proofs_verified",
+  "aggregate_proof_verification_failures",
+  "pseudonyms_generated",
+  "pseudonyms_converted",
+  "randomizer_pool_pairs_produced",
+  "randomizer_pool_pairs_taken",
+  "randomizer_pool_fallbacks",
+};
+static_assert(std::size(COUNTER_NAMES) == size_t(Counter::COUNT));
+
+const char* const OPERATION_NAMES[] = {
+  "encrypt",
+  "decrypt",
+  "rerandomize",
+  "rekey",
+  "reshuffle",
+  "rks",
+  "rksr",
+  "encrypt_batch",
+  "decrypt_batch",
+  "rerandomize_batch",
+  "rekey_batch",
+  "reshuffle_batch",
+  "rks_batch",
+  "rksr_batch",
+  "create_proof",
+  "verify_proof",
+  "verify_proof_batch",
+  "create_aggregate_proof",
+  "verify_aggregate_proof",
+  "generate_pseudonym",
+  "generate_pseudonyms",
+  "convert_pseudonym",
+  "convert_pseudonyms",
+};
+static_assert(std::size(OPERATION_NAMES) == size_t(Operation::COUNT));
+
+#if !defined(LIBPEP_NO_METRICS)
+
+// Metrics of one thread. Only the owning thread writes (a relaxed load and store, no atomic read-modify-write),
+// snapshots read concurrently.
+struct ThreadMetrics {
+  struct AtomicHistogram {
+    std::atomic<uint64_t> buckets[Histogram::BUCKETS] = {};
+    std::atomic<uint64_t> count = 0;
+    std::atomic<uint64_t> sum = 0;
+  };
+  std::atomic<uint64_t> counters[size_t(Counter::COUNT)] = {};
+  AtomicHistogram latencies[size_t(Operation::COUNT)];
+};
+
+void Add(std::atomic<uint64_t>& x, uint64_t n) {
+  x.store(x.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void AddTo(MetricsSnapshot& out, const ThreadMetrics& in) {
+  for (size_t i = 0; i < size_t(Counter::COUNT); ++i)
+    out.counters[i] += in.counters[i].load(std::memory_order_relaxed);
+  for (size_t i = 0; i < size_t(Operation::COUNT); ++i) {
+    for (size_t b = 0; b < Histogram::BUCKETS; ++b)
+      out.latencies[i].buckets[b] += in.latencies[i].buckets[b].load(std::memory_order_relaxed);
+    out.latencies[i].count += in.latencies[i].count.load(std::memory_order_relaxed);
+    out.latencies[i].sum += in.latencies[i].sum.load(std::memory_order_relaxed);
+  }
+}
+
+// metrics of the live threads, and the sum of the threads that have ended; never destroyed, as threads may end
+// after static destructors have run
+struct Registry {
+  std::mutex mutex;
+  std::vector<ThreadMetrics*> threads;
+  MetricsSnapshot ended;
+  // subtracted from the snapshots, as threads can not be reset from another thread
+  MetricsSnapshot offset;
+  std::map<uint64_t, std::function<RandomizerPoolGauges()>> pools;
+  uint64_t nextPool = 1;
+};
+
+Registry& GetRegistry() {
+  static Registry* registry = new Registry();
+  return *registry;
+}
+
+struct ThreadMetricsOwner {
+  ThreadMetrics* metrics;
+  ThreadMetricsOwner() : metrics(new ThreadMetrics()) {
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.threads.push_back(metrics);
+  }
+  ~ThreadMetricsOwner() {
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    AddTo(registry.ended, *metrics);
+    std::erase(registry.threads, metrics);
+    delete metrics;
+  }
+};
+
+ThreadMetrics& Local() {
+  thread_local ThreadMetricsOwner owner;
+  return *owner.metrics;
+}
+
+#endif
+
+}
+
+const char* libpep::Name(Counter counter) {
+  return COUNTER_NAMES[size_t(counter)];
+}
+
+const char* libpep::Name(Operation operation) {
+  return OPERATION_NAMES[size_t(operation)];
+}
+
+size_t libpep::Histogram::BucketOf(uint64_t nanoseconds) {
+  if (nanoseconds < SUB_BUCKETS)
+    return size_t(nanoseconds);
+  size_t exponent = size_t(std::bit_width(nanoseconds)) - 1;
+  if (exponent > MAX_EXPONENT)
+    return BUCKETS - 1;
+  size_t mantissa = size_t(nanoseconds >> (exponent - 3)) & (SUB_BUCKETS - 1);
+  return (exponent - 2) * SUB_BUCKETS + mantissa;
+}
+
+uint64_t libpep::Histogram::UpperBound(size_t bucket) {
+  if (bucket < SUB_BUCKETS)
+    return bucket;
+  size_t exponent = bucket / SUB_BUCKETS + 2;
+  uint64_t mantissa = bucket % SUB_BUCKETS;
+  return ((SUB_BUCKETS + mantissa + 1) << (exponent - 3)) - 1;
+}
+
+uint64_t libpep::Histogram::quantile(double q) const {
+  if (count == 0)
+    return 0;
+  auto rank = uint64_t(q * double(count - 1)) + 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < BUCKETS; ++i) {
+    seen += buckets[i];
+    if (seen >= rank)
+      return UpperBound(i);
+  }
+  return UpperBound(BUCKETS - 1);
+}
+
+#if !defined(LIBPEP_NO_METRICS)
+
+void libpep::Count(Counter counter, uint64_t n) {
+  Add(Local().counters[size_t(counter)], n);
+}
+
+libpep::ScopedTimer::~ScopedTimer() {
+  auto nanoseconds = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+  auto& histogram = Local().latencies[size_t(operation)];
+  Add(histogram.buckets[Histogram::BucketOf(nanoseconds)], 1);
+  Add(histogram.count, 1);
+  Add(histogram.sum, nanoseconds);
+}
+
+#endif
+
+MetricsSnapshot libpep::Metrics() {
+  MetricsSnapshot retval;
+#if !defined(LIBPEP_NO_METRICS)
+  auto& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  retval = registry.ended;
+  for (const ThreadMetrics* metrics : registry.threads)
+    AddTo(retval, *metrics);
+  for (size_t i = 0; i < size_t(Counter::COUNT); ++i)
+    retval.counters[i] -= registry.offset.counters[i];
+  for (size_t i = 0; i < size_t(Operation::COUNT); ++i) {
+    for (size_t b = 0; b < Histogram::BUCKETS; ++b)
+      retval.latencies[i].buckets[b] -= registry.offset.latencies[i].buckets[b];
+    retval.latencies[i].count -= registry.offset.latencies[i].count;
+    retval.latencies[i].sum -= registry.offset.latencies[i].sum;
+  }
+  for (const auto& [id, gauges] : registry.pools) {
+    retval.randomizerPools.push_back(gauges());
+    retval.randomizerPools.back().id = id;
+  }
+#endif
+  return retval;
+}
+
+void libpep::ResetMetrics() {
+#if !defined(LIBPEP_NO_METRICS)
+  auto& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.offset = registry.ended;
+  for (const ThreadMetrics* metrics : registry.threads)
+    AddTo(registry.offset, *metrics);
+#endif
+}
+
+uint64_t libpep::RegisterRandomizerPool(std::function<RandomizerPoolGauges()> gauges) {
+#if !defined(LIBPEP_NO_METRICS)
+  auto& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  uint64_t id = registry.nextPool++;
+  registry.pools.emplace(id, std::move(gauges));
+  return id;
+#else
+  (void)gauges;
+  return 0;
+#endif
+}
+
+void libpep::UnregisterRandomizerPool(uint64_t id) {
+#if !defined(LIBPEP_NO_METRICS)
+  auto& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.pools.erase(id);
+#else
+  (void)id;
+#endif
+}
+
+std::string libpep::ToPrometheus(const MetricsSnapshot& snapshot) {
+  std::ostringstream out;
+  for (size_t i = 0; i < size_t(Counter::COUNT); ++i) {
+    std::string name = std::string("libpep_") + COUNTER_NAMES[i] + "_total";
+    out << "# TYPE " << name << " counter\n" << name << " " << snapshot.counters[i] << "\n";
+  }
+  // the buckets of a power of two end at 2^(e+1) - 1 ns, so these are exact boundaries of the histogram
+  const size_t FIRST_EXPONENT = 9; // le = 1.024 µs
+  const size_t LAST_EXPONENT = 33; // le = 17.2 s
+  out << "# HELP libpep_operation_duration_seconds Latency of libpep operations\n";
+  out << "# TYPE libpep_operation_duration_seconds histogram\n";
+  for (size_t i = 0; i < size_t(Operation::COUNT); ++i) {
+    const Histogram& histogram = snapshot.latencies[i];
+    std::string labels = std::string("operation=\"") + OPERATION_NAMES[i] + "\"";
+    uint64_t cumulative = 0;
+    size_t bucket = 0;
+    for (size_t exponent = FIRST_EXPONENT; exponent <= LAST_EXPONENT; ++exponent) {
+      uint64_t upper = (uint64_t(2) << exponent) - 1;
+      for (; bucket < Histogram::BUCKETS && Histogram::UpperBound(bucket) <= upper; ++bucket)
+        cumulative += histogram.buckets[bucket];
+      out << "libpep_operation_duration_seconds_bucket{" << labels << ",le=\"" << double(upper + 1) * 1e-9 << "\"} " << cumulative << "\n";
+    }
+    out << "libpep_operation_duration_seconds_bucket{" << labels << ",le=\"+Inf\"} " << histogram.count << "\n";
+    out << "libpep_operation_duration_seconds_sum{" << labels << "} " << double(histogram.sum) * 1e-9 << "\n";
+    out << "libpep_operation_duration_seconds_count{" << labels << "} " << histogram.count << "\n";
+  }
+  out << "# HELP libpep_randomizer_pool_depth Pairs ready for use in a RandomizerPool\n";
+  out << "# TYPE libpep_randomizer_pool_depth gauge\n";
+  for (const auto& pool : snapshot.randomizerPools)
+    out << "libpep_randomizer_pool_depth{pool=\"" << pool.id << "\"} " << pool.depth << "\n";
+  out << "# TYPE libpep_randomizer_pool_capacity gauge\n";
+  for (const auto& pool : snapshot.randomizerPools)
+    out << "libpep_randomizer_pool_capacity{pool=\"" << pool.id << "\"} " << pool.capacity << "\n";
+  return out.str();
+}
+
+void libpep::WriteMetrics(const std::string& path, const MetricsSnapshot& snapshot) {
+  std::string temporary = path + ".tmp";
+  {
+    std::ofstream out(temporary, std::ios::trunc);
+    out << ToPrometheus(snapshot);
+    out.close();
+    if (!out)
+      throw std::runtime_error("could not write " + temporary);
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    throw std::runtime_error("could not write " + path);
+  }
+}
+
+void libpep::WriteMetrics(const std::string& path) {
+  WriteMetrics(path, Metrics());
+}
+
+struct libpep::MetricsExporter::State {
+  std::mutex mutex;
+  std::condition_variable stopped;
+  bool stopping = false;
+};
+
+libpep::MetricsExporter::MetricsExporter(std::chrono::milliseconds interval, std::function<void(const MetricsSnapshot&)> callback) : state(std::make_shared<State>()) {
+  thread = std::thread([state = state, interval, callback = std::move(callback)] {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (!state->stopped.wait_for(lock, interval, [&] { return state->stopping; })) {
+      lock.unlock();
+      callback(Metrics());
+      lock.lock();
+    }
+  });
+}
+
+libpep::MetricsExporter::MetricsExporter(std::chrono::milliseconds interval, const std::string& path) : MetricsExporter(interval, [path](const MetricsSnapshot& snapshot) {
+  try {
+    WriteMetrics(path, snapshot);
+  } catch (const std::exception&) {
+    // the next interval tries again
+  }
+}) {
+}
+
+libpep::MetricsExporter::~MetricsExporter() {
+  {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->stopping = true;
+  }
+  state->stopped.notify_all();
+  thread.join();
+}
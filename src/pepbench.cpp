@@ -0,0 +1,638 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#include "libpep.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <vector>
+
+using namespace libpep;
+
+// Microbenchmarks of the public functions of base.h, ristretto.h, curve-backend.h, core.h, zkp.h and libpep.h. Every
+// benchmark is run for a number of samples, each sample repeating the function until it takes at least the minimum
+// sample time; reported are the median time per operation and the median absolute deviation of the samples (both
+// robust against outliers, e.g. from other processes). Batch functions are run on the default executor, and report
+// the time per element.
+
+namespace {
+
+const size_t N = 256; // elements of batch benchmarks
+
+struct Options {
+  std::string filter;
+  std::string json;
+  std::string baseline;
+  double threshold = 10; // percentage a benchmark may be slower than the baseline
+  double minTime = 0.01; // seconds per sample
+  size_t samples = 15;
+  bool list = false;
+};
+
+struct Benchmark {
+  std::string name;
+  size_t items; // operations per call of the function
+  std::function<double(size_t)> run; // returns the seconds taken by the given number of calls
+};
+
+struct Result {
+  std::string name;
+  double nsPerOp;
+  double deviation; // median absolute deviation, as percentage of nsPerOp
+  size_t samples;
+  size_t iterations;
+};
+
+// keeps the compiler from optimising away the computation of value
+template <typename T>
+void DoNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "g"(&value) : "memory");
+#else
+  static const volatile void* sink;
+  sink = &value;
+#endif
+}
+
+std::vector<Benchmark>& Benchmarks() {
+  static std::vector<Benchmark> benchmarks;
+  return benchmarks;
+}
+
+// f is copied into the benchmark, so it can own its input; the loop is instantiated for every f, so the call is inlined
+template <typename F>
+void Add(std::string name, F f, size_t items = 1) {
+  Benchmark benchmark{std::move(name), items, [f = std::move(f)](size_t iterations) mutable {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+      if constexpr (std::is_void_v<decltype(f())>) {
+        f();
+      } else {
+        auto retval = f();
+        DoNotOptimize(retval);
+      }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }};
+  Benchmarks().push_back(std::move(benchmark));
+}
+
+template <typename T, typename F>
+std::vector<T> Generate(size_t size, F&& f) {
+  std::vector<T> retval;
+  retval.reserve(size);
+  for (size_t i = 0; i < size; ++i)
+    retval.push_back(f());
+  return retval;
+}
+
+void RegisterBase() {
+  auto a = Scalar::Random();
+  auto b = Scalar::Random();
+  auto P = GroupElement::Random();
+  auto Q = GroupElement::Random();
+  HashSHA512 hash;
+  RandomBytes(hash);
+  auto scalars = Generate<Scalar>(N, Scalar::Random);
+  auto scalarHex = Generate<std::string>(N, [] { return Scalar::Random().hex(); });
+  auto pointHex = Generate<std::string>(N, [] { return GroupElement::Random().hex(); });
+  std::vector<std::string_view> scalarViews(scalarHex.begin(), scalarHex.end());
+  std::vector<std::string_view> pointViews(pointHex.begin(), pointHex.end());
+
+  Add("base/Scalar::Random", [] { return Scalar::Random(); });
+  Add("base/Scalar::RandomBatch n=256", [out = std::vector<Scalar>(N)]() mutable { Scalar::RandomBatch(out); }, N);
+  Add("base/Scalar::FromHash", [hash]() mutable { return Scalar::FromHash(hash); });
+  Add("base/Scalar::invert", [a] { return a.invert(); });
+  Add("base/Scalar::complement", [a] { return a.complement(); });
+  Add("base/Scalar::operator- (negate)", [a] { return -a; });
+  Add("base/Scalar::is_zero", [a] { return a.is_zero(); });
+  Add("base/Scalar::is_valid", [a] { return a.is_valid(); });
+  Add("base/Scalar::hex", [a] { return a.hex(); });
+  Add("base/Scalar::FromHex", [hex = a.hex()] { return Scalar::FromHex(hex); });
+  Add("base/Scalar::FromHexBatch n=256", [scalarHex, views = scalarViews, out = std::vector<Scalar>(N)]() mutable {
+    return Scalar::FromHexBatch(views, out);
+  }, N);
+  Add("base/Scalar::BatchInvert n=256", [scalars, values = scalars]() mutable {
+    values = scalars;
+    return Scalar::BatchInvert(values);
+  }, N);
+  Add("base/Scalar + Scalar", [a, b] { return a + b; });
+  Add("base/Scalar - Scalar", [a, b] { return a - b; });
+  Add("base/Scalar * Scalar", [a, b] { return a * b; });
+  Add("base/Scalar / Scalar", [a, b] { return a / b; });
+  Add("base/Scalar == Scalar", [a, b] { return a == b; });
+  Add("base/Scalar::mult_base", [a] { return a.mult_base(); });
+  Add("base/Scalar * G", [a] { return a * G; });
+
+  Add("base/GroupElement::Random", [] { return GroupElement::Random(); });
+  Add("base/GroupElement::FromHash", [hash]() mutable { return GroupElement::FromHash(hash); });
+  Add("base/GroupElement::is_zero", [P] { return P.is_zero(); });
+  Add("base/GroupElement::is_valid", [P] { return P.is_valid(); });
+  Add("base/GroupElement::hex", [P] { return P.hex(); });
+  Add("base/GroupElement::FromHex", [hex = P.hex()] { return GroupElement::FromHex(hex); });
+  Add("base/GroupElement::FromHexBatch n=256", [pointHex, views = pointViews, out = std::vector<GroupElement>(N)]() mutable {
+    return GroupElement::FromHexBatch(views, out);
+  }, N);
+  Add("base/GroupElement + GroupElement", [P, Q] { return P + Q; });
+  Add("base/GroupElement - GroupElement", [P, Q] { return P - Q; });
+  Add("base/Scalar * GroupElement", [a, P] { return a * P; });
+  Add("base/GroupElement / Scalar", [a, P] { return P / a; });
+  Add("base/GroupElement == GroupElement", [P, Q] { return P == Q; });
+
+  Add("base/SHA512 64 bytes", [hash] {
+    HashSHA512 out;
+    SHA512(out, std::string_view(reinterpret_cast<const char*>(hash), sizeof(hash)));
+    return out[0];
+  });
+  Add("base/RandomBytes 32 bytes", [] {
+    uint8_t out[32];
+    RandomBytes(out);
+    return out[0];
+  });
+  KDFSeedKey seed;
+  KDFGenerateSeedKey(seed);
+  Add("base/KDFGenerateSeedKey", [] {
+    KDFSeedKey out;
+    KDFGenerateSeedKey(out);
+    return out[0];
+  });
+  Add("base/KDF 32 bytes", [seed = std::vector<uint8_t>(seed, seed + sizeof(seed))] {
+    KDFSeedKey key;
+    std::copy(seed.begin(), seed.end(), key);
+    KDFContext context = "pepbench";
+    uint8_t out[32];
+    KDF(out, sizeof(out), 1, context, key);
+    return out[0];
+  });
+  Add("base/ToHex 32 bytes", [P] { return ToHex(P.raw()); });
+  Add("base/FromHex 32 bytes", [hex = P.hex()] {
+    uint8_t out[32];
+    FromHex(out, hex);
+    return out[0];
+  });
+  Add("base/TryFromHex 32 bytes", [hex = P.hex()] {
+    uint8_t out[32];
+    return TryFromHex(out, sizeof(out), hex);
+  });
+}
+
+void RegisterRistretto() {
+  auto a = Scalar::Random();
+  auto b = Scalar::Random();
+  auto P = DecodedGroupElement::Random();
+  auto Q = DecodedGroupElement::Random();
+  auto encoded = P.encode();
+
+  Add("ristretto/DecodedGroupElement(GroupElement)", [encoded] { return DecodedGroupElement(encoded); });
+  Add("ristretto/DecodedGroupElement::encode", [P] { return P.encode(); });
+  Add("ristretto/DecodedGroupElement + DecodedGroupElement", [P, Q] { return P + Q; });
+  Add("ristretto/DecodedGroupElement::MultBase", [a] { return DecodedGroupElement::MultBase(a); });
+  Add("ristretto/DecodedGroupElement::MultBaseVartime", [a] { return DecodedGroupElement::MultBaseVartime(a); });
+  Add("ristretto/Scalar * DecodedGroupElement", [a, P] { return a * P; });
+  Add("ristretto/ScalarMulVartime", [a, P] { return ScalarMulVartime(a, P); });
+  Add("ristretto/DoubleScalarMul", [a, P, b, Q] { return DoubleScalarMul(a, P, b, Q); });
+  Add("ristretto/DoubleScalarMulVartime", [a, P, b, Q] { return DoubleScalarMulVartime(a, P, b, Q); });
+  Add("ristretto/DoubleScalarMulVartime with G", [a, b, Q] { return DoubleScalarMulVartime(a, G, b, Q); });
+  Add("ristretto/DecodedGroupElement == DecodedGroupElement", [P, Q] { return P == Q; });
+}
+
+// the scalar multiplications with every supported curve backend, to compare them (see curve-backend.h); the other
+// benchmarks use the backend given with --backend, or the default one
+void RegisterCurveBackends() {
+  auto a = Scalar::Random();
+  auto b = Scalar::Random();
+  auto P = DecodedGroupElement::Random();
+  auto Q = DecodedGroupElement::Random();
+  auto encoded = P.encode();
+
+  for (auto backend : SupportedCurveBackends()) {
+    auto with = [backend](auto f) {
+      return [backend, f] {
+        auto previous = ActiveCurveBackend();
+        SetCurveBackend(backend);
+        auto retval = f();
+        SetCurveBackend(previous);
+        return retval;
+      };
+    };
+    std::string prefix = std::string("backend/") + Name(backend) + "/";
+    Add(prefix + "Scalar * GroupElement", with([a, encoded] { return a * encoded; }));
+    Add(prefix + "Scalar * DecodedGroupElement", with([a, P] { return a * P; }));
+    Add(prefix + "ScalarMulVartime", with([a, P] { return ScalarMulVartime(a, P); }));
+    Add(prefix + "DoubleScalarMul", with([a, P, b, Q] { return DoubleScalarMul(a, P, b, Q); }));
+    Add(prefix + "DoubleScalarMulVartime", with([a, P, b, Q] { return DoubleScalarMulVartime(a, P, b, Q); }));
+    Add(prefix + "DoubleScalarMulVartime with G", with([a, b, Q] { return DoubleScalarMulVartime(a, G, b, Q); }));
+  }
+}
+
+void RegisterCore() {
+  auto y = Scalar::Random();
+  auto Y = y * G;
+  auto prepared = PreparePublicKey(Y);
+  auto k = Scalar::Random();
+  auto n = Scalar::Random();
+  auto s = Scalar::Random();
+  auto M = GroupElement::Random();
+  auto in = Encrypt(M, Y);
+  DecodedElGamal decoded(in);
+  DecodedGroupElement dM(M);
+  DecodedGroupElement dY(Y);
+  auto messages = Generate<GroupElement>(N, GroupElement::Random);
+  auto decodedMessages = Generate<DecodedGroupElement>(N, DecodedGroupElement::Random);
+  auto tuples = Generate<ElGamal>(N, [&] { return Encrypt(GroupElement::Random(), Y); });
+  auto tupleHex = Generate<std::string>(N, [&] { return Encrypt(GroupElement::Random(), Y).hex(); });
+  std::vector<std::string_view> tupleViews(tupleHex.begin(), tupleHex.end());
+  std::vector<uint8_t> record(ElGamal::BYTES);
+  in.bytes(std::span<uint8_t, ElGamal::BYTES>(record));
+  std::vector<uint8_t> compact(ElGamal::COMPACT_BYTES);
+  in.compact(std::span<uint8_t, ElGamal::COMPACT_BYTES>(compact));
+  std::vector<uint8_t> records(N * ElGamal::BYTES);
+  for (size_t i = 0; i < N; ++i)
+    tuples[i].bytes(std::span(records).subspan(i * ElGamal::BYTES).first<ElGamal::BYTES>());
+  auto halves = Generate<DecodedElGamal>(N, [&] { return DecodedElGamal(Encrypt(GroupElement::Random(), Y)); });
+
+  Add("core/ElGamal::hex", [in] { return in.hex(); });
+  Add("core/ElGamal::FromHex", [hex = in.hex()] { return ElGamal::FromHex(hex); });
+  Add("core/ElGamal::FromHexBatch n=256", [tupleHex, views = tupleViews, out = std::vector<ElGamal>(N)]() mutable {
+    return ElGamal::FromHexBatch(views, out);
+  }, N);
+  Add("core/ElGamal::bytes", [in, out = record]() mutable { in.bytes(std::span<uint8_t, ElGamal::BYTES>(out)); });
+  Add("core/ElGamal::FromBytes", [record] { return ElGamal::FromBytes(std::span<const uint8_t, ElGamal::BYTES>(record)); });
+  Add("core/ElGamal::compact", [in, out = compact]() mutable { in.compact(std::span<uint8_t, ElGamal::COMPACT_BYTES>(out)); });
+  Add("core/ElGamal::FromCompact", [compact, Y] { return ElGamal::FromCompact(std::span<const uint8_t, ElGamal::COMPACT_BYTES>(compact), Y); });
+  Add("core/ElGamal == ElGamal", [in, other = tuples[0]] { return in == other; });
+  Add("core/ElGamalView::get", [record]() mutable { return ElGamalView(std::span<uint8_t, ElGamal::BYTES>(record)).get(); });
+  Add("core/DecodedElGamal(ElGamal)", [in] { return DecodedElGamal(in); });
+  Add("core/DecodedElGamal::encode", [decoded] { return decoded.encode(); });
+  Add("core/PreparePublicKey (cached)", [Y] { return PreparePublicKey(Y); });
+  Add("core/PreparedPublicKey (not cached)", [Y] { return PreparedPublicKey(Y); });
+
+  Add("core/Encrypt", [M, Y] { return Encrypt(M, Y); });
+  Add("core/Encrypt prepared", [M, prepared] { return Encrypt(M, prepared); });
+  Add("core/Decrypt", [in, y] { return Decrypt(in, y); });
+  Add("core/Rerandomize", [in, s] { return Rerandomize(in, s); });
+  Add("core/Rerandomize prepared", [in, prepared, s] { return Rerandomize(in, prepared, s); });
+  Add("core/Rekey", [in, k] { return Rekey(in, k); });
+  Add("core/Reshuffle", [in, n] { return Reshuffle(in, n); });
+  Add("core/RKS", [in, k, n] { return RKS(in, k, n); });
+  Add("core/RKSR", [in, k, n, s] { return RKSR(in, k, n, s); });
+
+  Add("core/Encrypt decoded", [dM, dY] { return Encrypt(dM, dY); });
+  Add("core/Decrypt decoded", [decoded, y] { return Decrypt(decoded, y); });
+  Add("core/Rerandomize decoded", [decoded, s] { return Rerandomize(decoded, s); });
+  Add("core/Rekey decoded", [decoded, k] { return Rekey(decoded, k); });
+  Add("core/Reshuffle decoded", [decoded, n] { return Reshuffle(decoded, n); });
+  Add("core/RKS decoded", [decoded, k, n] { return RKS(decoded, k, n); });
+  Add("core/RKSR decoded", [decoded, k, n, s] { return RKSR(decoded, k, n, s); });
+
+  Add("core/Encrypt batch n=256", [messages, Y, out = std::vector<ElGamal>(N)]() mutable { Encrypt(messages, Y, out); }, N);
+  Add("core/Encrypt prepared batch n=256", [messages, prepared, out = std::vector<ElGamal>(N)]() mutable { Encrypt(messages, prepared, out); }, N);
+  Add("core/Encrypt decoded batch n=256", [decodedMessages, prepared, out = std::vector<ElGamal>(N)]() mutable { Encrypt(decodedMessages, prepared, out); }, N);
+  Add("core/Decrypt batch n=256", [tuples, y, out = std::vector<GroupElement>(N)]() mutable { Decrypt(tuples, y, out); }, N);
+  Add("core/Rerandomize batch n=256", [tuples, out = std::vector<ElGamal>(N)]() mutable { Rerandomize(tuples, out); }, N);
+  Add("core/Rekey batch n=256", [tuples, k, out = std::vector<ElGamal>(N)]() mutable { Rekey(tuples, k, out); }, N);
+  Add("core/Reshuffle batch n=256", [tuples, n, out = std::vector<ElGamal>(N)]() mutable { Reshuffle(tuples, n, out); }, N);
+  Add("core/RKS batch n=256", [tuples, k, n, out = std::vector<ElGamal>(N)]() mutable { RKS(tuples, k, n, out); }, N);
+  Add("core/RKSR batch n=256", [tuples, k, n, out = std::vector<ElGamal>(N)]() mutable { RKSR(tuples, k, n, out); }, N);
+
+  // the in-place versions transform the same record over and over, which keeps it valid
+  Add("core/Rerandomize view", [record]() mutable { Rerandomize(ElGamalView(std::span<uint8_t, ElGamal::BYTES>(record))); });
+  Add("core/Rekey view", [record, k]() mutable { Rekey(ElGamalView(std::span<uint8_t, ElGamal::BYTES>(record)), k); });
+  Add("core/Reshuffle view", [record, n]() mutable { Reshuffle(ElGamalView(std::span<uint8_t, ElGamal::BYTES>(record)), n); });
+  Add("core/RKS view", [record, k, n]() mutable { RKS(ElGamalView(std::span<uint8_t, ElGamal::BYTES>(record)), k, n); });
+  Add("core/Rerandomize records n=256", [records]() mutable { Rerandomize(std::span<uint8_t>(records)); }, N);
+  Add("core/Rekey records n=256", [records, k]() mutable { Rekey(std::span<uint8_t>(records), k); }, N);
+  Add("core/Reshuffle records n=256", [records, n]() mutable { Reshuffle(std::span<uint8_t>(records), n); }, N);
+  Add("core/RKS records n=256", [records, k, n]() mutable { RKS(std::span<uint8_t>(records), k, n); }, N);
+  Add("core/DoubleAndEncodeBatch n=256", [halves, out = std::vector<ElGamal>(N)]() mutable { DoubleAndEncodeBatch(halves, out); }, N);
+}
+
+void RegisterZKP() {
+  auto y = Scalar::Random();
+  auto Y = y * G;
+  auto a = Scalar::Random();
+  auto k = Scalar::Random();
+  auto n = Scalar::Random();
+  auto M = GroupElement::Random();
+  auto in = Encrypt(M, Y);
+  auto [A, proof] = CreateProof(a, M);
+  auto compactProof = Compact(A, M, proof);
+  auto signature = Sign(M, y);
+
+  auto points = Generate<GroupElement>(N, GroupElement::Random);
+  std::vector<GroupElement> keys;
+  std::vector<Proof> proofs;
+  for (const auto& P : points) {
+    auto [key, p] = CreateProof(Scalar::Random(), P);
+    keys.push_back(key);
+    proofs.push_back(p);
+  }
+  std::vector<GroupElement> multiplied;
+  for (const auto& P : points)
+    multiplied.push_back(a * P);
+  auto [aggregateA, aggregate] = CreateAggregateProof(a, points, multiplied);
+
+  auto tuples = Generate<ElGamal>(N, [&] { return Encrypt(GroupElement::Random(), Y); });
+  auto rerandomized = ProveRerandomize(in);
+  auto reshuffled = ProveReshuffle(in, n);
+  auto rekeyed = ProveRekey(in, k);
+  auto rks = ProveRKS(in, k, n);
+  auto compactRerandomized = Compact(in, rerandomized);
+  auto compactReshuffled = Compact(in, reshuffled);
+  auto compactRekeyed = Compact(in, rekeyed);
+  auto compactRKS = Compact(in, rks);
+  auto rerandomizedBatch = Generate<ProvedRerandomize>(N, [&, i = size_t(0)]() mutable { return ProveRerandomize(tuples[i++]); });
+  auto reshuffledBatch = Generate<ProvedReshuffle>(N, [&, i = size_t(0)]() mutable { return ProveReshuffle(tuples[i++], n); });
+  auto rekeyedBatch = Generate<ProvedRekey>(N, [&, i = size_t(0)]() mutable { return ProveRekey(tuples[i++], k); });
+  auto rksBatch = Generate<ProvedRKS>(N, [&, i = size_t(0)]() mutable { return ProveRKS(tuples[i++], k, n); });
+  std::vector<ElGamal> reshuffledOut(N), rekeyedOut(N), rksOut(N);
+  auto aggregateReshuffle = ProveReshuffleBatch(tuples, n, reshuffledOut);
+  auto aggregateRekey = ProveRekeyBatch(tuples, k, rekeyedOut);
+  auto aggregateRKS = ProveRKSBatch(tuples, k, n, rksOut);
+
+  Add("zkp/CreateProof", [a, M] { return CreateProof(a, M); });
+  Add("zkp/VerifyProof", [A, M, proof] { return VerifyProof(A, M, proof); });
+  Add("zkp/VerifyProof components", [A, M, proof] { return VerifyProof(A, M, proof.N, proof.C1, proof.C2, proof.s); });
+  Add("zkp/VerifyProofBatch n=256", [points, keys, proofs] { return VerifyProofBatch(keys, points, proofs); }, N);
+  Add("zkp/Compact proof", [A, M, proof] { return Compact(A, M, proof); });
+  Add("zkp/VerifyProof compact", [A, M, compactProof] { return VerifyProof(A, M, compactProof); });
+  Add("zkp/CreateAggregateProof n=256", [a, points, multiplied] { return CreateAggregateProof(a, points, multiplied); }, N);
+  Add("zkp/VerifyAggregateProof n=256", [aggregateA, points, multiplied, aggregate] { return VerifyAggregateProof(aggregateA, points, multiplied, aggregate); }, N);
+  Add("zkp/Sign", [M, y] { return Sign(M, y); });
+  Add("zkp/Verify", [M, signature, Y] { return Verify(M, signature, Y); });
+
+  Add("zkp/ProveRerandomize", [in] { return ProveRerandomize(in); });
+  Add("zkp/VerifyRerandomize", [in, rerandomized] { return VerifyRerandomize(in, rerandomized); });
+  Add("zkp/VerifyRerandomize compact", [in, compactRerandomized] { return VerifyRerandomize(in, compactRerandomized); });
+  Add("zkp/VerifyRerandomize batch n=256", [tuples, rerandomizedBatch] { return VerifyRerandomize(tuples, rerandomizedBatch); }, N);
+  Add("zkp/ProveReshuffle", [in, n] { return ProveReshuffle(in, n); });
+  Add("zkp/VerifyReshuffle", [in, reshuffled] { return VerifyReshuffle(in, reshuffled); });
+  Add("zkp/VerifyReshuffle compact", [in, compactReshuffled] { return VerifyReshuffle(in, compactReshuffled); });
+  Add("zkp/VerifyReshuffle batch n=256", [tuples, reshuffledBatch] { return VerifyReshuffle(tuples, reshuffledBatch); }, N);
+  Add("zkp/ReshuffledBy", [reshuffled] { return ReshuffledBy(reshuffled); });
+  Add("zkp/ProveRekey", [in, k] { return ProveRekey(in, k); });
+  Add("zkp/VerifyRekey", [in, rekeyed] { return VerifyRekey(in, rekeyed); });
+  Add("zkp/VerifyRekey compact", [in, compactRekeyed] { return VerifyRekey(in, compactRekeyed); });
+  Add("zkp/VerifyRekey batch n=256", [tuples, rekeyedBatch] { return VerifyRekey(tuples, rekeyedBatch); }, N);
+  Add("zkp/RekeyBy", [rekeyed] { return RekeyBy(rekeyed); });
+  Add("zkp/ProveRKS", [in, k, n] { return ProveRKS(in, k, n); });
+  Add("zkp/VerifyRKS", [in, rks] { return VerifyRKS(in, rks); });
+  Add("zkp/VerifyRKS compact", [in, compactRKS] { return VerifyRKS(in, compactRKS); });
+  Add("zkp/VerifyRKS batch n=256", [tuples, rksBatch] { return VerifyRKS(tuples, rksBatch); }, N);
+  Add("zkp/Compact ProvedRKS", [in, rks] { return Compact(in, rks); });
+
+  Add("zkp/ProveReshuffleBatch n=256", [tuples, n, out = std::vector<ElGamal>(N)]() mutable { return ProveReshuffleBatch(tuples, n, out); }, N);
+  Add("zkp/VerifyReshuffleBatch n=256", [tuples, reshuffledOut, aggregateReshuffle] { return VerifyReshuffleBatch(tuples, reshuffledOut, aggregateReshuffle); }, N);
+  Add("zkp/ProveRekeyBatch n=256", [tuples, k, out = std::vector<ElGamal>(N)]() mutable { return ProveRekeyBatch(tuples, k, out); }, N);
+  Add("zkp/VerifyRekeyBatch n=256", [tuples, rekeyedOut, aggregateRekey] { return VerifyRekeyBatch(tuples, rekeyedOut, aggregateRekey); }, N);
+  Add("zkp/ProveRKSBatch n=256", [tuples, k, n, out = std::vector<ElGamal>(N)]() mutable { return ProveRKSBatch(tuples, k, n, out); }, N);
+  Add("zkp/VerifyRKSBatch n=256", [tuples, rksOut, aggregateRKS] { return VerifyRKSBatch(tuples, rksOut, aggregateRKS); }, N);
+
+  Add("zkp/Serialize ProvedRKS", [rks] { return Serialize(rks); });
+  Add("zkp/Deserialize ProvedRKS", [encoded = Serialize(rks)] { return Deserialize<ProvedRKS>(encoded); });
+  Add("zkp/Serialize CompactProvedRKS", [compactRKS] { return Serialize(compactRKS); });
+  Add("zkp/Deserialize CompactProvedRKS", [encoded = Serialize(compactRKS)] { return Deserialize<CompactProvedRKS>(encoded); });
+}
+
+void RegisterLibPEP() {
+  auto [pk, sk] = GenerateGlobalKeys();
+  auto prepared = PreparePublicKey(pk);
+  std::string secret = "secret";
+  std::string decryptionContext = "decryption";
+  std::string pseudonymisationContext = "pseudonymisation";
+  auto global = GeneratePseudonym("identity", pk);
+  auto local = ConvertToLocalPseudonym(global, secret, decryptionContext, pseudonymisationContext);
+  auto localKey = MakeLocalDecryptionKey(sk, secret, decryptionContext);
+  auto identities = Generate<std::string>(N, [i = 0]() mutable { return "identity-" + std::to_string(i++); });
+  std::vector<std::string_view> identityViews(identities.begin(), identities.end());
+  auto contexts = Generate<std::string>(N, [i = 0]() mutable { return "context-" + std::to_string(i++); });
+  std::vector<std::string_view> contextViews(contexts.begin(), contexts.end());
+  auto globals = Generate<GlobalEncryptedPseudonym>(N, [&] { return GeneratePseudonym("identity", pk); });
+  std::vector<LocalEncryptedPseudonym> locals(N);
+  ConvertToLocalPseudonyms(globals, secret, decryptionContext, pseudonymisationContext, locals);
+
+  Add("libpep/GenerateGlobalKeys", [] { return GenerateGlobalKeys(); });
+  Add("libpep/GeneratePseudonym", [pk] { return GeneratePseudonym("identity", pk); });
+  Add("libpep/GeneratePseudonym prepared", [prepared] { return GeneratePseudonym("identity", prepared); });
+  Add("libpep/GeneratePseudonyms n=256", [identities, views = identityViews, prepared, out = std::vector<GlobalEncryptedPseudonym>(N)]() mutable {
+    GeneratePseudonyms(views, prepared, out);
+  }, N);
+  Add("libpep/ConvertToLocalPseudonym", [=] { return ConvertToLocalPseudonym(global, secret, decryptionContext, pseudonymisationContext); });
+  Add("libpep/ConvertToRerandomizedLocalPseudonym", [=] { return ConvertToRerandomizedLocalPseudonym(global, secret, decryptionContext, pseudonymisationContext); });
+  Add("libpep/ConvertFromLocalPseudonym", [=] { return ConvertFromLocalPseudonym(local, secret, decryptionContext, pseudonymisationContext); });
+  Add("libpep/ConvertToLocalPseudonyms n=256", [=, out = std::vector<LocalEncryptedPseudonym>(N)]() mutable {
+    ConvertToLocalPseudonyms(globals, secret, decryptionContext, pseudonymisationContext, out);
+  }, N);
+  Add("libpep/ConvertToRerandomizedLocalPseudonyms n=256", [=, out = std::vector<LocalEncryptedPseudonym>(N)]() mutable {
+    ConvertToRerandomizedLocalPseudonyms(globals, secret, decryptionContext, pseudonymisationContext, out);
+  }, N);
+  Add("libpep/ConvertFromLocalPseudonyms n=256", [=, out = std::vector<GlobalEncryptedPseudonym>(N)]() mutable {
+    ConvertFromLocalPseudonyms(locals, secret, decryptionContext, pseudonymisationContext, out);
+  }, N);
+  Add("libpep/PrepareFactors n=256 (cached)", [=] { PrepareFactors(secret, contextViews, contextViews); }, N);
+  Add("libpep/MakeLocalDecryptionKey", [=] { return MakeLocalDecryptionKey(sk, secret, decryptionContext); });
+  Add("libpep/MakeLocalDecryptionKeys n=256", [=, out = std::vector<LocalDecryptionKey>(N)]() mutable {
+    MakeLocalDecryptionKeys(sk, secret, contextViews, out);
+  }, N);
+  Add("libpep/DecryptLocalPseudonym", [local, localKey] { return DecryptLocalPseudonym(local, localKey); });
+  Add("libpep/DecryptLocalPseudonyms n=256", [locals, localKey, out = std::vector<LocalPseudonym>(N)]() mutable {
+    DecryptLocalPseudonyms(locals, localKey, out);
+  }, N);
+  Add("libpep/RerandomizeGlobal", [global] { return RerandomizeGlobal(global); });
+  Add("libpep/RerandomizeLocal", [local] { return RerandomizeLocal(local); });
+}
+
+double Median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  size_t middle = values.size() / 2;
+  return values.size() % 2 == 1 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+Result Measure(Benchmark& benchmark, const Options& options) {
+  // warm up (caches, lazily built tables), and find the number of calls that takes at least minTime
+  size_t iterations = 1;
+  for (;;) {
+    double seconds = benchmark.run(iterations);
+    if (seconds >= options.minTime)
+      break;
+    // aim a bit over minTime, but grow at most 100 times per step
+    double factor = seconds > 0 ? std::min(100.0, 1.2 * options.minTime / seconds) : 100.0;
+    iterations = std::max(iterations + 1, size_t(double(iterations) * factor));
+  }
+  std::vector<double> samples;
+  for (size_t i = 0; i < options.samples; ++i)
+    samples.push_back(benchmark.run(iterations) * 1e9 / double(iterations * benchmark.items));
+  double median = Median(samples);
+  std::vector<double> deviations;
+  for (double x : samples)
+    deviations.push_back(std::abs(x - median));
+  return {benchmark.name, median, 100 * Median(deviations) / median, samples.size(), iterations};
+}
+
+std::string Escape(const std::string& in) {
+  std::string retval;
+  for (char c : in) {
+    if (c == '"' || c == '\\')
+      retval += '\\';
+    retval += c;
+  }
+  return retval;
+}
+
+void WriteJSON(const std::string& path, const std::vector<Result>& results) {
+  std::ofstream out(path);
+  out << std::setprecision(10) << "{\n  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& r = results[i];
+    out << "    {\"name\": \"" << Escape(r.name) << "\", \"ns_per_op\": " << r.nsPerOp << ", \"ops_per_second\": " << 1e9 / r.nsPerOp
+        << ", \"mad_percent\": " << r.deviation << ", \"samples\": " << r.samples << ", \"iterations\": " << r.iterations << "}"
+        << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  out << "  ]\n}\n";
+  if (!out)
+    throw std::runtime_error("could not write " + path);
+}
+
+// reads the name and ns_per_op of every benchmark in a file written by WriteJSON
+std::map<std::string, double> ReadBaseline(const std::string& path) {
+  std::ifstream in(path);
+  if (!in)
+    throw std::runtime_error("could not open " + path);
+  std::stringstream contents;
+  contents << in.rdbuf();
+  std::string text = contents.str();
+  static const std::regex entry(R"re("name":\s*"((?:[^"\\]|\\.)*)"\s*,\s*"ns_per_op":\s*([-+0-9.eE]+))re");
+  std::map<std::string, double> retval;
+  for (auto it = std::sregex_iterator(text.begin(), text.end(), entry); it != std::sregex_iterator(); ++it) {
+    std::string name = std::regex_replace((*it)[1].str(), std::regex(R"(\\(.))"), "$1");
+    retval[name] = std::stod((*it)[2].str());
+  }
+  return retval;
+}
+
+CurveBackend ParseCurveBackend(const std::string& name) {
+  for (auto backend : {CurveBackend::Libsodium, CurveBackend::AVX2, CurveBackend::AVX512IFMA})
+    if (name == Name(backend))
+      return backend;
+  throw std::invalid_argument("unknown curve backend " + name);
+}
+
+void Usage(const char* argv0) {
+  std::cerr << argv0 << " [options]" << std::endl;
+  std::cerr << "  --filter [text]       only run benchmarks with text in their name" << std::endl;
+  std::cerr << "  --list                list the benchmarks" << std::endl;
+  std::cerr << "  --samples [count]     samples per benchmark (default 15)" << std::endl;
+  std::cerr << "  --min-time [seconds]  minimum time of a sample (default 0.01)" << std::endl;
+  std::cerr << "  --json [file]         write the results as JSON" << std::endl;
+  std::cerr << "  --baseline [file]     compare with the results in a JSON file of an earlier run" << std::endl;
+  std::cerr << "  --threshold [percent] slowdown compared to the baseline that counts as a regression (default 10)" << std::endl;
+  std::cerr << "  --backend [name]      curve backend to use (libsodium, avx2 or avx512ifma; default the fastest supported)" << std::endl;
+  std::cerr << "exits with 1 if a benchmark regressed" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  try {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      bool hasValue = i + 1 < argc;
+      if (arg == "--list") {
+        options.list = true;
+      } else if (arg == "--filter" && hasValue) {
+        options.filter = argv[++i];
+      } else if (arg == "--samples" && hasValue) {
+        options.samples = std::stoul(argv[++i]);
+      } else if (arg == "--min-time" && hasValue) {
+        options.minTime = std::stod(argv[++i]);
+      } else if (arg == "--json" && hasValue) {
+        options.json = argv[++i];
+      } else if (arg == "--baseline" && hasValue) {
+        options.baseline = argv[++i];
+      } else if (arg == "--threshold" && hasValue) {
+        options.threshold = std::stod(argv[++i]);
+      } else if (arg == "--backend" && hasValue) {
+        SetCurveBackend(ParseCurveBackend(argv[++i]));
+      } else {
+        Usage(argv[0]);
+        return -1;
+      }
+    }
+    if (options.samples == 0)
+      throw std::invalid_argument("--samples should be at least 1");
+
+    RegisterBase();
+    RegisterRistretto();
+    RegisterCurveBackends();
+    RegisterCore();
+    RegisterZKP();
+    RegisterLibPEP();
+    std::map<std::string, double> baseline;
+    if (!options.baseline.empty())
+      baseline = ReadBaseline(options.baseline);
+
+    std::vector<Result> results;
+    size_t regressions = 0;
+    if (!options.list) {
+      std::cout << std::left << std::setw(52) << "benchmark" << std::right << std::setw(14) << "ns/op" << std::setw(16) << "ops/s" << std::setw(9) << "mad %";
+      if (!baseline.empty())
+        std::cout << std::setw(11) << "change %";
+      std::cout << std::endl;
+    }
+    for (auto& benchmark : Benchmarks()) {
+      if (benchmark.name.find(options.filter) == std::string::npos)
+        continue;
+      if (options.list) {
+        std::cout << benchmark.name << std::endl;
+        continue;
+      }
+      auto result = Measure(benchmark, options);
+      results.push_back(result);
+      std::cout << std::left << std::setw(52) << result.name << std::right << std::fixed << std::setprecision(1)
+                << std::setw(14) << result.nsPerOp << std::setw(16) << std::setprecision(0) << 1e9 / result.nsPerOp
+                << std::setw(9) << std::setprecision(1) << result.deviation;
+      auto it = baseline.find(result.name);
+      if (it != baseline.end()) {
+        double change = 100 * (result.nsPerOp - it->second) / it->second;
+        bool regression = change > options.threshold;
+        regressions += regression;
+        std::cout << std::setw(11) << std::showpos << change << std::noshowpos << (regression ? "  REGRESSION" : "");
+      }
+      std::cout << std::endl;
+    }
+    if (!options.json.empty())
+      WriteJSON(options.json, results);
+    if (regressions > 0) {
+      std::cerr << regressions << " benchmark(s) more than " << options.threshold << "% slower than the baseline" << std::endl;
+      return 1;
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "error: " << e.what() << std::endl;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,168 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#include "randomizer-pool.h"
+
+#include <bit>
+#include <stdexcept>
+
+#include "metrics.h"
+#include "sodium.h"
+
+using namespace libpep;
+
+libpep::RandomizerPool::Randomizer::~Randomizer() {
+  sodium_memzero(this, sizeof(*this));
+}
+
+libpep::RandomizerPool::RandomizerPool(const GroupElement& _Y, size_t capacity) : Y(_Y), mask(0), cells(nullptr), metricsId(0) {
+  if (_Y.is_zero())
+    throw std::invalid_argument("RandomizerPool expects a non zero public key");
+  if (capacity == 0)
+    throw std::invalid_argument("RandomizerPool expects a non zero capacity");
+  capacity = std::bit_ceil(capacity);
+  mask = capacity - 1;
+  cells = std::make_unique<Cell[]>(capacity);
+  for (size_t i = 0; i < capacity; ++i)
+    cells[i].sequence.store(i, std::memory_order_relaxed);
+  thread = std::thread([this] { fill(); });
+  metricsId = RegisterRandomizerPool([this] {
+    RandomizerPoolGauges retval;
+    retval.depth = depth();
+    retval.capacity = mask + 1;
+    return retval;
+  });
+}
+
+libpep::RandomizerPool::~RandomizerPool() {
+  UnregisterRandomizerPool(metricsId);
+  stopping = true;
+  full = false;
+  full.notify_one();
+  thread.join();
+  // cells still in the ring are wiped by the destructors of the Randomizers
+}
+
+RandomizerPool::Randomizer libpep::RandomizerPool::compute() const {
+  auto r = Scalar::Random();
+  Randomizer retval;
+  retval.R = DecodedGroupElement::MultBase(r);
+  retval.B = retval.R.encode();
+  retval.RY = r * Y;
+  sodium_memzero(r.value, sizeof(r.value));
+  return retval;
+}
+
+// only called by the background thread
+bool libpep::RandomizerPool::push(const Randomizer& value) {
+  size_t position = enqueuePosition.load(std::memory_order_relaxed);
+  Cell& cell = cells[position & mask];
+  if (cell.sequence.load(std::memory_order_acquire) != position)
+    return false; // full
+  cell.value = value;
+  cell.sequence.store(position + 1, std::memory_order_release);
+  enqueuePosition.store(position + 1, std::memory_order_relaxed);
+  return true;
+}
+
+bool libpep::RandomizerPool::pop(Randomizer& out) {
+  size_t position = dequeuePosition.load(std::memory_order_relaxed);
+  for (;;) {
+    Cell& cell = cells[position & mask];
+    auto diff = static_cast<std::ptrdiff_t>(cell.sequence.load(std::memory_order_acquire) - (position + 1));
+    if (diff < 0)
+      return false; // empty
+    if (diff > 0) {
+      position = dequeuePosition.load(std::memory_order_relaxed);
+    } else if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+      out = cell.value;
+      sodium_memzero(&cell.value, sizeof(cell.value));
+      cell.sequence.store(position + mask + 1, std::memory_order_release);
+      return true;
+    }
+  }
+}
+
+size_t libpep::RandomizerPool::depth() const {
+  size_t dequeued = dequeuePosition.load();
+  size_t enqueued = enqueuePosition.load();
+  return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+void libpep::RandomizerPool::fill() {
+  while (!stopping) {
+    if (depth() > mask) {
+      // announce the wait before checking again, so a take() in between either sees the flag or is seen here
+      full = true;
+      if (depth() > mask && !stopping)
+        full.wait(true);
+      full = false;
+      continue;
+    }
+    // a consumer may still be copying out of the cell that is next
+    if (push(compute())) {
+      produced.fetch_add(1, std::memory_order_relaxed);
+      Count(Counter::RandomizerPoolPairsProduced);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+RandomizerPool::Randomizer libpep::RandomizerPool::take() {
+  Randomizer retval;
+  if (pop(retval)) {
+    taken.fetch_add(1, std::memory_order_relaxed);
+    Count(Counter::RandomizerPoolPairsTaken);
+    if (full) {
+      full = false;
+      full.notify_one();
+    }
+    return retval;
+  }
+  fallbacks.fetch_add(1, std::memory_order_relaxed);
+  Count(Counter::RandomizerPoolFallbacks);
+  return compute();
+}
+
+RandomizerPool::Statistics libpep::RandomizerPool::statistics() const {
+  Statistics retval;
+  retval.depth = depth();
+  retval.capacity = mask + 1;
+  retval.produced = produced.load(std::memory_order_relaxed);
+  retval.taken = taken.load(std::memory_order_relaxed);
+  retval.fallbacks = fallbacks.load(std::memory_order_relaxed);
+  return retval;
+}
+
+ElGamal libpep::Encrypt(const GroupElement& M, RandomizerPool& pool) {
+  ScopedTimer timer(Operation::Encrypt);
+  Count(Counter::Encryptions);
+  auto x = pool.take();
+  return {x.B, (DecodedGroupElement(M) + x.RY).encode(), pool.publicKey().encoded()};
+}
+
+ElGamal libpep::Rerandomize(const ElGamal& in, RandomizerPool& pool) {
+  if (in.Y != pool.publicKey().encoded())
+    throw std::invalid_argument("Rerandomize with a pool that is not for the public key of the ElGamal tuple");
+  ScopedTimer timer(Operation::Rerandomize);
+  Count(Counter::Rerandomizations);
+  auto x = pool.take();
+  return {(x.R + DecodedGroupElement(in.B)).encode(), (x.RY + DecodedGroupElement(in.C)).encode(), in.Y};
+}
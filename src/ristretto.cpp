@@ -0,0 +1,1570 @@
+/**
+Copyright 2021 Bernard van Gastel, bvgastel@bitpowder.com.
+This file is part of libpep.
+
+libpep is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+libpep is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Author: Bernard van Gastel
+
+#include "ristretto.h"
+
+#include <array>
+#include <stdexcept>
+#include <vector>
+
+#include "curve-backend.h"
+#include "metrics.h"
+#include "sodium.h"
+
+using namespace libpep;
+
+// Field and point arithmetic follows ed25519_ref10.c and fe_51/fe.h of libsodium,
+// the ristretto encoding follows ristretto255_frombytes() and ristretto255_p3_tobytes() there.
+// Results are byte for byte identical to the crypto_core_ristretto255_* functions.
+
+namespace {
+
+#if defined(__SIZEOF_INT128__)
+using uint128 = unsigned __int128;
+inline uint128 mul64(uint64_t a, uint64_t b) {
+  return uint128(a) * b;
+}
+inline uint64_t shr51(uint128 a) {
+  return uint64_t(a >> 51);
+}
+inline uint64_t lo64(uint128 a) {
+  return uint64_t(a);
+}
+#else
+// portable fallback for compilers without 128 bits integers (MSVC)
+struct uint128 {
+  uint64_t lo;
+  uint64_t hi;
+};
+inline uint128 mul64(uint64_t a, uint64_t b) {
+  uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+  uint64_t b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+  uint64_t lolo = a_lo * b_lo;
+  uint64_t lohi = a_lo * b_hi;
+  uint64_t hilo = a_hi * b_lo;
+  uint64_t hihi = a_hi * b_hi;
+  uint64_t cross = (lolo >> 32) + (lohi & 0xFFFFFFFF) + hilo;
+  return {(cross << 32) | (lolo & 0xFFFFFFFF), hihi + (lohi >> 32) + (cross >> 32)};
+}
+inline uint128 operator+(uint128 a, uint128 b) {
+  uint64_t lo = a.lo + b.lo;
+  return {lo, a.hi + b.hi + (lo < a.lo)};
+}
+inline uint128& operator+=(uint128& a, uint64_t b) {
+  uint64_t lo = a.lo + b;
+  a.hi += lo < a.lo;
+  a.lo = lo;
+  return a;
+}
+inline uint64_t shr51(uint128 a) {
+  return (a.lo >> 51) | (a.hi << 13);
+}
+inline uint64_t lo64(uint128 a) {
+  return a.lo;
+}
+#endif
+
+const uint64_t MASK51 = (uint64_t(1) << 51) - 1;
+
+using fe = FieldElement;
+
+const fe fe_zero = {{0, 0, 0, 0, 0}};
+const fe fe_one = {{1, 0, 0, 0, 0}};
+// d = -121665/121666
+const fe fe_d = {{0x34dca135978a3, 0x1a8283b156ebd, 0x5e7a26001c029, 0x739c663a03cbb, 0x52036cee2b6ff}};
+const fe fe_d2 = {{0x69b9426b2f159, 0x35050762add7a, 0x3cf44c0038052, 0x6738cc7407977, 0x2406d9dc56dff}};
+const fe fe_sqrtm1 = {{0x61b274a0ea0b0, 0xd5a5fc8f189d, 0x7ef5e9cbd0c60, 0x78595a6804c9e, 0x2b8324804fc1d}};
+// 1/sqrt(a-d)
+const fe fe_invsqrtamd = {{0xfdaa805d40ea, 0x2eb482e57d339, 0x7610274bc58, 0x6510b613dc8ff, 0x786c8905cfaff}};
+// sqrt(a*d-1)
+const fe fe_sqrtadm1 = {{0x7f6a0497b2e1b, 0x1836f0a97afd2, 0x7d747f6be7638, 0x456079e7e6498, 0x376931bf2b834}};
+// 1-d^2
+const fe fe_onemsqd = {{0x409c1945fc176, 0x719abc6a1fc4f, 0x1c37f90b20684, 0x6bccca55eedf, 0x29072a8b2b3e}};
+// (d-1)^2
+const fe fe_sqdmone = {{0x55aaa44ed4d20, 0x59603c3332635, 0x26d3baf4a7928, 0x120a66e6997a9, 0x5968b37af66c2}};
+
+inline void fe_add(fe& h, const fe& f, const fe& g) {
+  for (int i = 0; i < 5; ++i)
+    h.v[i] = f.v[i] + g.v[i];
+}
+
+inline void fe_sub(fe& h, const fe& f, const fe& g) {
+  uint64_t h0 = g.v[0], h1 = g.v[1], h2 = g.v[2], h3 = g.v[3], h4 = g.v[4];
+  h1 += h0 >> 51; h0 &= MASK51;
+  h2 += h1 >> 51; h1 &= MASK51;
+  h3 += h2 >> 51; h2 &= MASK51;
+  h4 += h3 >> 51; h3 &= MASK51;
+  h0 += 19 * (h4 >> 51); h4 &= MASK51;
+  // f + 2p - g
+  h.v[0] = (f.v[0] + 0xfffffffffffdaULL) - h0;
+  h.v[1] = (f.v[1] + 0xffffffffffffeULL) - h1;
+  h.v[2] = (f.v[2] + 0xffffffffffffeULL) - h2;
+  h.v[3] = (f.v[3] + 0xffffffffffffeULL) - h3;
+  h.v[4] = (f.v[4] + 0xffffffffffffeULL) - h4;
+}
+
+inline void fe_neg(fe& h, const fe& f) {
+  fe_sub(h, fe_zero, f);
+}
+
+inline void fe_carry(fe& h, uint128 r0, uint128 r1, uint128 r2, uint128 r3, uint128 r4) {
+  uint64_t carry;
+  uint64_t r00 = lo64(r0) & MASK51;
+  carry = shr51(r0);
+  r1 += carry;
+  uint64_t r01 = lo64(r1) & MASK51;
+  carry = shr51(r1);
+  r2 += carry;
+  uint64_t r02 = lo64(r2) & MASK51;
+  carry = shr51(r2);
+  r3 += carry;
+  uint64_t r03 = lo64(r3) & MASK51;
+  carry = shr51(r3);
+  r4 += carry;
+  uint64_t r04 = lo64(r4) & MASK51;
+  carry = shr51(r4);
+  r00 += 19 * carry;
+  carry = r00 >> 51;
+  r00 &= MASK51;
+  r01 += carry;
+  carry = r01 >> 51;
+  r01 &= MASK51;
+  r02 += carry;
+  h.v[0] = r00;
+  h.v[1] = r01;
+  h.v[2] = r02;
+  h.v[3] = r03;
+  h.v[4] = r04;
+}
+
+inline void fe_mul(fe& h, const fe& f, const fe& g) {
+  const uint64_t f0 = f.v[0], f1 = f.v[1], f2 = f.v[2], f3 = f.v[3], f4 = f.v[4];
+  const uint64_t g0 = g.v[0], g1 = g.v[1], g2 = g.v[2], g3 = g.v[3], g4 = g.v[4];
+  const uint64_t g1_19 = 19 * g1, g2_19 = 19 * g2, g3_19 = 19 * g3, g4_19 = 19 * g4;
+
+  uint128 r0 = mul64(f0, g0) + mul64(f1, g4_19) + mul64(f2, g3_19) + mul64(f3, g2_19) + mul64(f4, g1_19);
+  uint128 r1 = mul64(f0, g1) + mul64(f1, g0) + mul64(f2, g4_19) + mul64(f3, g3_19) + mul64(f4, g2_19);
+  uint128 r2 = mul64(f0, g2) + mul64(f1, g1) + mul64(f2, g0) + mul64(f3, g4_19) + mul64(f4, g3_19);
+  uint128 r3 = mul64(f0, g3) + mul64(f1, g2) + mul64(f2, g1) + mul64(f3, g0) + mul64(f4, g4_19);
+  uint128 r4 = mul64(f0, g4) + mul64(f1, g3) + mul64(f2, g2) + mul64(f3, g1) + mul64(f4, g0);
+  fe_carry(h, r0, r1, r2, r3, r4);
+}
+
+inline void fe_sq(fe& h, const fe& f) {
+  const uint64_t f0 = f.v[0], f1 = f.v[1], f2 = f.v[2], f3 = f.v[3], f4 = f.v[4];
+  const uint64_t f0_2 = f0 << 1, f1_2 = f1 << 1;
+  const uint64_t f1_38 = 38 * f1, f2_38 = 38 * f2, f3_38 = 38 * f3;
+  const uint64_t f3_19 = 19 * f3, f4_19 = 19 * f4;
+
+  uint128 r0 = mul64(f0, f0) + mul64(f1_38, f4) + mul64(f2_38, f3);
+  uint128 r1 = mul64(f0_2, f1) + mul64(f2_38, f4) + mul64(f3_19, f3);
+  uint128 r2 = mul64(f0_2, f2) + mul64(f1, f1) + mul64(f3_38, f4);
+  uint128 r3 = mul64(f0_2, f3) + mul64(f1_2, f2) + mul64(f4_19, f4);
+  uint128 r4 = mul64(f0_2, f4) + mul64(f1_2, f3) + mul64(f2, f2);
+  fe_carry(h, r0, r1, r2, r3, r4);
+}
+
+// h = 2 * f^2
+inline void fe_sq2(fe& h, const fe& f) {
+  fe_sq(h, f);
+  fe_add(h, h, h);
+}
+
+// h = f^(2^n)
+inline void fe_sqn(fe& h, const fe& f, int n) {
+  fe_sq(h, f);
+  for (int i = 1; i < n; ++i)
+    fe_sq(h, h);
+}
+
+void fe_reduce(uint64_t t[5], const fe& f) {
+  for (int i = 0; i < 5; ++i)
+    t[i] = f.v[i];
+  for (int round = 0; round < 2; ++round) {
+    t[1] += t[0] >> 51; t[0] &= MASK51;
+    t[2] += t[1] >> 51; t[1] &= MASK51;
+    t[3] += t[2] >> 51; t[2] &= MASK51;
+    t[4] += t[3] >> 51; t[3] &= MASK51;
+    t[0] += 19 * (t[4] >> 51); t[4] &= MASK51;
+  }
+  // now t is between 0 and 2^255-1, properly carried.
+  // case 1: between 0 and 2^255-20. case 2: between 2^255-19 and 2^255-1.
+  t[0] += 19;
+  t[1] += t[0] >> 51; t[0] &= MASK51;
+  t[2] += t[1] >> 51; t[1] &= MASK51;
+  t[3] += t[2] >> 51; t[2] &= MASK51;
+  t[4] += t[3] >> 51; t[3] &= MASK51;
+  t[0] += 19 * (t[4] >> 51); t[4] &= MASK51;
+  // now between 19 and 2^255-1 in both cases, and offset by 19.
+  t[0] += 0x8000000000000ULL - 19;
+  t[1] += 0x8000000000000ULL - 1;
+  t[2] += 0x8000000000000ULL - 1;
+  t[3] += 0x8000000000000ULL - 1;
+  t[4] += 0x8000000000000ULL - 1;
+  // now between 2^255 and 2^256-20, and offset by 2^255.
+  t[1] += t[0] >> 51; t[0] &= MASK51;
+  t[2] += t[1] >> 51; t[1] &= MASK51;
+  t[3] += t[2] >> 51; t[2] &= MASK51;
+  t[4] += t[3] >> 51; t[3] &= MASK51;
+  t[4] &= MASK51;
+}
+
+void fe_tobytes(uint8_t s[32], const fe& f) {
+  uint64_t t[5];
+  fe_reduce(t, f);
+  uint64_t w[4] = {
+    t[0] | (t[1] << 51),
+    (t[1] >> 13) | (t[2] << 38),
+    (t[2] >> 26) | (t[3] << 25),
+    (t[3] >> 39) | (t[4] << 12),
+  };
+  for (int i = 0; i < 4; ++i)
+    for (int j = 0; j < 8; ++j)
+      s[i * 8 + j] = uint8_t(w[i] >> (8 * j));
+}
+
+// ignores the top bit
+void fe_frombytes(fe& h, const uint8_t s[32]) {
+  uint64_t w[4];
+  for (int i = 0; i < 4; ++i) {
+    w[i] = 0;
+    for (int j = 0; j < 8; ++j)
+      w[i] |= uint64_t(s[i * 8 + j]) << (8 * j);
+  }
+  h.v[0] = w[0] & MASK51;
+  h.v[1] = ((w[0] >> 51) | (w[1] << 13)) & MASK51;
+  h.v[2] = ((w[1] >> 38) | (w[2] << 26)) & MASK51;
+  h.v[3] = ((w[2] >> 25) | (w[3] << 39)) & MASK51;
+  h.v[4] = (w[3] >> 12) & MASK51;
+}
+
+int fe_iszero(const fe& f) {
+  uint8_t s[32];
+  fe_tobytes(s, f);
+  uint8_t d = 0;
+  for (auto b : s)
+    d |= b;
+  return 1 & ((unsigned(d) - 1) >> 8);
+}
+
+int fe_isnegative(const fe& f) {
+  uint8_t s[32];
+  fe_tobytes(s, f);
+  return s[0] & 1;
+}
+
+inline void fe_cmov(fe& f, const fe& g, unsigned int b) {
+  uint64_t mask = uint64_t(0) - uint64_t(b);
+  for (int i = 0; i < 5; ++i)
+    f.v[i] ^= mask & (f.v[i] ^ g.v[i]);
+}
+
+inline void fe_cneg(fe& h, const fe& f, unsigned int b) {
+  fe negf;
+  fe_neg(negf, f);
+  h = f;
+  fe_cmov(h, negf, b);
+}
+
+inline void fe_abs(fe& h, const fe& f) {
+  fe_cneg(h, f, unsigned(fe_isnegative(f)));
+}
+
+// z^(2^252-3)
+void fe_pow22523(fe& out, const fe& z) {
+  fe t0, t1, t2;
+  fe_sq(t0, z);
+  fe_sqn(t1, t0, 2);
+  fe_mul(t1, z, t1);
+  fe_mul(t0, t0, t1);
+  fe_sq(t0, t0);
+  fe_mul(t0, t1, t0);
+  fe_sqn(t1, t0, 5);
+  fe_mul(t0, t1, t0);
+  fe_sqn(t1, t0, 10);
+  fe_mul(t1, t1, t0);
+  fe_sqn(t2, t1, 20);
+  fe_mul(t1, t2, t1);
+  fe_sqn(t1, t1, 10);
+  fe_mul(t0, t1, t0);
+  fe_sqn(t1, t0, 50);
+  fe_mul(t1, t1, t0);
+  fe_sqn(t2, t1, 100);
+  fe_mul(t1, t2, t1);
+  fe_sqn(t1, t1, 50);
+  fe_mul(t0, t1, t0);
+  fe_sqn(t0, t0, 2);
+  fe_mul(out, t0, z);
+}
+
+// z^(p-2) = z^-1
+void fe_invert(fe& out, const fe& z) {
+  fe t0, t1, t2, t3;
+  fe_sq(t0, z);
+  fe_sqn(t1, t0, 2);
+  fe_mul(t1, z, t1);
+  fe_mul(t0, t0, t1);
+  fe_sq(t2, t0);
+  fe_mul(t1, t1, t2);
+  fe_sqn(t2, t1, 5);
+  fe_mul(t1, t2, t1);
+  fe_sqn(t2, t1, 10);
+  fe_mul(t2, t2, t1);
+  fe_sqn(t3, t2, 20);
+  fe_mul(t2, t3, t2);
+  fe_sqn(t2, t2, 10);
+  fe_mul(t1, t2, t1);
+  fe_sqn(t2, t1, 50);
+  fe_mul(t2, t2, t1);
+  fe_sqn(t3, t2, 100);
+  fe_mul(t2, t3, t2);
+  fe_sqn(t2, t2, 50);
+  fe_mul(t1, t2, t1);
+  fe_sqn(t1, t1, 5);
+  fe_mul(out, t1, t0);
+}
+
+// x = sqrt(u/v) (or sqrt(i*u/v)), returns 1 if u/v was square
+int fe_sqrt_ratio_m1(fe& x, const fe& u, const fe& v) {
+  fe v3, vxx, m_root_check, p_root_check, f_root_check, x_sqrtm1;
+  fe_sq(v3, v);
+  fe_mul(v3, v3, v); // v^3
+  fe_sq(x, v3);
+  fe_mul(x, x, v);
+  fe_mul(x, x, u); // u*v^7
+  fe_pow22523(x, x); // (u*v^7)^((q-5)/8)
+  fe_mul(x, x, v3);
+  fe_mul(x, x, u); // u*v^3*(u*v^7)^((q-5)/8)
+
+  fe_sq(vxx, x);
+  fe_mul(vxx, vxx, v); // v*x^2
+  fe_sub(m_root_check, vxx, u); // v*x^2-u
+  fe_add(p_root_check, vxx, u); // v*x^2+u
+  fe_mul(f_root_check, u, fe_sqrtm1); // u*sqrt(-1)
+  fe_add(f_root_check, vxx, f_root_check); // v*x^2+u*sqrt(-1)
+  int has_m_root = fe_iszero(m_root_check);
+  int has_p_root = fe_iszero(p_root_check);
+  int has_f_root = fe_iszero(f_root_check);
+  fe_mul(x_sqrtm1, x, fe_sqrtm1); // x*sqrt(-1)
+
+  fe_cmov(x, x_sqrtm1, unsigned(has_p_root | has_f_root));
+  fe_abs(x, x);
+  return has_m_root | has_p_root;
+}
+
+// completed point ((X:Z),(Y:T))
+struct GeP1P1 {
+  fe X, Y, Z, T;
+};
+
+// projective point (X:Y:Z)
+struct GeP2 {
+  fe X, Y, Z;
+};
+
+// cached form of an extended point, ready to be added
+struct GeCached {
+  fe YplusX, YminusX, Z, T2d;
+};
+
+// affine point ready to be added (Z = 1)
+struct GePrecomp {
+  fe yplusx, yminusx, xy2d;
+};
+
+using GeP3 = DecodedGroupElement;
+
+void ge_p3_0(GeP3& h) {
+  h.X = fe_zero;
+  h.Y = fe_one;
+  h.Z = fe_one;
+  h.T = fe_zero;
+}
+
+void ge_cached_0(GeCached& h) {
+  h.YplusX = fe_one;
+  h.YminusX = fe_one;
+  h.Z = fe_one;
+  h.T2d = fe_zero;
+}
+
+void ge_precomp_0(GePrecomp& h) {
+  h.yplusx = fe_one;
+  h.yminusx = fe_one;
+  h.xy2d = fe_zero;
+}
+
+inline void ge_p3_to_cached(GeCached& r, const GeP3& p) {
+  fe_add(r.YplusX, p.Y, p.X);
+  fe_sub(r.YminusX, p.Y, p.X);
+  r.Z = p.Z;
+  fe_mul(r.T2d, p.T, fe_d2);
+}
+
+inline void ge_p3_to_p2(GeP2& r, const GeP3& p) {
+  r.X = p.X;
+  r.Y = p.Y;
+  r.Z = p.Z;
+}
+
+inline void ge_p1p1_to_p2(GeP2& r, const GeP1P1& p) {
+  fe_mul(r.X, p.X, p.T);
+  fe_mul(r.Y, p.Y, p.Z);
+  fe_mul(r.Z, p.Z, p.T);
+}
+
+inline void ge_p1p1_to_p3(GeP3& r, const GeP1P1& p) {
+  fe_mul(r.X, p.X, p.T);
+  fe_mul(r.Y, p.Y, p.Z);
+  fe_mul(r.Z, p.Z, p.T);
+  fe_mul(r.T, p.X, p.Y);
+}
+
+// r = 2 * p
+inline void ge_p2_dbl(GeP1P1& r, const GeP2& p) {
+  fe t0;
+  fe_sq(r.X, p.X);
+  fe_sq(r.Z, p.Y);
+  fe_sq2(r.T, p.Z);
+  fe_add(r.Y, p.X, p.Y);
+  fe_sq(t0, r.Y);
+  fe_add(r.Y, r.Z, r.X);
+  fe_sub(r.Z, r.Z, r.X);
+  fe_sub(r.X, t0, r.Y);
+  fe_sub(r.T, r.T, r.Z);
+}
+
+inline void ge_p3_dbl(GeP1P1& r, const GeP3& p) {
+  GeP2 q;
+  ge_p3_to_p2(q, p);
+  ge_p2_dbl(r, q);
+}
+
+// r = p + q
+inline void ge_add(GeP1P1& r, const GeP3& p, const GeCached& q) {
+  fe t0;
+  fe_add(r.X, p.Y, p.X);
+  fe_sub(r.Y, p.Y, p.X);
+  fe_mul(r.Z, r.X, q.YplusX);
+  fe_mul(r.Y, r.Y, q.YminusX);
+  fe_mul(r.T, q.T2d, p.T);
+  fe_mul(r.X, p.Z, q.Z);
+  fe_add(t0, r.X, r.X);
+  fe_sub(r.X, r.Z, r.Y);
+  fe_add(r.Y, r.Z, r.Y);
+  fe_add(r.Z, t0, r.T);
+  fe_sub(r.T, t0, r.T);
+}
+
+// r = p - q
+inline void ge_sub(GeP1P1& r, const GeP3& p, const GeCached& q) {
+  fe t0;
+  fe_add(r.X, p.Y, p.X);
+  fe_sub(r.Y, p.Y, p.X);
+  fe_mul(r.Z, r.X, q.YminusX);
+  fe_mul(r.Y, r.Y, q.YplusX);
+  fe_mul(r.T, q.T2d, p.T);
+  fe_mul(r.X, p.Z, q.Z);
+  fe_add(t0, r.X, r.X);
+  fe_sub(r.X, r.Z, r.Y);
+  fe_add(r.Y, r.Z, r.Y);
+  fe_sub(r.Z, t0, r.T);
+  fe_add(r.T, t0, r.T);
+}
+
+// r = p + q
+inline void ge_madd(GeP1P1& r, const GeP3& p, const GePrecomp& q) {
+  fe t0;
+  fe_add(r.X, p.Y, p.X);
+  fe_sub(r.Y, p.Y, p.X);
+  fe_mul(r.Z, r.X, q.yplusx);
+  fe_mul(r.Y, r.Y, q.yminusx);
+  fe_mul(r.T, q.xy2d, p.T);
+  fe_add(t0, p.Z, p.Z);
+  fe_sub(r.X, r.Z, r.Y);
+  fe_add(r.Y, r.Z, r.Y);
+  fe_add(r.Z, t0, r.T);
+  fe_sub(r.T, t0, r.T);
+}
+
+inline unsigned char ct_equal(signed char b, signed char c) {
+  unsigned char ub = static_cast<unsigned char>(b);
+  unsigned char uc = static_cast<unsigned char>(c);
+  unsigned char x = ub ^ uc; // 0: yes; 1..255: no
+  uint32_t y = x; // 0: yes; 1..255: no
+  y -= 1; // 4294967295: yes; 0..254: no
+  y >>= 31; // 1: yes; 0: no
+  return static_cast<unsigned char>(y);
+}
+
+inline unsigned char ct_negative(signed char b) {
+  // 18446744073709551361..18446744073709551615: yes; 0..255: no
+  uint64_t x = static_cast<uint64_t>(static_cast<int64_t>(b));
+  x >>= 63; // 1: yes; 0: no
+  return static_cast<unsigned char>(x);
+}
+
+inline void ge_cmov_cached(GeCached& t, const GeCached& u, unsigned char b) {
+  fe_cmov(t.YplusX, u.YplusX, b);
+  fe_cmov(t.YminusX, u.YminusX, b);
+  fe_cmov(t.Z, u.Z, b);
+  fe_cmov(t.T2d, u.T2d, b);
+}
+
+inline void ge_cmov_precomp(GePrecomp& t, const GePrecomp& u, unsigned char b) {
+  fe_cmov(t.yplusx, u.yplusx, b);
+  fe_cmov(t.yminusx, u.yminusx, b);
+  fe_cmov(t.xy2d, u.xy2d, b);
+}
+
+// t = b * P, with cached[i] = (i+1) * P, and -8 <= b <= 8, constant time
+void ge_cmov8_cached(GeCached& t, const GeCached cached[8], signed char b) {
+  const unsigned char bnegative = ct_negative(b);
+  const unsigned char babs = static_cast<unsigned char>(b - static_cast<signed char>(((-bnegative) & b) * 2));
+
+  ge_cached_0(t);
+  for (int i = 0; i < 8; ++i)
+    ge_cmov_cached(t, cached[i], ct_equal(static_cast<signed char>(babs), static_cast<signed char>(i + 1)));
+  GeCached minust;
+  minust.YplusX = t.YminusX;
+  minust.YminusX = t.YplusX;
+  minust.Z = t.Z;
+  fe_neg(minust.T2d, t.T2d);
+  ge_cmov_cached(t, minust, bnegative);
+}
+
+void ge_cmov8_precomp(GePrecomp& t, const GePrecomp precomp[8], signed char b) {
+  const unsigned char bnegative = ct_negative(b);
+  const unsigned char babs = static_cast<unsigned char>(b - static_cast<signed char>(((-bnegative) & b) * 2));
+
+  ge_precomp_0(t);
+  for (int i = 0; i < 8; ++i)
+    ge_cmov_precomp(t, precomp[i], ct_equal(static_cast<signed char>(babs), static_cast<signed char>(i + 1)));
+  GePrecomp minust;
+  minust.yplusx = t.yminusx;
+  minust.yminusx = t.yplusx;
+  fe_neg(minust.xy2d, t.xy2d);
+  ge_cmov_precomp(t, minust, bnegative);
+}
+
+// signed radix 16 representation of a scalar: 64 digits in [-8, 8], requires a[31] <= 127
+void slide16(signed char e[64], const uint8_t a[32]) {
+  for (int i = 0; i < 32; ++i) {
+    e[2 * i + 0] = static_cast<signed char>(a[i] & 15);
+    e[2 * i + 1] = static_cast<signed char>((a[i] >> 4) & 15);
+  }
+  signed char carry = 0;
+  for (int i = 0; i < 63; ++i) {
+    e[i] = static_cast<signed char>(e[i] + carry);
+    carry = static_cast<signed char>((e[i] + 8) >> 4);
+    e[i] = static_cast<signed char>(e[i] - carry * 16);
+  }
+  e[63] = static_cast<signed char>(e[63] + carry);
+}
+
+// pi[i] = (i+1) * p
+void ge_precompute8(GeCached pi[8], const GeP3& p) {
+  GeP1P1 t;
+  GeP3 p2, p3, p4, p5, p6, p7, p8;
+  ge_p3_to_cached(pi[0], p);
+  ge_p3_dbl(t, p); ge_p1p1_to_p3(p2, t); ge_p3_to_cached(pi[1], p2);
+  ge_add(t, p, pi[1]); ge_p1p1_to_p3(p3, t); ge_p3_to_cached(pi[2], p3);
+  ge_p3_dbl(t, p2); ge_p1p1_to_p3(p4, t); ge_p3_to_cached(pi[3], p4);
+  ge_add(t, p, pi[3]); ge_p1p1_to_p3(p5, t); ge_p3_to_cached(pi[4], p5);
+  ge_p3_dbl(t, p3); ge_p1p1_to_p3(p6, t); ge_p3_to_cached(pi[5], p6);
+  ge_add(t, p, pi[5]); ge_p1p1_to_p3(p7, t); ge_p3_to_cached(pi[6], p7);
+  ge_p3_dbl(t, p4); ge_p1p1_to_p3(p8, t); ge_p3_to_cached(pi[7], p8);
+}
+
+// signed radix 16 digits of a scalar for the constant time multiplications
+void recode16(signed char e[64], const uint8_t scalar[32]) {
+  uint8_t a[32];
+  memcpy(a, scalar, sizeof(a));
+  a[31] &= 127; // same as crypto_scalarmult_ristretto255()
+  slide16(e, a);
+}
+
+// r = e * p, constant time
+void ge_scalarmult(GeP3& h, const signed char e[64], const GeP3& p) {
+  GeCached pi[8];
+  ge_precompute8(pi, p);
+
+  ge_p3_0(h);
+  GeCached c;
+  GeP1P1 t;
+  GeP2 s;
+  for (int i = 63; i != 0; i--) {
+    ge_cmov8_cached(c, pi, e[i]);
+    ge_add(t, h, c);
+    ge_p1p1_to_p2(s, t);
+    ge_p2_dbl(t, s);
+    ge_p1p1_to_p2(s, t);
+    ge_p2_dbl(t, s);
+    ge_p1p1_to_p2(s, t);
+    ge_p2_dbl(t, s);
+    ge_p1p1_to_p2(s, t);
+    ge_p2_dbl(t, s);
+    ge_p1p1_to_p3(h, t); // *16
+  }
+  ge_cmov8_cached(c, pi, e[0]);
+  ge_add(t, h, c);
+  ge_p1p1_to_p3(h, t);
+}
+
+// h = e * p + f * q, constant time, sharing the doublings of both scalar multiplications
+void ge_double_scalarmult(GeP3& h, const signed char e[64], const GeP3& p, const signed char f[64], const GeP3& q) {
+  GeCached pi[8];
+  GeCached qi[8];
+  ge_precompute8(pi, p);
+  ge_precompute8(qi, q);
+
+  ge_p3_0(h);
+  GeCached c;
+  GeP1P1 t;
+  GeP2 s;
+  for (int i = 63; i != 0; i--) {
+    ge_cmov8_cached(c, pi, e[i]);
+    ge_add(t, h, c);
+    ge_p1p1_to_p3(h, t);
+    ge_cmov8_cached(c, qi, f[i]);
+    ge_add(t, h, c);
+    ge_p1p1_to_p2(s, t);
+    ge_p2_dbl(t, s);
+    ge_p1p1_to_p2(s, t);
+    ge_p2_dbl(t, s);
+    ge_p1p1_to_p2(s, t);
+    ge_p2_dbl(t, s);
+    ge_p1p1_to_p2(s, t);
+    ge_p2_dbl(t, s);
+    ge_p1p1_to_p3(h, t); // *16
+  }
+  ge_cmov8_cached(c, pi, e[0]);
+  ge_add(t, h, c);
+  ge_p1p1_to_p3(h, t);
+  ge_cmov8_cached(c, qi, f[0]);
+  ge_add(t, h, c);
+  ge_p1p1_to_p3(h, t);
+}
+
+// width 5 non adjacent form of a scalar: 256 digits, zero or odd in [-15, 15], variable time (from libsodium)
+void slide_vartime(signed char r[256], const uint8_t a[32]) {
+  for (int i = 0; i < 256; ++i)
+    r[i] = static_cast<signed char>(1 & (a[i >> 3] >> (i & 7)));
+  for (int i = 0; i < 256; ++i) {
+    if (!r[i])
+      continue;
+    for (int b = 1; b <= 6 && i + b < 256; ++b) {
+      if (!r[i + b])
+        continue;
+      int ribs = r[i + b] << b;
+      int cmp = r[i] + ribs;
+      if (cmp <= 15) {
+        r[i] = static_cast<signed char>(cmp);
+        r[i + b] = 0;
+      } else {
+        cmp = r[i] - ribs;
+        if (cmp < -15)
+          break;
+        r[i] = static_cast<signed char>(cmp);
+        for (int k = i + b; k < 256; ++k) {
+          if (!r[k]) {
+            r[k] = 1;
+            break;
+          }
+          r[k] = 0;
+        }
+      }
+    }
+  }
+}
+
+// pi[i] = (2i+1) * p
+void ge_precompute_odd8(GeCached pi[8], const GeP3& p) {
+  GeP1P1 t;
+  GeP3 p2, u;
+  ge_p3_dbl(t, p);
+  ge_p1p1_to_p3(p2, t);
+  GeCached c2;
+  ge_p3_to_cached(c2, p2);
+  ge_p3_to_cached(pi[0], p);
+  u = p;
+  for (int i = 1; i < 8; ++i) {
+    ge_add(t, u, c2);
+    ge_p1p1_to_p3(u, t);
+    ge_p3_to_cached(pi[i], u);
+  }
+}
+
+// width 5 NAF of a scalar, see slide_vartime
+void naf_vartime(signed char e[256], const uint8_t scalar[32]) {
+  uint8_t a[32];
+  memcpy(a, scalar, sizeof(a));
+  a[31] &= 127;
+  slide_vartime(e, a);
+}
+
+// t = t + d * p for a NAF digit d (with pi the odd multiples of p), variable time; h is scratch space
+inline void ge_add_digit_vartime(GeP1P1& t, GeP3& h, const GeCached pi[8], signed char d) {
+  if (d > 0) {
+    ge_p1p1_to_p3(h, t);
+    ge_add(t, h, pi[d / 2]);
+  } else if (d < 0) {
+    ge_p1p1_to_p3(h, t);
+    ge_sub(t, h, pi[-d / 2]);
+  }
+}
+
+// h = e * p for a width 5 NAF e, variable time (with the odd multiples p, 3p, ..., 15p)
+void ge_scalarmult_vartime(GeP3& h, const signed char e[256], const GeP3& p) {
+  ge_p3_0(h);
+  int i = 255;
+  while (i >= 0 && !e[i])
+    --i;
+  if (i < 0)
+    return;
+
+  GeCached pi[8];
+  ge_precompute_odd8(pi, p);
+  GeP1P1 t;
+  GeP2 r;
+  ge_p3_to_p2(r, h);
+  for (; i >= 0; --i) {
+    ge_p2_dbl(t, r);
+    ge_add_digit_vartime(t, h, pi, e[i]);
+    ge_p1p1_to_p2(r, t);
+  }
+  ge_p1p1_to_p3(h, t);
+}
+
+// h = e * p + f * q for width 5 NAFs e and f, variable time (Straus' method: both share the doublings), with pi and
+// qi the odd multiples of p and q
+void ge_double_scalarmult_vartime(GeP3& h, const signed char e[256], const GeCached pi[8], const signed char f[256], const GeCached qi[8]) {
+  ge_p3_0(h);
+  int i = 255;
+  while (i >= 0 && !e[i] && !f[i])
+    --i;
+  if (i < 0)
+    return;
+
+  GeP1P1 t;
+  GeP2 r;
+  ge_p3_to_p2(r, h);
+  for (; i >= 0; --i) {
+    ge_p2_dbl(t, r);
+    ge_add_digit_vartime(t, h, pi, e[i]);
+    ge_add_digit_vartime(t, h, qi, f[i]);
+    ge_p1p1_to_p2(r, t);
+  }
+  ge_p1p1_to_p3(h, t);
+}
+
+// h = e * p + f * q, variable time, see above
+void ge_double_scalarmult_vartime(GeP3& h, const signed char e[256], const GeP3& p, const signed char f[256], const GeP3& q) {
+  GeCached pi[8];
+  GeCached qi[8];
+  ge_precompute_odd8(pi, p);
+  ge_precompute_odd8(qi, q);
+  ge_double_scalarmult_vartime(h, e, pi, f, qi);
+}
+
+// h = sum scalars[i] * points[i], constant time (Straus' method with signed radix 16 digits, sharing the doublings)
+void ge_multi_scalarmult(GeP3& h, const Scalar* scalars, const GeP3* points, size_t n) {
+  std::vector<std::array<signed char, 64>> digits(n);
+  std::vector<std::array<GeCached, 8>> tables(n);
+  for (size_t j = 0; j < n; ++j) {
+    uint8_t a[32];
+    memcpy(a, scalars[j].value, sizeof(a));
+    a[31] &= 127;
+    slide16(digits[j].data(), a);
+    ge_precompute8(tables[j].data(), points[j]);
+  }
+  ge_p3_0(h);
+  GeCached c;
+  GeP1P1 t;
+  GeP2 s;
+  for (size_t i = 63; ; --i) {
+    for (size_t j = 0; j < n; ++j) {
+      ge_cmov8_cached(c, tables[j].data(), digits[j][i]);
+      ge_add(t, h, c);
+      ge_p1p1_to_p3(h, t);
+    }
+    if (i == 0)
+      break;
+    ge_p3_to_p2(s, h);
+    ge_p2_dbl(t, s);
+    ge_p1p1_to_p2(s, t);
+    ge_p2_dbl(t, s);
+    ge_p1p1_to_p2(s, t);
+    ge_p2_dbl(t, s);
+    ge_p1p1_to_p2(s, t);
+    ge_p2_dbl(t, s);
+    ge_p1p1_to_p3(h, t); // *16
+  }
+}
+
+// h = sum scalars[i] * points[i], variable time (Straus' method, with a width 5 NAF for every scalar)
+void ge_multi_scalarmult_straus_vartime(GeP3& h, const Scalar* scalars, const GeP3* points, size_t n) {
+  std::vector<std::array<signed char, 256>> digits(n);
+  std::vector<std::array<GeCached, 8>> tables(n);
+  int top = -1;
+  for (size_t j = 0; j < n; ++j) {
+    uint8_t a[32];
+    memcpy(a, scalars[j].value, sizeof(a));
+    a[31] &= 127;
+    slide_vartime(digits[j].data(), a);
+    ge_precompute_odd8(tables[j].data(), points[j]);
+    for (int i = 255; i > top; --i) {
+      if (digits[j][static_cast<size_t>(i)]) {
+        top = i;
+        break;
+      }
+    }
+  }
+  ge_p3_0(h);
+  if (top < 0)
+    return;
+  GeP1P1 t;
+  GeP2 r;
+  ge_p3_to_p2(r, h);
+  for (int i = top; i >= 0; --i) {
+    ge_p2_dbl(t, r);
+    for (size_t j = 0; j < n; ++j) {
+      signed char d = digits[j][static_cast<size_t>(i)];
+      if (d > 0) {
+        ge_p1p1_to_p3(h, t);
+        ge_add(t, h, tables[j][static_cast<size_t>(d / 2)]);
+      } else if (d < 0) {
+        ge_p1p1_to_p3(h, t);
+        ge_sub(t, h, tables[j][static_cast<size_t>(-d / 2)]);
+      }
+    }
+    ge_p1p1_to_p2(r, t);
+  }
+  ge_p1p1_to_p3(h, t);
+}
+
+// signed radix 2^w digits of a scalar (a[31] <= 127): count = ceil(256 / w) digits in [-2^(w-1), 2^(w-1)]
+void radix_2w(int16_t* digits, size_t count, const uint8_t a[32], unsigned int w) {
+  uint64_t limbs[4];
+  for (size_t i = 0; i < 4; ++i) {
+    limbs[i] = 0;
+    for (size_t b = 0; b < 8; ++b)
+      limbs[i] |= uint64_t(a[8 * i + b]) << (8 * b);
+  }
+  const uint64_t radix = uint64_t(1) << w;
+  const uint64_t mask = radix - 1;
+  int64_t carry = 0;
+  for (size_t i = 0; i < count; ++i) {
+    size_t bit = i * w;
+    size_t limb = bit / 64;
+    size_t offset = bit % 64;
+    uint64_t bits = limb < 4 ? limbs[limb] >> offset : 0;
+    if (offset + w > 64 && limb + 1 < 4)
+      bits |= limbs[limb + 1] << (64 - offset);
+    int64_t coefficient = carry + static_cast<int64_t>(bits & mask);
+    carry = (coefficient + static_cast<int64_t>(radix / 2)) >> w;
+    digits[i] = static_cast<int16_t>(coefficient - carry * static_cast<int64_t>(radix));
+  }
+  // a[31] <= 127 makes sure the last digit stays within 2^(w-1)
+  digits[count - 1] = static_cast<int16_t>(digits[count - 1] + carry * static_cast<int64_t>(radix));
+}
+
+// h = sum scalars[i] * points[i], variable time (Pippenger's bucket method), for a large number of points
+void ge_multi_scalarmult_pippenger_vartime(GeP3& h, const Scalar* scalars, const GeP3* points, size_t n) {
+  const unsigned int w = n < 500 ? 6 : n < 800 ? 7 : 8;
+  const size_t digitCount = (256 + w - 1) / w;
+  const size_t bucketCount = size_t(1) << (w - 1);
+  std::vector<int16_t> digits(n * digitCount);
+  std::vector<GeCached> cached(n);
+  for (size_t j = 0; j < n; ++j) {
+    uint8_t a[32];
+    memcpy(a, scalars[j].value, sizeof(a));
+    a[31] &= 127;
+    radix_2w(&digits[j * digitCount], digitCount, a, w);
+    ge_p3_to_cached(cached[j], points[j]);
+  }
+
+  std::vector<GeP3> buckets(bucketCount);
+  GeP1P1 t;
+  GeP2 s;
+  GeCached c;
+  ge_p3_0(h);
+  for (size_t d = digitCount; d-- > 0;) {
+    if (d != digitCount - 1) {
+      // h = 2^w * h
+      ge_p3_to_p2(s, h);
+      for (unsigned int i = 0; i < w; ++i) {
+        ge_p2_dbl(t, s);
+        ge_p1p1_to_p2(s, t);
+      }
+      ge_p1p1_to_p3(h, t);
+    }
+    for (auto& bucket : buckets)
+      ge_p3_0(bucket);
+    for (size_t j = 0; j < n; ++j) {
+      int16_t digit = digits[j * digitCount + d];
+      if (digit > 0) {
+        GeP3& bucket = buckets[static_cast<size_t>(digit - 1)];
+        ge_add(t, bucket, cached[j]);
+        ge_p1p1_to_p3(bucket, t);
+      } else if (digit < 0) {
+        GeP3& bucket = buckets[static_cast<size_t>(-digit - 1)];
+        ge_sub(t, bucket, cached[j]);
+        ge_p1p1_to_p3(bucket, t);
+      }
+    }
+    // sum of (b+1) * buckets[b], as a sum of running sums
+    GeP3 running = buckets[bucketCount - 1];
+    GeP3 sum = running;
+    for (size_t b = bucketCount - 1; b-- > 0;) {
+      ge_p3_to_cached(c, buckets[b]);
+      ge_add(t, running, c);
+      ge_p1p1_to_p3(running, t);
+      ge_p3_to_cached(c, running);
+      ge_add(t, sum, c);
+      ge_p1p1_to_p3(sum, t);
+    }
+    ge_p3_to_cached(c, sum);
+    ge_add(t, h, c);
+    ge_p1p1_to_p3(h, t);
+  }
+}
+
+// above this number of points Pippenger's method is faster than Straus'
+const size_t PIPPENGER_THRESHOLD = 190;
+
+void ge_multi_scalarmult_vartime(GeP3& h, const Scalar* scalars, const GeP3* points, size_t n) {
+  if (n < PIPPENGER_THRESHOLD)
+    ge_multi_scalarmult_straus_vartime(h, scalars, points, n);
+  else
+    ge_multi_scalarmult_pippenger_vartime(h, scalars, points, n);
+}
+
+// table[i][j] = (j+1) * 256^i * P, in affine coordinates
+struct FixedBaseTable {
+  GePrecomp table[32][8];
+
+  explicit FixedBaseTable(const GeP3& p) {
+    // compute all multiples in extended coordinates, and normalise them with a single inversion
+    GeP3 points[32][8];
+    GeP3 base = p;
+    GeP1P1 t;
+    for (int i = 0; i < 32; ++i) {
+      GeCached cached;
+      ge_p3_to_cached(cached, base);
+      points[i][0] = base;
+      for (int j = 1; j < 8; ++j) {
+        ge_add(t, points[i][j - 1], cached);
+        ge_p1p1_to_p3(points[i][j], t);
+      }
+      // base = 256 * base
+      for (int k = 0; k < 8; ++k) {
+        ge_p3_dbl(t, base);
+        ge_p1p1_to_p3(base, t);
+      }
+    }
+    // Montgomery's trick: one inversion for all Z coordinates
+    fe acc = fe_one;
+    fe partial[32][8];
+    for (int i = 0; i < 32; ++i) {
+      for (int j = 0; j < 8; ++j) {
+        partial[i][j] = acc;
+        fe_mul(acc, acc, points[i][j].Z);
+      }
+    }
+    fe inv;
+    fe_invert(inv, acc);
+    for (int i = 31; i >= 0; --i) {
+      for (int j = 7; j >= 0; --j) {
+        fe zinv, x, y, xy;
+        fe_mul(zinv, inv, partial[i][j]);
+        fe_mul(inv, inv, points[i][j].Z);
+        fe_mul(x, points[i][j].X, zinv);
+        fe_mul(y, points[i][j].Y, zinv);
+        GePrecomp& out = table[i][j];
+        fe_add(out.yplusx, y, x);
+        fe_sub(out.yminusx, y, x);
+        fe_mul(xy, x, y);
+        fe_mul(out.xy2d, xy, fe_d2);
+      }
+    }
+  }
+
+  // h = h + b * 256^(i / 2) * P for digit i of the scalar (odd digits are multiplied by 16 afterwards), variable
+  // time: the multiple is looked up instead of selected in constant time, and zero digits are skipped
+  void madd_vartime(GeP3& h, int i, signed char b) const {
+    if (b == 0)
+      return;
+    const GePrecomp& t = table[i / 2][(b > 0 ? b : -b) - 1];
+    GeP1P1 r;
+    if (b > 0) {
+      ge_madd(r, h, t);
+    } else {
+      GePrecomp minust;
+      minust.yplusx = t.yminusx;
+      minust.yminusx = t.yplusx;
+      fe_neg(minust.xy2d, t.xy2d);
+      ge_madd(r, h, minust);
+    }
+    ge_p1p1_to_p3(h, r);
+  }
+
+  // h = a * P, variable time
+  void mult_vartime(GeP3& h, const uint8_t scalar[32]) const {
+    uint8_t a[32];
+    memcpy(a, scalar, sizeof(a));
+    a[31] &= 127;
+    signed char e[64];
+    slide16(e, a);
+
+    ge_p3_0(h);
+    for (int i = 1; i < 64; i += 2)
+      madd_vartime(h, i, e[i]);
+    GeP1P1 r;
+    GeP2 s;
+    ge_p3_dbl(r, h);
+    ge_p1p1_to_p2(s, r);
+    ge_p2_dbl(r, s);
+    ge_p1p1_to_p2(s, r);
+    ge_p2_dbl(r, s);
+    ge_p1p1_to_p2(s, r);
+    ge_p2_dbl(r, s);
+    ge_p1p1_to_p3(h, r); // *16
+    for (int i = 0; i < 64; i += 2)
+      madd_vartime(h, i, e[i]);
+  }
+
+  // h = a * P, constant time
+  void mult(GeP3& h, const uint8_t scalar[32]) const {
+    uint8_t a[32];
+    memcpy(a, scalar, sizeof(a));
+    a[31] &= 127;
+    signed char e[64];
+    slide16(e, a);
+
+    GePrecomp t;
+    GeP1P1 r;
+    GeP2 s;
+    ge_p3_0(h);
+    for (int i = 1; i < 64; i += 2) {
+      ge_cmov8_precomp(t, table[i / 2], e[i]);
+      ge_madd(r, h, t);
+      ge_p1p1_to_p3(h, r);
+    }
+    ge_p3_dbl(r, h);
+    ge_p1p1_to_p2(s, r);
+    ge_p2_dbl(r, s);
+    ge_p1p1_to_p2(s, r);
+    ge_p2_dbl(r, s);
+    ge_p1p1_to_p2(s, r);
+    ge_p2_dbl(r, s);
+    ge_p1p1_to_p3(h, r); // *16
+    for (int i = 0; i < 64; i += 2) {
+      ge_cmov8_precomp(t, table[i / 2], e[i]);
+      ge_madd(r, h, t);
+      ge_p1p1_to_p3(h, r);
+    }
+  }
+};
+
+// ed25519 base point, which is also the ristretto generator
+const GeP3& ge_base() {
+  static const GeP3 base = [] {
+    GeP3 b;
+    b.X = {{0x62d608f25d51a, 0x412a4b4f6592a, 0x75b7171a4b31d, 0x1ff60527118fe, 0x216936d3cd6e5}};
+    b.Y = {{0x6666666666658, 0x4cccccccccccc, 0x1999999999999, 0x3333333333333, 0x6666666666666}};
+    b.Z = fe_one;
+    b.T = {{0x68ab3a5b7dda3, 0xeea2a5eadbb, 0x2af8df483c27e, 0x332b375274732, 0x67875f0fd78b7}};
+    return b;
+  }();
+  return base;
+}
+
+const FixedBaseTable& ge_base_table() {
+  static const FixedBaseTable table(ge_base());
+  return table;
+}
+
+// G, 3G, ..., 15G
+const std::array<GeCached, 8>& ge_base_odd8() {
+  static const std::array<GeCached, 8> table = [] {
+    std::array<GeCached, 8> retval;
+    ge_precompute_odd8(retval.data(), ge_base());
+    return retval;
+  }();
+  return table;
+}
+
+// h = e * G + f * q, variable time, with the precomputed odd multiples of G
+void ge_double_scalarmult_base_vartime(GeP3& h, const signed char e[256], const signed char f[256], const GeP3& q) {
+  GeCached qi[8];
+  ge_precompute_odd8(qi, q);
+  ge_double_scalarmult_vartime(h, e, ge_base_odd8().data(), f, qi);
+}
+
+const CurveBackendOperations libsodiumOperations = {ge_scalarmult, ge_double_scalarmult, ge_scalarmult_vartime, ge_double_scalarmult_vartime, ge_double_scalarmult_base_vartime};
+
+bool ristretto_is_canonical(const uint8_t s[32]) {
+  unsigned char c = (s[31] & 0x7f) ^ 0x7f;
+  for (int i = 30; i > 0; i--)
+    c |= s[i] ^ 0xff;
+  c = static_cast<unsigned char>((static_cast<unsigned int>(c) - 1U) >> 8);
+  unsigned char d = static_cast<unsigned char>((0xed - 1U - static_cast<unsigned int>(s[0])) >> 8);
+  unsigned char e = s[31] >> 7;
+  return 0 == (((c & d) | e | (s[0] & 1)) & 1);
+}
+
+bool ristretto_frombytes(GeP3& h, const uint8_t s[32]) {
+  if (!ristretto_is_canonical(s))
+    return false;
+  fe inv_sqrt, one, s_, ss, u1, u2, u1u1, u2u2, v, v_u2u2;
+  fe_frombytes(s_, s);
+  fe_sq(ss, s_); // ss = s^2
+
+  u1 = fe_one;
+  fe_sub(u1, u1, ss); // u1 = 1-ss
+  fe_sq(u1u1, u1); // u1u1 = u1^2
+
+  u2 = fe_one;
+  fe_add(u2, u2, ss); // u2 = 1+ss
+  fe_sq(u2u2, u2); // u2u2 = u2^2
+
+  fe_mul(v, fe_d, u1u1); // v = d*u1^2
+  fe_neg(v, v); // v = -d*u1^2
+  fe_sub(v, v, u2u2); // v = -(d*u1^2)-u2^2
+
+  fe_mul(v_u2u2, v, u2u2); // v_u2u2 = v*u2^2
+
+  one = fe_one;
+  int was_square = fe_sqrt_ratio_m1(inv_sqrt, one, v_u2u2);
+  fe den_x, den_y;
+  fe_mul(den_x, inv_sqrt, u2);
+  fe_mul(den_y, inv_sqrt, den_x);
+  fe_mul(den_y, den_y, v);
+
+  fe_mul(h.X, s_, den_x);
+  fe_add(h.X, h.X, h.X);
+  fe_abs(h.X, h.X);
+  fe_mul(h.Y, u1, den_y);
+  h.Z = fe_one;
+  fe_mul(h.T, h.X, h.Y);
+
+  return was_square && !fe_isnegative(h.T) && !fe_iszero(h.Y);
+}
+
+void ristretto_p3_tobytes(uint8_t s[32], const GeP3& h) {
+  fe den1, den2, den_inv, eden, inv_sqrt, ix, iy, one, s_, t_z_inv, u1, u2, u1_u2u2, x_, y_, x_z_inv, z_inv, zmy;
+  int rotate;
+
+  fe_add(u1, h.Z, h.Y); // u1 = Z+Y
+  fe_sub(zmy, h.Z, h.Y); // zmy = Z-Y
+  fe_mul(u1, u1, zmy); // u1 = (Z+Y)*(Z-Y)
+  fe_mul(u2, h.X, h.Y); // u2 = X*Y
+
+  fe_sq(u1_u2u2, u2); // u1_u2u2 = u2^2
+  fe_mul(u1_u2u2, u1, u1_u2u2); // u1_u2u2 = u1*u2^2
+
+  one = fe_one;
+  (void)fe_sqrt_ratio_m1(inv_sqrt, one, u1_u2u2);
+  fe_mul(den1, inv_sqrt, u1); // den1 = inv_sqrt*u1
+  fe_mul(den2, inv_sqrt, u2); // den2 = inv_sqrt*u2
+  fe_mul(z_inv, den1, den2); // z_inv = den1*den2
+  fe_mul(z_inv, z_inv, h.T); // z_inv = den1*den2*T
+
+  fe_mul(ix, h.X, fe_sqrtm1); // ix = X*sqrt(-1)
+  fe_mul(iy, h.Y, fe_sqrtm1); // iy = Y*sqrt(-1)
+  fe_mul(eden, den1, fe_invsqrtamd); // eden = den1/sqrt(a-d)
+
+  fe_mul(t_z_inv, h.T, z_inv); // t_z_inv = T*z_inv
+  rotate = fe_isnegative(t_z_inv);
+
+  x_ = h.X;
+  y_ = h.Y;
+  den_inv = den2;
+
+  fe_cmov(x_, iy, unsigned(rotate));
+  fe_cmov(y_, ix, unsigned(rotate));
+  fe_cmov(den_inv, eden, unsigned(rotate));
+
+  fe_mul(x_z_inv, x_, z_inv);
+  fe_cneg(y_, y_, unsigned(fe_isnegative(x_z_inv)));
+
+  fe_sub(s_, h.Z, y_);
+  fe_mul(s_, den_inv, s_);
+  fe_abs(s_, s_);
+  fe_tobytes(s, s_);
+}
+
+// s[i] = encoding of 2 * p[i]. For a doubled point the inverse square root of the encoding can be computed
+// from the coordinates of p[i] with an ordinary inversion, so all points share one inversion (Montgomery's
+// trick). Follows double_and_compress_batch() of curve25519-dalek.
+void ristretto_double_tobytes_batch(GroupElement* out, const GeP3* points, size_t n) {
+  struct State {
+    fe e, f, g, h, eg, fh;
+  };
+  std::vector<State> states(n);
+  std::vector<fe> inverses(n);
+  std::vector<fe> prefix(n);
+  std::vector<unsigned int> zero(n);
+  fe acc = fe_one;
+  for (size_t i = 0; i < n; ++i) {
+    const GeP3& p = points[i];
+    State& st = states[i];
+    fe xx, yy, zz, dtt, y2, efgh;
+    fe_sq(xx, p.X);
+    fe_sq(yy, p.Y);
+    fe_sq(zz, p.Z);
+    fe_sq(dtt, p.T);
+    fe_mul(dtt, dtt, fe_d);
+    fe_add(y2, p.Y, p.Y);
+    fe_mul(st.e, p.X, y2); // e = 2*X*Y
+    fe_add(st.f, zz, dtt); // f = Z^2 + d*T^2
+    fe_add(st.g, yy, xx); // g = Y^2 - a*X^2
+    fe_sub(st.h, zz, dtt); // h = Z^2 - d*T^2
+    fe_mul(st.eg, st.e, st.g);
+    fe_mul(st.fh, st.f, st.h);
+    fe_mul(efgh, st.eg, st.fh);
+    // efgh is zero iff 2 * p is the identity (encoded as zero); invert 1 instead, and zero the inverse afterwards
+    zero[i] = unsigned(fe_iszero(efgh));
+    fe_cmov(efgh, fe_one, zero[i]);
+    inverses[i] = efgh;
+    prefix[i] = acc;
+    fe_mul(acc, acc, efgh);
+  }
+  fe inv;
+  fe_invert(inv, acc);
+  for (size_t i = n; i-- > 0;) {
+    fe current;
+    fe_mul(current, inv, prefix[i]);
+    fe_mul(inv, inv, inverses[i]);
+    inverses[i] = current;
+    fe_cmov(inverses[i], fe_zero, zero[i]);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    const State& st = states[i];
+    fe z_inv, t_inv, t, minus_e, f_sqrta, r;
+    fe_mul(z_inv, st.eg, inverses[i]);
+    fe_mul(t_inv, st.fh, inverses[i]);
+    fe magic = fe_invsqrtamd;
+    fe e = st.e;
+    fe g = st.g;
+    fe h = st.h;
+    fe_mul(t, st.eg, z_inv);
+    unsigned int negcheck1 = unsigned(fe_isnegative(t));
+    fe_neg(minus_e, st.e);
+    fe_mul(f_sqrta, st.f, fe_sqrtm1);
+    fe_cmov(e, st.g, negcheck1);
+    fe_cmov(g, minus_e, negcheck1);
+    fe_cmov(h, f_sqrta, negcheck1);
+    fe_cmov(magic, fe_sqrtm1, negcheck1);
+    fe_mul(t, h, e);
+    fe_mul(t, t, z_inv);
+    fe_cneg(g, g, unsigned(fe_isnegative(t)));
+    // s = (h - g) * magic * g / eg (or fh)
+    fe_mul(r, g, t_inv);
+    fe_mul(r, magic, r);
+    fe_sub(t, h, g);
+    fe_mul(r, t, r);
+    fe_abs(r, r);
+    fe_tobytes(out[i].value, r);
+  }
+}
+
+void ristretto_elligator(GeP3& p, const fe& t) {
+  fe c, n, one, r, rpd, s, s_prime, ss, u, v, w0, w1, w2, w3;
+  int wasnt_square;
+
+  one = fe_one;
+  fe_sq(r, t); // r = t^2
+  fe_mul(r, fe_sqrtm1, r); // r = sqrt(-1)*t^2
+  fe_add(u, r, one); // u = r+1
+  fe_mul(u, u, fe_onemsqd); // u = (r+1)*(1-d^2)
+  fe_neg(c, one); // c = -1
+  fe_add(rpd, r, fe_d); // rpd = r+d
+  fe_mul(v, r, fe_d); // v = r*d
+  fe_sub(v, c, v); // v = c-r*d
+  fe_mul(v, v, rpd); // v = (c-r*d)*(r+d)
+
+  wasnt_square = 1 - fe_sqrt_ratio_m1(s, u, v);
+  fe_mul(s_prime, s, t);
+  fe_abs(s_prime, s_prime);
+  fe_neg(s_prime, s_prime); // s_prime = -|s*t|
+  fe_cmov(s, s_prime, unsigned(wasnt_square));
+  fe_cmov(c, r, unsigned(wasnt_square));
+
+  fe_sub(n, r, one); // n = r-1
+  fe_mul(n, n, c); // n = c*(r-1)
+  fe_mul(n, n, fe_sqdmone); // n = c*(r-1)*(d-1)^2
+  fe_sub(n, n, v); // n = c*(r-1)*(d-1)^2-v
+
+  fe_add(w0, s, s); // w0 = 2s
+  fe_mul(w0, w0, v); // w0 = 2s*v
+  fe_mul(w1, n, fe_sqrtadm1); // w1 = n*sqrt(ad-1)
+  fe_sq(ss, s); // ss = s^2
+  fe_sub(w2, one, ss); // w2 = 1-s^2
+  fe_add(w3, one, ss); // w3 = 1+s^2
+
+  fe_mul(p.X, w0, w3);
+  fe_mul(p.Y, w2, w1);
+  fe_mul(p.Z, w1, w3);
+  fe_mul(p.T, w0, w2);
+}
+
+}
+
+DecodedGroupElement::DecodedGroupElement() {
+  ge_p3_0(*this);
+}
+
+DecodedGroupElement::DecodedGroupElement(const GroupElement& encoded) {
+  Count(Counter::Decodings);
+  if (!ristretto_frombytes(*this, encoded.value))
+    throw std::invalid_argument("DecodedGroupElement got an invalid GroupElement");
+}
+
+std::optional<DecodedGroupElement> DecodedGroupElement::Decode(const GroupElement& encoded) {
+  Count(Counter::Decodings);
+  DecodedGroupElement r;
+  if (!ristretto_frombytes(r, encoded.value))
+    return {};
+  return r;
+}
+
+GroupElement DecodedGroupElement::encode() const {
+  Count(Counter::Encodings);
+  GroupElement r;
+  ristretto_p3_tobytes(r.value, *this);
+  return r;
+}
+
+bool DecodedGroupElement::is_zero() const {
+  // the identity is represented by the points (0, 1), (0, -1), (i, 0), and (-i, 0)
+  return fe_iszero(X) | fe_iszero(Y);
+}
+
+std::string DecodedGroupElement::hex() const {
+  return encode().hex();
+}
+
+DecodedGroupElement DecodedGroupElement::FromHex(std::string_view view) {
+  return DecodedGroupElement(GroupElement::FromHex(view));
+}
+
+DecodedGroupElement DecodedGroupElement::Random() {
+  uint8_t hash[64];
+  RandomBytes(hash);
+  return FromHash(hash);
+}
+
+DecodedGroupElement DecodedGroupElement::FromHash(uint8_t (&value)[64]) {
+  fe r0, r1;
+  fe_frombytes(r0, value);
+  fe_frombytes(r1, value + 32);
+  GeP3 p0, p1;
+  ristretto_elligator(p0, r0);
+  ristretto_elligator(p1, r1);
+  GeCached p1_cached;
+  ge_p3_to_cached(p1_cached, p1);
+  GeP1P1 t;
+  ge_add(t, p0, p1_cached);
+  DecodedGroupElement r;
+  ge_p1p1_to_p3(r, t);
+  return r;
+}
+
+DecodedGroupElement DecodedGroupElement::MultBase(const Scalar& s) {
+  Count(Counter::FixedBaseMultiplications);
+  DecodedGroupElement r;
+  ge_base_table().mult(r, s.value);
+  if (r.is_zero())
+    throw std::invalid_argument("base of scalar gave error (probably scalar is 0)");
+  return r;
+}
+
+DecodedGroupElement DecodedGroupElement::MultBaseVartime(const Scalar& s) {
+  Count(Counter::FixedBaseMultiplications);
+  DecodedGroupElement r;
+  ge_base_table().mult_vartime(r, s.value);
+  return r;
+}
+
+struct PreparedGroupElement::Table : FixedBaseTable {
+  using FixedBaseTable::FixedBaseTable;
+};
+
+PreparedGroupElement::PreparedGroupElement(const GroupElement& P) : PreparedGroupElement(DecodedGroupElement(P)) {
+}
+
+PreparedGroupElement::PreparedGroupElement(const DecodedGroupElement& P) : _encoded(P.encode()), _decoded(P), table(std::make_shared<const Table>(P)) {
+}
+
+namespace libpep {
+
+bool operator==(const DecodedGroupElement& lhs, const DecodedGroupElement& rhs) {
+  // equal encodings without encoding (RFC 9496): X1 * Y2 == Y1 * X2 or Y1 * Y2 == X1 * X2
+  fe a, b, c, d;
+  fe_mul(a, lhs.X, rhs.Y);
+  fe_mul(b, lhs.Y, rhs.X);
+  fe_mul(c, lhs.Y, rhs.Y);
+  fe_mul(d, lhs.X, rhs.X);
+  fe_sub(a, a, b);
+  fe_sub(c, c, d);
+  return fe_iszero(a) | fe_iszero(c);
+}
+
+bool operator!=(const DecodedGroupElement& lhs, const DecodedGroupElement& rhs) {
+  return !operator==(lhs, rhs);
+}
+
+DecodedGroupElement operator+(const DecodedGroupElement& lhs, const DecodedGroupElement& rhs) {
+  GeCached q;
+  ge_p3_to_cached(q, rhs);
+  GeP1P1 t;
+  ge_add(t, lhs, q);
+  DecodedGroupElement r;
+  ge_p1p1_to_p3(r, t);
+  return r;
+}
+
+DecodedGroupElement operator-(const DecodedGroupElement& lhs, const DecodedGroupElement& rhs) {
+  GeCached q;
+  ge_p3_to_cached(q, rhs);
+  GeP1P1 t;
+  ge_sub(t, lhs, q);
+  DecodedGroupElement r;
+  ge_p1p1_to_p3(r, t);
+  return r;
+}
+
+DecodedGroupElement operator-(const DecodedGroupElement& rhs) {
+  DecodedGroupElement r = rhs;
+  fe_neg(r.X, rhs.X);
+  fe_neg(r.T, rhs.T);
+  return r;
+}
+
+DecodedGroupElement operator*(const Scalar& lhs, const DecodedGroupElement& rhs) {
+  Count(Counter::ScalarMultiplications);
+  signed char e[64];
+  recode16(e, lhs.value);
+  DecodedGroupElement r;
+  ActiveCurveOperations().scalarmult(r, e, rhs);
+  if (r.is_zero())
+    throw std::invalid_argument("Scalar*GroupElement gave error (one of them is 0)");
+  return r;
+}
+
+DecodedGroupElement ScalarMulVartime(const Scalar& s, const DecodedGroupElement& P) {
+  Count(Counter::ScalarMultiplications);
+  signed char e[256];
+  naf_vartime(e, s.value);
+  DecodedGroupElement r;
+  ActiveCurveOperations().scalarmult_vartime(r, e, P);
+  return r;
+}
+
+DecodedGroupElement operator/(const DecodedGroupElement& lhs, const Scalar& rhs) {
+  return rhs.invert() * lhs;
+}
+
+void DoubleAndEncodeBatch(std::span<const DecodedGroupElement> in, std::span<GroupElement> out) {
+  if (in.size() != out.size())
+    throw std::invalid_argument("DoubleAndEncodeBatch expected output of the same size as the input");
+  Count(Counter::Encodings, in.size());
+  ristretto_double_tobytes_batch(out.data(), in.data(), in.size());
+}
+
+DecodedGroupElement MultiScalarMul(std::span<const Scalar> scalars, std::span<const DecodedGroupElement> points) {
+  if (scalars.size() != points.size())
+    throw std::invalid_argument("MultiScalarMul expects the same number of scalars and points");
+  Count(Counter::MultiScalarMultiplications);
+  Count(Counter::MultiScalarMultiplicationTerms, scalars.size());
+  DecodedGroupElement r;
+  ge_multi_scalarmult(r, scalars.data(), points.data(), scalars.size());
+  return r;
+}
+
+DecodedGroupElement MultiScalarMulVartime(std::span<const Scalar> scalars, std::span<const DecodedGroupElement> points) {
+  if (scalars.size() != points.size())
+    throw std::invalid_argument("MultiScalarMulVartime expects the same number of scalars and points");
+  Count(Counter::MultiScalarMultiplications);
+  Count(Counter::MultiScalarMultiplicationTerms, scalars.size());
+  DecodedGroupElement r;
+  ge_multi_scalarmult_vartime(r, scalars.data(), points.data(), scalars.size());
+  return r;
+}
+
+GroupElement MultiScalarMul(std::span<const Scalar> scalars, std::span<const GroupElement> points) {
+  std::vector<DecodedGroupElement> decoded(points.begin(), points.end());
+  return MultiScalarMul(scalars, decoded).encode();
+}
+
+GroupElement MultiScalarMulVartime(std::span<const Scalar> scalars, std::span<const GroupElement> points) {
+  std::vector<DecodedGroupElement> decoded(points.begin(), points.end());
+  return MultiScalarMulVartime(scalars, decoded).encode();
+}
+
+DecodedGroupElement operator*(const Scalar& lhs, const PreparedGroupElement& rhs) {
+  Count(Counter::FixedBaseMultiplications);
+  DecodedGroupElement r;
+  rhs.table->mult(r, lhs.value);
+  if (r.is_zero())
+    throw std::invalid_argument("Scalar*GroupElement gave error (one of them is 0)");
+  return r;
+}
+
+DecodedGroupElement DoubleScalarMulVartime(const Scalar& a, const DecodedGroupElement& P, const Scalar& b, const DecodedGroupElement& Q) {
+  Count(Counter::ScalarMultiplications, 2);
+  signed char e[256];
+  signed char f[256];
+  naf_vartime(e, a.value);
+  naf_vartime(f, b.value);
+  DecodedGroupElement r;
+  ActiveCurveOperations().double_scalarmult_vartime(r, e, P, f, Q);
+  return r;
+}
+
+DecodedGroupElement DoubleScalarMulVartime(const Scalar& a, const _G&, const Scalar& b, const DecodedGroupElement& Q) {
+  Count(Counter::FixedBaseMultiplications);
+  Count(Counter::ScalarMultiplications);
+  signed char e[256];
+  signed char f[256];
+  naf_vartime(e, a.value);
+  naf_vartime(f, b.value);
+  DecodedGroupElement r;
+  ActiveCurveOperations().double_scalarmult_base_vartime(r, e, f, Q);
+  return r;
+}
+
+DecodedGroupElement DoubleScalarMul(const Scalar& a, const DecodedGroupElement& P, const Scalar& b, const DecodedGroupElement& Q) {
+  Count(Counter::ScalarMultiplications, 2);
+  signed char e[64];
+  signed char f[64];
+  recode16(e, a.value);
+  recode16(f, b.value);
+  DecodedGroupElement r;
+  ActiveCurveOperations().double_scalarmult(r, e, P, f, Q);
+  return r;
+}
+
+}
+
+const CurveBackendOperations* libpep::LibsodiumCurveOperations() {
+  return &libsodiumOperations;
+}
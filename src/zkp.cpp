@@ -19,15 +19,361 @@ along with Bit Powder Libraries.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "zkp.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "metrics.h"
+
 using namespace libpep;
 
+namespace {
+
+// proof with its group elements decoded and its challenge computed, ready to be verified in a batch
+struct DecodedProof {
+  const DecodedGroupElement* A; // shared between proofs with the same A (e.g. the same factor used for a whole batch)
+  DecodedGroupElement M;
+  DecodedGroupElement N;
+  DecodedGroupElement C1;
+  DecodedGroupElement C2;
+  Scalar e;
+  Scalar s;
+};
+
+std::optional<DecodedProof> DecodeProof(const GroupElement& A, const DecodedGroupElement* dA, const GroupElement& M, const Proof& p) {
+  // zero A, M or N never verify, as in VerifyProof
+  if (!dA || !p.s.is_valid() || A.is_zero() || M.is_zero() || p.N.is_zero())
+    return {};
+  // decoding checks validity of the group elements
+  auto dM = DecodedGroupElement::Decode(M);
+  auto dN = DecodedGroupElement::Decode(p.N);
+  auto dC1 = DecodedGroupElement::Decode(p.C1);
+  auto dC2 = DecodedGroupElement::Decode(p.C2);
+  if (!dM || !dN || !dC1 || !dC2)
+    return {};
+  HashSHA512 hash;
+  SHA512(hash,
+      A.raw(),
+      M.raw(),
+      p.N.raw(),
+      p.C1.raw(),
+      p.C2.raw());
+  return DecodedProof{dA, *dM, *dN, *dC1, *dC2, Scalar::FromHash(hash), p.s};
+}
+
+const Scalar& One() {
+  static const Scalar one = Scalar::FromHex("0100000000000000000000000000000000000000000000000000000000000000");
+  return one;
+}
+
+const DecodedGroupElement& Generator() {
+  static const DecodedGroupElement g = DecodedGroupElement::MultBase(One());
+  return g;
+}
+
+// MultiScalarMulVartime, split in parts over the executor, each large enough for Pippenger's method to pay off
+DecodedGroupElement MultiScalarMulParallel(std::span<const Scalar> scalars, std::span<const DecodedGroupElement> points, Executor& executor) {
+  const size_t MIN_TERMS = 512;
+  size_t parts = std::min(executor.concurrency(), scalars.size() / MIN_TERMS);
+  if (parts <= 1)
+    return MultiScalarMulVartime(scalars, points);
+  size_t perPart = (scalars.size() + parts - 1) / parts;
+  std::vector<DecodedGroupElement> partial(parts);
+  executor.run(parts, [&](size_t i) {
+    size_t begin = i * perPart;
+    size_t count = std::min(scalars.size(), begin + perPart) - begin;
+    partial[i] = MultiScalarMulVartime(scalars.subspan(begin, count), points.subspan(begin, count));
+  });
+  DecodedGroupElement sum;
+  for (const auto& x : partial)
+    sum = sum + x;
+  return sum;
+}
+
+// Checks s*G = e*A + C1 and s*M = e*N + C2 for all proofs at once, by checking that
+// sum_i w_i * (s_i*G - e_i*A_i - C1_i) + v_i * (s_i*M_i - e_i*N_i - C2_i) = 0 for random weights w_i and v_i.
+bool VerifyCombined(std::span<const DecodedProof* const> proofs, Executor& executor) {
+  std::vector<Scalar> scalars;
+  std::vector<DecodedGroupElement> points;
+  scalars.reserve(1 + 5 * proofs.size());
+  points.reserve(1 + 5 * proofs.size());
+  Scalar sG;
+  // position in scalars/points of every distinct A, so equal A's are only added once to the multiplication
+  std::unordered_map<const DecodedGroupElement*, size_t> positionOfA;
+  std::vector<Scalar> weights(2 * proofs.size());
+  Scalar::RandomBatch(weights);
+  for (size_t i = 0; i < proofs.size(); ++i) {
+    const DecodedProof* p = proofs[i];
+    const Scalar& w = weights[2 * i];
+    const Scalar& v = weights[2 * i + 1];
+    sG = sG + w * p->s;
+    auto [it, inserted] = positionOfA.try_emplace(p->A, scalars.size());
+    if (inserted) {
+      scalars.push_back(-(w * p->e));
+      points.push_back(*p->A);
+    } else {
+      scalars[it->second] = scalars[it->second] - w * p->e;
+    }
+    scalars.push_back(-w);
+    points.push_back(p->C1);
+    scalars.push_back(v * p->s);
+    points.push_back(p->M);
+    scalars.push_back(-(v * p->e));
+    points.push_back(p->N);
+    scalars.push_back(-v);
+    points.push_back(p->C2);
+  }
+  scalars.push_back(sG);
+  points.push_back(Generator());
+  return MultiScalarMulParallel(scalars, points, executor).is_zero();
+}
+
+// marks the proofs valid if the combined check succeeds, otherwise splits the range in two
+void VerifyBisect(std::span<const DecodedProof* const> proofs, std::span<const size_t> indices, std::vector<bool>& result, Executor& executor) {
+  if (proofs.empty())
+    return;
+  if (VerifyCombined(proofs, executor)) {
+    for (size_t i : indices)
+      result[i] = true;
+    return;
+  }
+  if (proofs.size() == 1)
+    return;
+  size_t half = proofs.size() / 2;
+  VerifyBisect(proofs.first(half), indices.first(half), result, executor);
+  VerifyBisect(proofs.subspan(half), indices.subspan(half), result, executor);
+}
+
+// counts a verified proof, and whether it failed
+bool Verified(bool valid, Counter verified = Counter::ProofsVerified, Counter failures = Counter::ProofVerificationFailures) {
+  Count(verified);
+  if (!valid)
+    Count(failures);
+  return valid;
+}
+
+// group elements of a batch item that are not covered by one of its proofs, but should be valid
+template <typename... Args>
+bool AllValid(const Args&... args) {
+  return (args.is_valid() && ...);
+}
+
+// Verifies a batch of items, each with `proofsPerItem` proofs listed by `statements(item, proofIndex)` as (A, M, Proof).
+// `make(item)` returns the resulting ElGamal (or nothing if the item is invalid for another reason).
+template <typename Statements, typename Make>
+std::vector<std::optional<ElGamal>> VerifyItems(size_t items, size_t proofsPerItem, Executor& executor, Statements&& statements, Make&& make) {
+  std::vector<GroupElement> A;
+  std::vector<GroupElement> M;
+  std::vector<Proof> p;
+  A.reserve(items * proofsPerItem);
+  M.reserve(items * proofsPerItem);
+  p.reserve(items * proofsPerItem);
+  for (size_t i = 0; i < items; ++i) {
+    for (size_t j = 0; j < proofsPerItem; ++j) {
+      auto [a, m, proof] = statements(i, j);
+      A.push_back(a);
+      M.push_back(m);
+      p.push_back(proof);
+    }
+  }
+  auto valid = VerifyProofBatch(A, M, p, executor);
+  std::vector<std::optional<ElGamal>> retval(items);
+  for (size_t i = 0; i < items; ++i) {
+    bool ok = true;
+    for (size_t j = 0; j < proofsPerItem; ++j)
+      ok = ok && valid[i * proofsPerItem + j];
+    if (ok)
+      retval[i] = make(i);
+  }
+  return retval;
+}
+
+// Fiat-Shamir digest of the statement of an aggregated proof, from which the weights and the challenge are derived
+void AggregateDigest(HashSHA512& digest, const GroupElement& A, std::span<const GroupElement> M, std::span<const GroupElement> N) {
+  SHA512State state;
+  uint64_t count = M.size();
+  state.update("libpep aggregate proof");
+  state.update(A.raw());
+  state.update({reinterpret_cast<const char*>(&count), sizeof(count)});
+  for (const auto& x : M)
+    state.update(x.raw());
+  for (const auto& x : N)
+    state.update(x.raw());
+  std::move(state).finish(digest);
+}
+
+// weight i = SHA512(digest | i), in chunks over the executor
+std::vector<Scalar> AggregateWeights(const HashSHA512& digest, size_t count, Executor& executor) {
+  const size_t CHUNK = 256;
+  std::vector<Scalar> weights(count);
+  executor.run((count + CHUNK - 1) / CHUNK, [&](size_t c) {
+    for (uint64_t i = c * CHUNK; i < std::min(count, (c + 1) * CHUNK); ++i) {
+      HashSHA512 hash;
+      SHA512(hash, std::string_view(reinterpret_cast<const char*>(digest), sizeof(digest)), std::string_view(reinterpret_cast<const char*>(&i), sizeof(i)));
+      weights[i] = Scalar::FromHash(hash);
+    }
+  });
+  return weights;
+}
+
+// Terms of a multi scalar multiplication in which equal points (by their encoding) are added once, with the sum
+// of their scalars. Batches often contain the same point many times (e.g. the public key of all tuples).
+// The encodings of the added points are used as keys, so these should outlive the Terms.
+struct Terms {
+  std::vector<Scalar> scalars;
+  std::vector<GroupElement> points;
+  std::unordered_map<std::string_view, size_t> positions;
+  void add(const GroupElement& P, const Scalar& s) {
+    auto [it, inserted] = positions.try_emplace(P.raw(), points.size());
+    if (inserted) {
+      scalars.push_back(s);
+      points.push_back(P);
+    } else {
+      scalars[it->second] = scalars[it->second] + s;
+    }
+  }
+  // decodes the points over the executor; nullopt if a point is not valid
+  std::optional<std::vector<DecodedGroupElement>> decode(Executor& executor) const {
+    const size_t CHUNK = 16;
+    std::vector<DecodedGroupElement> retval(points.size());
+    std::atomic<bool> valid = true;
+    executor.run((points.size() + CHUNK - 1) / CHUNK, [&](size_t c) {
+      for (size_t i = c * CHUNK; i < std::min(points.size(), (c + 1) * CHUNK); ++i) {
+        auto decoded = DecodedGroupElement::Decode(points[i]);
+        if (decoded)
+          retval[i] = *decoded;
+        else
+          valid = false;
+      }
+    });
+    if (!valid)
+      return {};
+    return retval;
+  }
+};
+
+void CheckBatchSize(size_t inSize, size_t proofSize, const char* func) {
+  if (inSize != proofSize)
+    throw std::invalid_argument(std::string(func) + " expected the same number of proofs as inputs");
+}
+
+// serialisation of the parts of proofs
+void Write(std::string& out, const GroupElement& x) {
+  out.append(x.raw());
+}
+
+void Write(std::string& out, const Scalar& x) {
+  out.append(x.raw());
+}
+
+void Write(std::string& out, const Proof& p) {
+  Write(out, p.N);
+  Write(out, p.C1);
+  Write(out, p.C2);
+  Write(out, p.s);
+}
+
+void Write(std::string& out, const CompactProof& p) {
+  Write(out, p.N);
+  Write(out, p.e);
+  Write(out, p.s);
+}
+
+void Write(std::string& out, const AggregateProof& p) {
+  Write(out, p.C1);
+  Write(out, p.C2);
+  Write(out, p.s);
+}
+
+template <typename... Ts>
+void Write(std::string& out, const std::tuple<Ts...>& t) {
+  std::apply([&](const auto&... x) {
+    (Write(out, x), ...);
+  }, t);
+}
+
+// reads from the front of in, with the same checks as FromHex (zero only if allowed)
+template <typename T>
+void ReadBytes(std::string_view& in, T& x, bool zero = false) {
+  if (in.size() < sizeof(x.value))
+    throw std::invalid_argument("Deserialize expected more bytes");
+  memcpy(x.value, in.data(), sizeof(x.value));
+  in.remove_prefix(sizeof(x.value));
+  if (!x.is_valid() || (x.is_zero() && !zero))
+    throw std::invalid_argument("Deserialize produced an invalid or zero value");
+}
+
+void Read(std::string_view& in, GroupElement& x) {
+  ReadBytes(in, x);
+}
+
+void Read(std::string_view& in, Scalar& x) {
+  ReadBytes(in, x);
+}
+
+void Read(std::string_view& in, Proof& p) {
+  Read(in, p.N);
+  Read(in, p.C1);
+  Read(in, p.C2);
+  Read(in, p.s);
+}
+
+void Read(std::string_view& in, CompactProof& p) {
+  Read(in, p.N);
+  Read(in, p.e);
+  Read(in, p.s);
+}
+
+void Read(std::string_view& in, AggregateProof& p) {
+  Read(in, p.C1);
+  // C2 is zero in the proof of an empty batch
+  ReadBytes(in, p.C2, true);
+  Read(in, p.s);
+}
+
+template <typename... Ts>
+void Read(std::string_view& in, std::tuple<Ts...>& t) {
+  std::apply([&](auto&... x) {
+    (Read(in, x), ...);
+  }, t);
+}
+
+void CheckOutputSize(size_t inSize, size_t outSize, const char* func) {
+  if (inSize != outSize)
+    throw std::invalid_argument(std::string(func) + " expected the same number of outputs as inputs");
+}
+
+// one component (B, C or Y) of every tuple of a batch, the points of an aggregated proof
+std::vector<GroupElement> Components(std::span<const ElGamal> tuples, GroupElement ElGamal::* component) {
+  std::vector<GroupElement> retval;
+  retval.reserve(tuples.size());
+  for (const auto& x : tuples)
+    retval.push_back(x.*component);
+  return retval;
+}
+
+bool SameComponents(std::span<const ElGamal> in, std::span<const ElGamal> out, GroupElement ElGamal::* component) {
+  for (size_t i = 0; i < in.size(); ++i) {
+    if (in[i].*component != out[i].*component)
+      return false;
+  }
+  return true;
+}
+
+}
+
 std::tuple<GroupElement,Proof> libpep::CreateProof(const Scalar& a /*secret*/, const GroupElement& M /*public*/) {
+  ScopedTimer timer(Operation::CreateProof);
+  Count(Counter::ProofsCreated);
   Scalar r = Scalar::Random();
 
-  GroupElement A = a * G;
-  GroupElement N = a * M;
-  GroupElement C1 = r * G;
-  GroupElement C2 = r * M;
+  DecodedGroupElement dM(M);
+  GroupElement A = DecodedGroupElement::MultBase(a).encode();
+  GroupElement N = (a * dM).encode();
+  GroupElement C1 = DecodedGroupElement::MultBase(r).encode();
+  GroupElement C2 = (r * dM).encode();
 
   HashSHA512 hash;
   SHA512(hash,
@@ -42,8 +388,18 @@ std::tuple<GroupElement,Proof> libpep::CreateProof(const Scalar& a /*secret*/, c
 }
 
 [[nodiscard]] bool libpep::VerifyProof(const GroupElement& A, const GroupElement& M, const GroupElement& N, const GroupElement& C1, const GroupElement& C2, const Scalar& s) {
-  if (!A.is_valid() || !M.is_valid() || !N.is_valid() || !C1.is_valid() || !C2.is_valid() || !s.is_valid())
-    return false;
+  ScopedTimer timer(Operation::VerifyProof);
+  // with a zero A, M or N the equations hold for proofs of a zero factor, which must not verify
+  if (!s.is_valid() || A.is_zero() || M.is_zero() || N.is_zero())
+    return Verified(false);
+  // decoding checks validity of the group elements
+  auto dA = DecodedGroupElement::Decode(A);
+  auto dM = DecodedGroupElement::Decode(M);
+  auto dN = DecodedGroupElement::Decode(N);
+  auto dC1 = DecodedGroupElement::Decode(C1);
+  auto dC2 = DecodedGroupElement::Decode(C2);
+  if (!dA || !dM || !dN || !dC1 || !dC2)
+    return Verified(false);
   HashSHA512 hash;
   SHA512(hash,
       A.raw(),
@@ -53,14 +409,155 @@ std::tuple<GroupElement,Proof> libpep::CreateProof(const Scalar& a /*secret*/, c
       C2.raw());
   Scalar e = Scalar::FromHash(hash);
 
-  return s * G == e*A + C1
-    && s * M == e*N + C2;
+  // s*G - e*A == C1 and s*M - e*N == C2; all values are public, so variable time multiplications can be used
+  return Verified(DoubleScalarMulVartime(s, G, -e, *dA) == *dC1
+    && DoubleScalarMulVartime(s, *dM, -e, *dN) == *dC2);
 }
 
 [[nodiscard]] bool libpep::VerifyProof(const GroupElement& A, const GroupElement& M, const Proof& p) {
   return VerifyProof(A, M, p.N, p.C1, p.C2, p.s);
 }
 
+CompactProof libpep::Compact(const GroupElement& A, const GroupElement& M, const Proof& p) {
+  HashSHA512 hash;
+  SHA512(hash,
+      A.raw(),
+      M.raw(),
+      p.N.raw(),
+      p.C1.raw(),
+      p.C2.raw());
+  return {p.N, Scalar::FromHash(hash), p.s};
+}
+
+[[nodiscard]] bool libpep::VerifyProof(const GroupElement& A, const GroupElement& M, const CompactProof& p) {
+  ScopedTimer timer(Operation::VerifyProof);
+  // as above, zero A, M or N never verify
+  if (!p.s.is_valid() || !p.e.is_valid() || A.is_zero() || M.is_zero() || p.N.is_zero())
+    return Verified(false);
+  // decoding checks validity of the group elements
+  auto dA = DecodedGroupElement::Decode(A);
+  auto dM = DecodedGroupElement::Decode(M);
+  auto dN = DecodedGroupElement::Decode(p.N);
+  if (!dA || !dM || !dN)
+    return Verified(false);
+  // the commitments, if the proof is valid
+  GroupElement C1 = DoubleScalarMulVartime(p.s, G, -p.e, *dA).encode();
+  GroupElement C2 = DoubleScalarMulVartime(p.s, *dM, -p.e, *dN).encode();
+  HashSHA512 hash;
+  SHA512(hash,
+      A.raw(),
+      M.raw(),
+      p.N.raw(),
+      C1.raw(),
+      C2.raw());
+  return Verified(Scalar::FromHash(hash) == p.e);
+}
+
+[[nodiscard]] std::vector<bool> libpep::VerifyProofBatch(std::span<const GroupElement> A, std::span<const GroupElement> M, std::span<const Proof> p, Executor& executor) {
+  if (A.size() != M.size() || A.size() != p.size())
+    throw std::invalid_argument("VerifyProofBatch expects spans of the same size");
+  ScopedTimer timer(Operation::VerifyProofBatch);
+  // decode every distinct A once
+  std::vector<size_t> distinctA;
+  std::vector<size_t> indexOfA(A.size());
+  std::unordered_map<std::string_view, size_t> seen;
+  for (size_t i = 0; i < A.size(); ++i) {
+    auto [it, inserted] = seen.try_emplace(A[i].raw(), distinctA.size());
+    if (inserted)
+      distinctA.push_back(i);
+    indexOfA[i] = it->second;
+  }
+  std::vector<std::optional<DecodedGroupElement>> decodedA(distinctA.size());
+  executor.run(distinctA.size(), [&](size_t i) {
+    decodedA[i] = DecodedGroupElement::Decode(A[distinctA[i]]);
+  });
+
+  // decode the proofs (and hash them) in chunks
+  const size_t CHUNK = 16;
+  std::vector<std::optional<DecodedProof>> decoded(p.size());
+  executor.run((p.size() + CHUNK - 1) / CHUNK, [&](size_t c) {
+    for (size_t i = c * CHUNK; i < std::min(p.size(), (c + 1) * CHUNK); ++i) {
+      const auto& dA = decodedA[indexOfA[i]];
+      decoded[i] = DecodeProof(A[i], dA ? &*dA : nullptr, M[i], p[i]);
+    }
+  });
+
+  // proofs with an invalid scalar or group element are never part of the combined check
+  std::vector<const DecodedProof*> proofs;
+  std::vector<size_t> indices;
+  for (size_t i = 0; i < decoded.size(); ++i) {
+    if (decoded[i]) {
+      proofs.push_back(&*decoded[i]);
+      indices.push_back(i);
+    }
+  }
+  std::vector<bool> result(p.size(), false);
+  VerifyBisect(proofs, indices, result, executor);
+  Count(Counter::ProofsVerified, result.size());
+  Count(Counter::ProofVerificationFailures, size_t(std::count(result.begin(), result.end(), false)));
+  return result;
+}
+
+std::tuple<GroupElement,AggregateProof> libpep::CreateAggregateProof(const Scalar& a, std::span<const GroupElement> M, std::span<const GroupElement> N, Executor& executor) {
+  if (M.size() != N.size())
+    throw std::invalid_argument("CreateAggregateProof expects spans of the same size");
+  ScopedTimer timer(Operation::CreateAggregateProof);
+  Count(Counter::AggregateProofsCreated);
+  GroupElement A = DecodedGroupElement::MultBase(a).encode();
+  HashSHA512 digest;
+  AggregateDigest(digest, A, M, N);
+  auto weights = AggregateWeights(digest, M.size(), executor);
+  Terms terms;
+  for (size_t i = 0; i < M.size(); ++i)
+    terms.add(M[i], weights[i]);
+  auto points = terms.decode(executor);
+  if (!points)
+    throw std::invalid_argument("CreateAggregateProof expects valid group elements");
+  // M* = sum w_i * M_i (all public), and N* = a * M* is never needed by the prover
+  auto combinedM = MultiScalarMulParallel(terms.scalars, *points, executor);
+
+  Scalar r = Scalar::Random();
+  GroupElement C1 = DecodedGroupElement::MultBase(r).encode();
+  // an empty batch has M* = 0, so C2 is zero and the proof only shows knowledge of a
+  GroupElement C2 = M.empty() ? GroupElement() : (r * combinedM).encode();
+  HashSHA512 hash;
+  SHA512(hash, std::string_view(reinterpret_cast<const char*>(digest), sizeof(digest)), C1.raw(), C2.raw());
+  Scalar e = Scalar::FromHash(hash);
+  return {A, {C1, C2, a*e + r}};
+}
+
+[[nodiscard]] bool libpep::VerifyAggregateProof(const GroupElement& A, std::span<const GroupElement> M, std::span<const GroupElement> N, const AggregateProof& p, Executor& executor) {
+  if (M.size() != N.size())
+    throw std::invalid_argument("VerifyAggregateProof expects spans of the same size");
+  ScopedTimer timer(Operation::VerifyAggregateProof);
+  // zero A, M_i or N_i never verify, as in VerifyProof
+  auto isZero = [](const GroupElement& P) { return P.is_zero(); };
+  if (!p.s.is_valid() || A.is_zero() || std::any_of(M.begin(), M.end(), isZero) || std::any_of(N.begin(), N.end(), isZero))
+    return Verified(false, Counter::AggregateProofsVerified, Counter::AggregateProofVerificationFailures);
+  HashSHA512 digest;
+  AggregateDigest(digest, A, M, N);
+  auto weights = AggregateWeights(digest, M.size(), executor);
+  HashSHA512 hash;
+  SHA512(hash, std::string_view(reinterpret_cast<const char*>(digest), sizeof(digest)), p.C1.raw(), p.C2.raw());
+  Scalar e = Scalar::FromHash(hash);
+
+  // s*M* = e*N* + C2 (with M* = sum w_i*M_i and N* = sum w_i*N_i) and s*G = e*A + C1, the latter with a random
+  // weight v so both are checked with one multiplication
+  static const GroupElement g = Generator().encode();
+  auto v = Scalar::Random();
+  Terms terms;
+  for (size_t i = 0; i < M.size(); ++i) {
+    terms.add(M[i], p.s * weights[i]);
+    terms.add(N[i], -(e * weights[i]));
+  }
+  terms.add(p.C2, -One());
+  terms.add(g, v * p.s);
+  terms.add(A, -(v * e));
+  terms.add(p.C1, -v);
+  auto points = terms.decode(executor);
+  return Verified(points && MultiScalarMulParallel(terms.scalars, *points, executor).is_zero(), Counter::AggregateProofsVerified, Counter::AggregateProofVerificationFailures);
+}
+
 Signature libpep::Sign(const GroupElement& message, const Scalar& secretKey) {
   auto p = CreateProof(secretKey, message);
   return std::get<1>(p);
@@ -83,6 +580,26 @@ ProvedRerandomize libpep::ProveRerandomize(const ElGamal& in, const Scalar& s) {
   return VerifyRerandomize(in.B, in.C, in.Y, std::get<0>(p), std::get<1>(p));
 }
 
+CompactProvedRerandomize libpep::Compact(const ElGamal& in, const ProvedRerandomize& p) {
+  const auto& [S, py] = p;
+  return {S, Compact(S, in.Y, py)};
+}
+
+[[nodiscard]] std::optional<ElGamal> libpep::VerifyRerandomize(const ElGamal& in, const CompactProvedRerandomize& p) {
+  const auto& [S, py] = p;
+  return in.B.is_valid() && in.C.is_valid() && VerifyProof(S, in.Y, py) ?
+    ElGamal{S + in.B, py.value() + in.C, in.Y} : std::optional<ElGamal>();
+}
+
+[[nodiscard]] std::vector<std::optional<ElGamal>> libpep::VerifyRerandomize(std::span<const ElGamal> in, std::span<const ProvedRerandomize> p, Executor& executor) {
+  CheckBatchSize(in.size(), p.size(), __func__);
+  return VerifyItems(in.size(), 1, executor, [&](size_t i, size_t) {
+    return std::tuple<const GroupElement&, const GroupElement&, const Proof&>{std::get<0>(p[i]), in[i].Y, std::get<1>(p[i])};
+  }, [&](size_t i) -> std::optional<ElGamal> {
+    return AllValid(in[i].B, in[i].C) ? ElGamal{std::get<0>(p[i]) + in[i].B, std::get<1>(p[i]).value() + in[i].C, in[i].Y} : std::optional<ElGamal>();
+  });
+}
+
 // adjust the encrypted cypher text to be n*M (with M the original text being encrypted)
 ProvedReshuffle libpep::ProveReshuffle(const ElGamal& in, const Scalar& n) {
   // Reshuffle is normally {n * in.b, n * in.c, in.y};
@@ -101,10 +618,62 @@ ProvedReshuffle libpep::ProveReshuffle(const ElGamal& in, const Scalar& n) {
   return VerifyReshuffle(in.B, in.C, in.Y, std::get<0>(p), std::get<1>(p), std::get<2>(p));
 }
 
+CompactProvedReshuffle libpep::Compact(const ElGamal& in, const ProvedReshuffle& p) {
+  const auto& [AB, pb, pc] = p;
+  return {AB, Compact(AB, in.B, pb), Compact(AB, in.C, pc)};
+}
+
+[[nodiscard]] std::optional<ElGamal> libpep::VerifyReshuffle(const ElGamal& in, const CompactProvedReshuffle& p) {
+  const auto& [AB, pb, pc] = p;
+  return VerifyProof(AB, in.B, pb) && VerifyProof(AB, in.C, pc) && in.Y.is_valid() ?
+    ElGamal{pb.value(), pc.value(), in.Y} : std::optional<ElGamal>();
+}
+
+[[nodiscard]] std::vector<std::optional<ElGamal>> libpep::VerifyReshuffle(std::span<const ElGamal> in, std::span<const ProvedReshuffle> p, Executor& executor) {
+  CheckBatchSize(in.size(), p.size(), __func__);
+  return VerifyItems(in.size(), 2, executor, [&](size_t i, size_t j) {
+    const auto& [AB, pb, pc] = p[i];
+    return j == 0 ? std::tuple<const GroupElement&, const GroupElement&, const Proof&>{AB, in[i].B, pb}
+                  : std::tuple<const GroupElement&, const GroupElement&, const Proof&>{AB, in[i].C, pc};
+  }, [&](size_t i) -> std::optional<ElGamal> {
+    return AllValid(in[i].Y) ? ElGamal{std::get<1>(p[i]).value(), std::get<2>(p[i]).value(), in[i].Y} : std::optional<ElGamal>();
+  });
+}
+
 GroupElement libpep::ReshuffledBy(const ProvedReshuffle& in) {
   return std::get<0>(in);
 }
 
+ProvedReshuffleBatch libpep::ProveReshuffleBatch(std::span<const ElGamal> in, const Scalar& n, std::span<ElGamal> out, Executor& executor) {
+  CheckOutputSize(in.size(), out.size(), __func__);
+  // collected before transforming, so in and out can be the same span
+  auto M = Components(in, &ElGamal::B);
+  auto C = Components(in, &ElGamal::C);
+  M.insert(M.end(), C.begin(), C.end());
+  Reshuffle(in, n, out, executor);
+  auto N = Components(out, &ElGamal::B);
+  C = Components(out, &ElGamal::C);
+  N.insert(N.end(), C.begin(), C.end());
+  return CreateAggregateProof(n, M, N, executor);
+}
+
+[[nodiscard]] bool libpep::VerifyReshuffleBatch(std::span<const ElGamal> in, std::span<const ElGamal> out, const ProvedReshuffleBatch& p, Executor& executor) {
+  CheckOutputSize(in.size(), out.size(), __func__);
+  if (!SameComponents(in, out, &ElGamal::Y))
+    return false;
+  auto M = Components(in, &ElGamal::B);
+  auto C = Components(in, &ElGamal::C);
+  M.insert(M.end(), C.begin(), C.end());
+  auto N = Components(out, &ElGamal::B);
+  C = Components(out, &ElGamal::C);
+  N.insert(N.end(), C.begin(), C.end());
+  return VerifyAggregateProof(std::get<0>(p), M, N, std::get<1>(p), executor);
+}
+
+GroupElement libpep::ReshuffledBy(const ProvedReshuffleBatch& in) {
+  return std::get<0>(in);
+}
+
 // adjust the encrypted cypher text to be n*M (with M the original text being encrypted)
 ProvedRekey libpep::ProveRekey(const ElGamal& in, const Scalar& k) {
   // Rekey is normmaly {in.b/k, in.c, k*in.y};
@@ -122,10 +691,53 @@ ProvedRekey libpep::ProveRekey(const ElGamal& in, const Scalar& k) {
   return VerifyRekey(in.B, in.C, in.Y, std::get<0>(p), std::get<1>(p), std::get<2>(p), std::get<3>(p));
 }
 
+CompactProvedRekey libpep::Compact(const ElGamal& in, const ProvedRekey& p) {
+  const auto& [AB, pb, AY, py] = p;
+  return {AB, Compact(AB, in.B, pb), AY, Compact(AY, in.Y, py)};
+}
+
+[[nodiscard]] std::optional<ElGamal> libpep::VerifyRekey(const ElGamal& in, const CompactProvedRekey& p) {
+  const auto& [AB, pb, AY, py] = p;
+  return VerifyProof(AB, in.B, pb) && in.C.is_valid() && VerifyProof(AY, in.Y, py) ?
+    ElGamal{pb.value(), in.C, py.value()} : std::optional<ElGamal>();
+}
+
+[[nodiscard]] std::vector<std::optional<ElGamal>> libpep::VerifyRekey(std::span<const ElGamal> in, std::span<const ProvedRekey> p, Executor& executor) {
+  CheckBatchSize(in.size(), p.size(), __func__);
+  return VerifyItems(in.size(), 2, executor, [&](size_t i, size_t j) {
+    const auto& [AB, pb, AY, py] = p[i];
+    return j == 0 ? std::tuple<const GroupElement&, const GroupElement&, const Proof&>{AB, in[i].B, pb}
+                  : std::tuple<const GroupElement&, const GroupElement&, const Proof&>{AY, in[i].Y, py};
+  }, [&](size_t i) -> std::optional<ElGamal> {
+    return AllValid(in[i].C) ? ElGamal{std::get<1>(p[i]).value(), in[i].C, std::get<3>(p[i]).value()} : std::optional<ElGamal>();
+  });
+}
+
 GroupElement libpep::RekeyBy(const ProvedRekey& in) {
   return std::get<2>(in);
 }
 
+ProvedRekeyBatch libpep::ProveRekeyBatch(std::span<const ElGamal> in, const Scalar& k, std::span<ElGamal> out, Executor& executor) {
+  CheckOutputSize(in.size(), out.size(), __func__);
+  auto B = Components(in, &ElGamal::B);
+  auto Y = Components(in, &ElGamal::Y);
+  Rekey(in, k, out, executor);
+  return std::tuple_cat(CreateAggregateProof(k.invert(), B, Components(out, &ElGamal::B), executor),
+                        CreateAggregateProof(k, Y, Components(out, &ElGamal::Y), executor));
+}
+
+[[nodiscard]] bool libpep::VerifyRekeyBatch(std::span<const ElGamal> in, std::span<const ElGamal> out, const ProvedRekeyBatch& p, Executor& executor) {
+  CheckOutputSize(in.size(), out.size(), __func__);
+  const auto& [AB, pb, AY, py] = p;
+  return SameComponents(in, out, &ElGamal::C)
+    && VerifyAggregateProof(AB, Components(in, &ElGamal::B), Components(out, &ElGamal::B), pb, executor)
+    && VerifyAggregateProof(AY, Components(in, &ElGamal::Y), Components(out, &ElGamal::Y), py, executor);
+}
+
+GroupElement libpep::RekeyBy(const ProvedRekeyBatch& in) {
+  return std::get<2>(in);
+}
+
 ProvedRKS libpep::ProveRKS(const ElGamal& in, const Scalar& k, const Scalar& n) {
   // RKS is normally {(n / k) * in.B, n * in.C, k * in.Y};
   // different order (C, Y, B) so that first and second group elements for prove_reshuffle,
@@ -139,9 +751,93 @@ ProvedRKS libpep::ProveRKS(const ElGamal& in, const Scalar& k, const Scalar& n)
 [[nodiscard]] std::optional<ElGamal> libpep::VerifyRKS(const ElGamal& in, const ProvedRKS& p) {
   return VerifyRKS(in.B, in.C, in.Y, std::get<0>(p), std::get<1>(p), std::get<2>(p), std::get<3>(p), std::get<4>(p), std::get<5>(p));
 }
+CompactProvedRKS libpep::Compact(const ElGamal& in, const ProvedRKS& p) {
+  const auto& [AC, pc, AY, py, AB, pb] = p;
+  return {AC, Compact(AC, in.C, pc), AY, Compact(AY, in.Y, py), AB, Compact(AB, in.B, pb)};
+}
+
+[[nodiscard]] std::optional<ElGamal> libpep::VerifyRKS(const ElGamal& in, const CompactProvedRKS& p) {
+  const auto& [AC, pc, AY, py, AB, pb] = p;
+  return VerifyProof(AB, in.B, pb) && VerifyProof(AC, in.C, pc) && VerifyProof(AY, in.Y, py) ?
+    ElGamal{pb.value(), pc.value(), py.value()} : std::optional<ElGamal>();
+}
+
+[[nodiscard]] std::vector<std::optional<ElGamal>> libpep::VerifyRKS(std::span<const ElGamal> in, std::span<const ProvedRKS> p, Executor& executor) {
+  CheckBatchSize(in.size(), p.size(), __func__);
+  return VerifyItems(in.size(), 3, executor, [&](size_t i, size_t j) {
+    const auto& [AC, pc, AY, py, AB, pb] = p[i];
+    return j == 0 ? std::tuple<const GroupElement&, const GroupElement&, const Proof&>{AB, in[i].B, pb}
+         : j == 1 ? std::tuple<const GroupElement&, const GroupElement&, const Proof&>{AC, in[i].C, pc}
+                  : std::tuple<const GroupElement&, const GroupElement&, const Proof&>{AY, in[i].Y, py};
+  }, [&](size_t i) -> std::optional<ElGamal> {
+    return ElGamal{std::get<5>(p[i]).value(), std::get<1>(p[i]).value(), std::get<3>(p[i]).value()};
+  });
+}
+
 GroupElement libpep::ReshuffledBy(const ProvedRKS& in) {
   return std::get<0>(in);
 }
 GroupElement libpep::RekeyBy(const ProvedRKS& in) {
   return std::get<2>(in);
 }
+
+ProvedRKSBatch libpep::ProveRKSBatch(std::span<const ElGamal> in, const Scalar& k, const Scalar& n, std::span<ElGamal> out, Executor& executor) {
+  CheckOutputSize(in.size(), out.size(), __func__);
+  auto B = Components(in, &ElGamal::B);
+  auto C = Components(in, &ElGamal::C);
+  auto Y = Components(in, &ElGamal::Y);
+  RKS(in, k, n, out, executor);
+  return std::tuple_cat(CreateAggregateProof(n, C, Components(out, &ElGamal::C), executor),
+                        CreateAggregateProof(k, Y, Components(out, &ElGamal::Y), executor),
+                        CreateAggregateProof(n/k, B, Components(out, &ElGamal::B), executor));
+}
+
+[[nodiscard]] bool libpep::VerifyRKSBatch(std::span<const ElGamal> in, std::span<const ElGamal> out, const ProvedRKSBatch& p, Executor& executor) {
+  CheckOutputSize(in.size(), out.size(), __func__);
+  const auto& [AC, pc, AY, py, AB, pb] = p;
+  return VerifyAggregateProof(AC, Components(in, &ElGamal::C), Components(out, &ElGamal::C), pc, executor)
+    && VerifyAggregateProof(AY, Components(in, &ElGamal::Y), Components(out, &ElGamal::Y), py, executor)
+    && VerifyAggregateProof(AB, Components(in, &ElGamal::B), Components(out, &ElGamal::B), pb, executor);
+}
+
+GroupElement libpep::ReshuffledBy(const ProvedRKSBatch& in) {
+  return std::get<0>(in);
+}
+GroupElement libpep::RekeyBy(const ProvedRKSBatch& in) {
+  return std::get<2>(in);
+}
+
+template <typename T>
+std::string libpep::Serialize(const T& value) {
+  std::string retval;
+  Write(retval, value);
+  return retval;
+}
+
+template <typename T>
+T libpep::Deserialize(std::string_view in) {
+  T retval;
+  Read(in, retval);
+  if (!in.empty())
+    throw std::invalid_argument("Deserialize expected less bytes");
+  return retval;
+}
+
+#define SERIALISATION(T) \
+  template std::string libpep::Serialize<T>(const T& value); \
+  template T libpep::Deserialize<T>(std::string_view in);
+
+SERIALISATION(Proof)
+SERIALISATION(CompactProof)
+SERIALISATION(AggregateProof)
+SERIALISATION(ProvedRerandomize)
+SERIALISATION(ProvedReshuffle)
+SERIALISATION(ProvedRekey)
+SERIALISATION(ProvedRKS)
+SERIALISATION(CompactProvedRerandomize)
+SERIALISATION(CompactProvedReshuffle)
+SERIALISATION(CompactProvedRekey)
+SERIALISATION(CompactProvedRKS)
+SERIALISATION(ProvedReshuffleBatch)
+SERIALISATION(ProvedRekeyBatch)
+SERIALISATION(ProvedRKSBatch)
@@ -0,0 +1,162 @@
+// Author: Bernard van Gastel
+
+#include "libpep.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+IGNORE_WARNINGS_START
+#include <catch2/catch.hpp>
+IGNORE_WARNINGS_END
+
+// Benchmarks are hidden, run them with: peptest "[benchmark]"
+
+namespace {
+using namespace libpep;
+
+// cost per term of a multi scalar multiplication falls as the number of terms grows
+TEST_CASE("PEP.MultiScalarMulBenchmark", "[.][benchmark]") {
+  for (size_t n : {1, 2, 4, 16, 64, 256, 1024}) {
+    std::vector<Scalar> scalars;
+    std::vector<DecodedGroupElement> points;
+    for (size_t i = 0; i < n; ++i) {
+      scalars.push_back(Scalar::Random());
+      points.push_back(DecodedGroupElement::Random());
+    }
+    BENCHMARK("separate multiplications n=" + std::to_string(n)) {
+      DecodedGroupElement sum;
+      for (size_t i = 0; i < n; ++i)
+        sum = sum + scalars[i] * points[i];
+      return sum;
+    };
+    BENCHMARK("MultiScalarMul n=" + std::to_string(n)) {
+      return MultiScalarMul(scalars, points);
+    };
+    BENCHMARK("MultiScalarMulVartime n=" + std::to_string(n)) {
+      return MultiScalarMulVartime(scalars, points);
+    };
+  }
+}
+
+TEST_CASE("PEP.GeneratePseudonymsBenchmark", "[.][benchmark]") {
+  auto [pk, sk] = GenerateGlobalKeys();
+  auto prepared = PreparePublicKey(pk);
+  std::vector<std::string> identities;
+  for (int i = 0; i < 10000; ++i)
+    identities.push_back("identity-" + std::to_string(i));
+  std::vector<std::string_view> views(identities.begin(), identities.end());
+  std::vector<GlobalEncryptedPseudonym> out(identities.size());
+  BENCHMARK("GeneratePseudonym n=10000") {
+    for (size_t i = 0; i < identities.size(); ++i)
+      out[i] = GeneratePseudonym(identities[i], prepared);
+    return out.back();
+  };
+  BENCHMARK("GeneratePseudonyms n=10000") {
+    GeneratePseudonyms(views, prepared, out);
+    return out.back();
+  };
+}
+
+TEST_CASE("PEP.IdentityDictionaryBenchmark", "[.][benchmark]") {
+  auto path = (std::filesystem::temp_directory_path() / "libpep-identities.benchmark").string();
+  IdentityKey key;
+  RandomBytes(key);
+  auto [pk, sk] = GenerateGlobalKeys();
+  auto prepared = PreparePublicKey(pk);
+  std::vector<std::string> identities;
+  std::vector<uint64_t> rowIds;
+  for (uint64_t i = 0; i < 10000; ++i) {
+    identities.push_back("identity-" + std::to_string(i));
+    rowIds.push_back(i);
+  }
+  std::vector<std::string_view> views(identities.begin(), identities.end());
+  {
+    IdentityDictionaryBuilder builder(path, key);
+    builder.add(views, rowIds);
+    builder.commit();
+  }
+  IdentityDictionary dictionary(path, key);
+  std::vector<GlobalEncryptedPseudonym> out(identities.size());
+  InlineExecutor inlineExecutor;
+  BENCHMARK("GeneratePseudonyms n=10000") {
+    GeneratePseudonyms(views, prepared, out, inlineExecutor);
+    return out.back();
+  };
+  BENCHMARK("GeneratePseudonyms dictionary n=10000") {
+    GeneratePseudonyms(views, dictionary, prepared, out, inlineExecutor);
+    return out.back();
+  };
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("PEP.RandomBenchmark", "[.][benchmark]") {
+  std::vector<Scalar> batch(256);
+  BENCHMARK("Scalar::Random n=256") {
+    for (auto& x : batch)
+      x = Scalar::Random();
+    return batch.back();
+  };
+  BENCHMARK("Scalar::RandomBatch n=256") {
+    Scalar::RandomBatch(batch);
+    return batch.back();
+  };
+  SetBufferedRandom(true);
+  BENCHMARK("Scalar::Random buffered n=256") {
+    for (auto& x : batch)
+      x = Scalar::Random();
+    return batch.back();
+  };
+  BENCHMARK("Scalar::RandomBatch buffered n=256") {
+    Scalar::RandomBatch(batch);
+    return batch.back();
+  };
+  SetBufferedRandom(false);
+}
+
+// the pool moves both scalar multiplications of Encrypt to the background thread (as long as it keeps up)
+TEST_CASE("PEP.RandomizerPoolBenchmark", "[.][benchmark]") {
+  auto Y = Scalar::Random() * G;
+  auto prepared = PreparePublicKey(Y);
+  RandomizerPool pool(Y, 1 << 16);
+  auto M = GroupElement::Random();
+  BENCHMARK("Encrypt") {
+    return Encrypt(M, Y);
+  };
+  BENCHMARK("Encrypt prepared") {
+    return Encrypt(M, prepared);
+  };
+  BENCHMARK("Encrypt pool") {
+    return Encrypt(M, pool);
+  };
+  auto stats = pool.statistics();
+  WARN("pool: taken " << stats.taken << ", fallbacks " << stats.fallbacks);
+}
+
+TEST_CASE("PEP.HexBenchmark", "[.][benchmark]") {
+  auto Y = Scalar::Random() * G;
+  std::vector<ElGamal> tuples;
+  std::vector<std::string> hex;
+  for (size_t i = 0; i < 256; ++i) {
+    tuples.push_back(Encrypt(GroupElement::Random(), Y));
+    hex.push_back(tuples.back().hex());
+  }
+  std::vector<std::string_view> views(hex.begin(), hex.end());
+  std::vector<ElGamal> out(hex.size());
+  BENCHMARK("ElGamal::hex n=256") {
+    size_t size = 0;
+    for (const auto& x : tuples)
+      size += x.hex().size();
+    return size;
+  };
+  BENCHMARK("ElGamal::FromHex n=256") {
+    for (size_t i = 0; i < views.size(); ++i)
+      out[i] = ElGamal::FromHex(views[i]);
+    return out[0];
+  };
+  BENCHMARK("ElGamal::FromHexBatch n=256") {
+    return ElGamal::FromHexBatch(views, out);
+  };
+}
+
+}
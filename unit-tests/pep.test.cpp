@@ -1,10 +1,22 @@
 // Author: Bernard van Gastel
 
 #include "libpep.h"
+#include "columnar-file.h"
 
 #include <limits.h>
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 #include <optional>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <set>
 #include <sstream>
+#include <thread>
+#include <vector>
 
 IGNORE_WARNINGS_START
 #include <catch2/catch.hpp>
@@ -34,6 +46,73 @@ TEST_CASE("PEP.Base", "[PEP]") {
   s = Scalar::Random();
   CHECK_THROWS(s*M);
 }
+TEST_CASE("PEP.DecodedGroupElement", "[PEP]") {
+  // decoded arithmetic should give the same encodings as the libsodium based GroupElement arithmetic
+  for (int i = 0; i < 32; ++i) {
+    auto P = GroupElement::Random();
+    auto Q = GroupElement::Random();
+    auto s = Scalar::Random();
+    DecodedGroupElement dP(P);
+    DecodedGroupElement dQ(Q);
+    CHECK(dP.encode() == P);
+    CHECK((dP + dQ).encode() == P + Q);
+    CHECK((dP - dQ).encode() == P - Q);
+    CHECK((-dP + dQ).encode() == Q - P);
+    CHECK((s * dP).encode() == s * P);
+    CHECK((dP / s).encode() == P / s);
+    CHECK(DecodedGroupElement::MultBase(s).encode() == s * G);
+    CHECK(dP + dQ == dQ + dP);
+
+    uint8_t hash[64];
+    RandomBytes(hash);
+    CHECK(DecodedGroupElement::FromHash(hash).encode() == GroupElement::FromHash(hash));
+  }
+  DecodedGroupElement zero;
+  CHECK(zero.is_zero());
+  CHECK(zero.encode().is_zero());
+  CHECK(DecodedGroupElement(GroupElement()).is_zero());
+  auto P = DecodedGroupElement::Random();
+  CHECK((P - P).is_zero());
+  CHECK_THROWS(Scalar::Random() * zero);
+
+  // 2^255-19 is not a canonical encoding
+  GroupElement invalid;
+  memset(invalid.value, 0xff, sizeof(invalid.value));
+  invalid.value[0] = 0xed;
+  invalid.value[31] = 0x7f;
+  CHECK(!invalid.is_valid());
+  CHECK(!DecodedGroupElement::Decode(invalid));
+  CHECK_THROWS(DecodedGroupElement(invalid));
+
+  // chained operations on decoded ElGamal tuples
+  auto y = Scalar::Random();
+  auto Y = y * G;
+  auto M = GroupElement::Random();
+  auto k = Scalar::Random();
+  auto n = Scalar::Random();
+  auto r = Scalar::Random();
+  auto encrypted = Encrypt(M, Y);
+  CHECK(RKS(DecodedElGamal(encrypted), k, n).encode() == RKS(encrypted, k, n));
+  CHECK(Rerandomize(DecodedElGamal(encrypted), r).encode() == Rerandomize(encrypted, r));
+  CHECK(Rekey(DecodedElGamal(encrypted), k).encode() == Rekey(encrypted, k));
+  CHECK(Reshuffle(DecodedElGamal(encrypted), n).encode() == Reshuffle(encrypted, n));
+  CHECK(Decrypt(RKS(Rerandomize(DecodedElGamal(encrypted), r), k, n), k * y).encode() == n * M);
+}
+
+TEST_CASE("PEP.DoubleAndEncodeBatch", "[PEP]") {
+  std::vector<DecodedGroupElement> points;
+  for (int i = 0; i < 32; ++i)
+    points.push_back(DecodedGroupElement::Random());
+  points[5] = DecodedGroupElement();
+  points[9] = DecodedGroupElement::MultBase(Scalar::Random());
+  points[10] = -points[9];
+  std::vector<GroupElement> encoded(points.size());
+  DoubleAndEncodeBatch(points, encoded);
+  for (size_t i = 0; i < points.size(); ++i)
+    CHECK(encoded[i] == (points[i] + points[i]).encode());
+  CHECK(encoded[5].is_zero());
+}
+
 TEST_CASE("PEP.SecureRemotePassword", "[PEP]") {
   uint8_t salt[4];
   RandomBytes(salt);
@@ -160,6 +239,621 @@ TEST_CASE("PEP.PEPAssumptions", "[PEP]") {
   CHECK(Reshuffle(Rekey(encrypted, k), n) == RKS(encrypted, k, n));
 }
 
+TEST_CASE("PEP.PreparedPublicKey", "[PEP]") {
+  auto y = Scalar::Random();
+  auto Y = y * G;
+  auto prepared = PreparePublicKey(Y);
+  CHECK(prepared.encoded() == Y);
+  CHECK(PreparePublicKey(Y).encoded() == Y);
+  for (int i = 0; i < 8; ++i) {
+    auto s = Scalar::Random();
+    CHECK((s * prepared).encode() == s * Y);
+    auto M = GroupElement::Random();
+    auto encrypted = Encrypt(M, prepared);
+    CHECK(encrypted.Y == Y);
+    CHECK(Decrypt(encrypted, y) == M);
+    CHECK(Rerandomize(encrypted, prepared, s) == Rerandomize(encrypted, s));
+  }
+  auto other = PreparePublicKey(Scalar::Random() * G);
+  CHECK_THROWS_AS(Rerandomize(Encrypt(GroupElement::Random(), Y), other), std::invalid_argument);
+  CHECK(Decrypt(GeneratePseudonym("user", prepared), y) == Decrypt(GeneratePseudonym("user", Y), y));
+}
+
+TEST_CASE("PEP.BufferedRandom", "[PEP]") {
+  auto check = [](std::span<const Scalar> values) {
+    std::set<std::string> distinct;
+    for (const auto& x : values) {
+      CHECK(x.is_valid());
+      CHECK(!x.is_zero());
+      distinct.insert(x.hex());
+    }
+    CHECK(distinct.size() == values.size());
+  };
+  std::vector<Scalar> batch(100);
+  Scalar::RandomBatch(batch);
+  check(batch);
+
+  SetBufferedRandom(true);
+  CHECK(BufferedRandom());
+  Scalar::RandomBatch(batch);
+  check(batch);
+  std::vector<Scalar> single;
+  for (int i = 0; i < 2000; ++i) // more than a reseed interval of output
+    single.push_back(Scalar::Random());
+  check(single);
+  auto y = Scalar::Random();
+  auto M = GroupElement::Random();
+  CHECK(GroupElement::Random() != M);
+  CHECK(Decrypt(Rerandomize(Encrypt(M, y * G)), y) == M);
+
+  // threads have their own generator
+  Scalar other;
+  std::thread([&other] { other = Scalar::Random(); }).join();
+  CHECK(other.is_valid());
+  CHECK(other != Scalar::Random());
+
+#if !defined(_WIN32)
+  // after a fork, the child does not hand out the buffered bytes of the parent
+  uint8_t parent[32];
+  uint8_t child[32];
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if (pid == 0) {
+    RandomBytes(child);
+    ssize_t written = write(fds[1], child, sizeof(child));
+    _exit(written == sizeof(child) ? 0 : 1);
+  }
+  RandomBytes(parent);
+  REQUIRE(read(fds[0], child, sizeof(child)) == sizeof(child));
+  int status = 0;
+  waitpid(pid, &status, 0);
+  close(fds[0]);
+  close(fds[1]);
+  CHECK(memcmp(parent, child, sizeof(parent)) != 0);
+#endif
+  SetBufferedRandom(false);
+  CHECK(!BufferedRandom());
+}
+
+TEST_CASE("PEP.RandomizerPool", "[PEP]") {
+  auto y = Scalar::Random();
+  auto Y = y * G;
+  RandomizerPool pool(Y, 12);
+  CHECK(pool.publicKey().encoded() == Y);
+  CHECK(pool.statistics().capacity == 16);
+  for (int i = 0; i < 1000 && pool.statistics().depth < 16; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  CHECK(pool.statistics().depth == 16);
+
+  auto M = GroupElement::Random();
+  std::vector<ElGamal> encrypted;
+  for (int i = 0; i < 40; ++i) {
+    encrypted.push_back(Encrypt(M, pool));
+    CHECK(encrypted.back().Y == Y);
+    CHECK(Decrypt(encrypted.back(), y) == M);
+    auto rerandomized = Rerandomize(encrypted.back(), pool);
+    CHECK(rerandomized.B != encrypted.back().B);
+    CHECK(Decrypt(rerandomized, y) == M);
+  }
+  for (size_t i = 1; i < encrypted.size(); ++i)
+    CHECK(encrypted[i].B != encrypted[i - 1].B); // every pair is used once
+  auto stats = pool.statistics();
+  CHECK(stats.taken + stats.fallbacks == 80);
+  CHECK(stats.taken <= stats.produced);
+  CHECK(stats.depth <= stats.capacity);
+
+  CHECK_THROWS_AS(Rerandomize(Encrypt(M, Scalar::Random() * G), pool), std::invalid_argument);
+  CHECK_THROWS_AS(RandomizerPool(Y, 0), std::invalid_argument);
+  CHECK_THROWS_AS(RandomizerPool(GroupElement(), 16), std::invalid_argument);
+
+  // concurrent consumers
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t)
+    threads.emplace_back([&]() {
+      for (int i = 0; i < 50; ++i)
+        ENSURE(Decrypt(Encrypt(M, pool), y) == M);
+    });
+  for (auto& thread : threads)
+    thread.join();
+  stats = pool.statistics();
+  CHECK(stats.taken + stats.fallbacks == 80 + 200);
+}
+
+TEST_CASE("PEP.GeneratePseudonyms", "[PEP]") {
+  auto [pk, sk] = GenerateGlobalKeys();
+  std::vector<std::string> identities;
+  for (int i = 0; i < 1000; ++i)
+    identities.push_back("identity-" + std::to_string(i));
+  identities.push_back("");
+  std::vector<std::string_view> views(identities.begin(), identities.end());
+  std::vector<GlobalEncryptedPseudonym> out(views.size());
+  GeneratePseudonyms(views, pk, out);
+  std::vector<GlobalEncryptedPseudonym> sequential(views.size());
+  InlineExecutor inlineExecutor;
+  GeneratePseudonyms(views, PreparePublicKey(pk), sequential, inlineExecutor);
+  for (size_t i = 0; i < views.size(); ++i) {
+    auto expected = Decrypt(GeneratePseudonym(identities[i], pk), sk);
+    CHECK(out[i].Y == pk);
+    CHECK(Decrypt(out[i], sk) == expected);
+    CHECK(Decrypt(sequential[i], sk) == expected);
+    CHECK(out[i] != sequential[i]);
+  }
+  GeneratePseudonyms({}, pk, {});
+  CHECK_THROWS_AS(GeneratePseudonyms(views, pk, std::span(out).first(3)), std::invalid_argument);
+}
+
+TEST_CASE("PEP.RKSR", "[PEP]") {
+  auto y = Scalar::Random();
+  auto Y = y * G;
+  auto M = GroupElement::Random();
+  auto encrypted = Encrypt(M, Y);
+  for (int i = 0; i < 8; ++i) {
+    auto k = Scalar::Random();
+    auto n = Scalar::Random();
+    auto s = Scalar::Random();
+    CHECK(RKSR(encrypted, k, n, s) == Rerandomize(RKS(encrypted, k, n), s));
+    CHECK(n * M == Decrypt(RKSR(encrypted, k, n), k * y));
+
+    auto P = DecodedGroupElement::Random();
+    auto Q = DecodedGroupElement::Random();
+    CHECK(DoubleScalarMul(k, P, n, Q) == k * P + n * Q);
+  }
+}
+
+TEST_CASE("PEP.Batch", "[PEP]") {
+  auto y = Scalar::Random();
+  auto Y = y * G;
+  auto k = Scalar::Random();
+  auto n = Scalar::Random();
+  std::vector<GroupElement> messages;
+  for (int i = 0; i < 300; ++i) // more than one chunk
+    messages.push_back(GroupElement::Random());
+
+  std::vector<ElGamal> encrypted(messages.size());
+  Encrypt(messages, Y, encrypted);
+  std::vector<GroupElement> decrypted(messages.size());
+  Decrypt(encrypted, y, decrypted);
+  CHECK(decrypted == messages);
+
+  std::vector<ElGamal> out(encrypted.size());
+  RKS(encrypted, k, n, out);
+  for (size_t i = 0; i < encrypted.size(); ++i)
+    CHECK(out[i] == RKS(encrypted[i], k, n));
+  Rekey(encrypted, k, out);
+  for (size_t i = 0; i < encrypted.size(); ++i)
+    CHECK(out[i] == Rekey(encrypted[i], k));
+  Reshuffle(encrypted, n, out);
+  for (size_t i = 0; i < encrypted.size(); ++i)
+    CHECK(out[i] == Reshuffle(encrypted[i], n));
+  Rerandomize(encrypted, out);
+  Decrypt(out, y, decrypted);
+  CHECK(decrypted == messages);
+  // randomized, so compare with the result of RKS after decryption
+  RKSR(encrypted, k, n, out);
+  std::vector<ElGamal> expected(encrypted.size());
+  RKS(encrypted, k, n, expected);
+  for (size_t i = 0; i < encrypted.size(); ++i) {
+    CHECK(out[i].Y == expected[i].Y);
+    CHECK(Decrypt(out[i], k * y) == Decrypt(expected[i], k * y));
+  }
+
+  // in place
+  auto copy = encrypted;
+  RKS(copy, k, n, copy);
+  for (size_t i = 0; i < encrypted.size(); ++i)
+    CHECK(copy[i] == RKS(encrypted[i], k, n));
+
+  CHECK_THROWS_AS(RKS(encrypted, k, n, std::span(out).first(1)), std::invalid_argument);
+}
+
+TEST_CASE("PEP.Hex", "[PEP]") {
+  for (size_t size : {0, 1, 15, 16, 17, 32, 33, 96}) {
+    std::string bytes(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+      bytes[i] = char(i * 37 + size);
+    std::string expected;
+    for (auto c : bytes) {
+      char digits[3];
+      snprintf(digits, sizeof(digits), "%02x", uint8_t(c));
+      expected += digits;
+    }
+    CHECK(ToHex(bytes) == expected);
+
+    std::vector<uint8_t> decoded(size);
+    CHECK(TryFromHex(decoded.data(), decoded.size(), expected));
+    CHECK(std::string(decoded.begin(), decoded.end()) == bytes);
+    for (auto& c : expected)
+      c = char(toupper(c));
+    CHECK(TryFromHex(decoded.data(), decoded.size(), expected));
+    CHECK(std::string(decoded.begin(), decoded.end()) == bytes);
+    // every position, both in the vectorised part and in the remainder
+    for (size_t i = 0; i < expected.size(); ++i) {
+      for (char wrong : {'g', 'G', '/', ':', '@', '`', ' ', '\0', char(0xB0)}) {
+        auto copy = expected;
+        copy[i] = wrong;
+        CHECK_FALSE(TryFromHex(decoded.data(), decoded.size(), copy));
+        CHECK_THROWS_AS(FromHex(decoded.data(), decoded.size(), copy), std::invalid_argument);
+      }
+    }
+    CHECK_FALSE(TryFromHex(decoded.data(), decoded.size(), expected + "0"));
+  }
+
+  auto s = Scalar::Random();
+  auto P = GroupElement::Random();
+  auto Y = GroupElement::Random();
+  auto E = Encrypt(GroupElement::Random(), Y);
+  auto E2 = Encrypt(GroupElement::Random(), Y);
+  std::string invalidPoint(64, '0');
+  invalidPoint[1] = '1'; // negative, so not canonical
+  std::vector<std::string> scalars = {s.hex(), std::string(64, '0'), "zz" + s.hex().substr(2), s.hex().substr(2)};
+  std::vector<std::string> points = {P.hex(), std::string(64, '0'), invalidPoint, P.hex()};
+  std::vector<std::string> tuples = {E.hex(), E.hex().substr(0, 128) + invalidPoint, E2.hex(), E.hex().substr(0, 64) + invalidPoint + Y.hex()};
+  std::vector<std::string_view> views(scalars.begin(), scalars.end());
+  std::vector<Scalar> parsedScalars(views.size(), s);
+  CHECK(Scalar::FromHexBatch(views, parsedScalars) == std::vector<bool>{true, false, false, false});
+  CHECK(parsedScalars[0] == s);
+  CHECK(parsedScalars[2].is_zero());
+  views.assign(points.begin(), points.end());
+  std::vector<GroupElement> parsedPoints(views.size());
+  CHECK(GroupElement::FromHexBatch(views, parsedPoints) == std::vector<bool>{true, false, false, true});
+  CHECK(parsedPoints[3] == P);
+  views.assign(tuples.begin(), tuples.end());
+  std::vector<ElGamal> parsedTuples(views.size());
+  CHECK(ElGamal::FromHexBatch(views, parsedTuples) == std::vector<bool>{true, false, true, false});
+  CHECK(parsedTuples[0] == E);
+  CHECK(parsedTuples[2] == E2);
+  CHECK(parsedTuples[1].B.is_zero());
+  CHECK_THROWS_AS(ElGamal::FromHexBatch(views, std::span(parsedTuples).first(1)), std::invalid_argument);
+}
+
+TEST_CASE("PEP.BinaryFormat", "[PEP]") {
+  auto y = Scalar::Random();
+  auto Y = y * G;
+  auto M = GroupElement::Random();
+  auto encrypted = Encrypt(M, Y);
+
+  uint8_t raw[ElGamal::BYTES];
+  encrypted.bytes(raw);
+  CHECK(ElGamal::FromBytes(raw) == encrypted);
+  CHECK(ToHex({reinterpret_cast<const char*>(raw), sizeof(raw)}) == encrypted.hex());
+  CHECK(ElGamal::FromHex(encrypted.hex()) == encrypted);
+  uint8_t compact[ElGamal::COMPACT_BYTES];
+  encrypted.compact(compact);
+  CHECK(ElGamal::FromCompact(compact, Y) == encrypted);
+  raw[32] |= 1; // C negative, so not canonical
+  CHECK_THROWS_AS(ElGamal::FromBytes(raw), std::invalid_argument);
+  memset(raw, 0, sizeof(raw));
+  CHECK_THROWS_AS(ElGamal::FromBytes(raw), std::invalid_argument);
+
+  auto k = Scalar::Random();
+  auto n = Scalar::Random();
+  std::vector<ElGamal> tuples;
+  for (int i = 0; i < 100; ++i)
+    tuples.push_back(Encrypt(GroupElement::Random(), Y));
+  std::vector<uint8_t> records(tuples.size() * ElGamal::BYTES);
+  for (size_t i = 0; i < tuples.size(); ++i)
+    tuples[i].bytes(std::span(records).subspan(i * ElGamal::BYTES).first<ElGamal::BYTES>());
+  auto view = [&](size_t i) {
+    return ElGamalView(std::span(records).subspan(i * ElGamal::BYTES).first<ElGamal::BYTES>());
+  };
+
+  RKS(records, k, n);
+  for (size_t i = 0; i < tuples.size(); ++i)
+    CHECK(view(i).get() == RKS(tuples[i], k, n));
+  Rekey(view(3), k.invert());
+  CHECK(view(3).get() == Reshuffle(tuples[3], n));
+  Reshuffle(view(3), n.invert());
+  CHECK(view(3).get() == tuples[3]);
+  RKS(view(3), k, n);
+  Rekey(records, k);
+  Reshuffle(records, n);
+  Rerandomize(records);
+  Rerandomize(view(0));
+  for (size_t i = 0; i < tuples.size(); ++i)
+    CHECK(Decrypt(view(i).get(), k * k * y) == (n * n) * Decrypt(tuples[i], y));
+
+  CHECK_THROWS_AS(Rekey(std::span(records).first(ElGamal::BYTES + 1), k), std::invalid_argument);
+
+  // all group elements of a record are checked, also the ones that are copied unchanged
+  auto corrupt = records;
+  std::fill_n(corrupt.begin() + ElGamal::BYTES + GroupElement::BYTES, GroupElement::BYTES, 0); // C of record 1
+  CHECK_THROWS_AS(Rekey(corrupt, k), std::invalid_argument);
+  CHECK_THROWS_AS(RKS(corrupt, k, n), std::invalid_argument);
+  corrupt = records;
+  corrupt[2 * ElGamal::BYTES + ElGamal::COMPACT_BYTES] ^= 1; // Y of record 2, negative so not valid
+  CHECK_THROWS_AS(Reshuffle(corrupt, n), std::invalid_argument);
+  CHECK_THROWS_AS(Rerandomize(corrupt), std::invalid_argument);
+}
+
+TEST_CASE("PEP.ColumnarFile", "[PEP]") {
+  auto path = (std::filesystem::temp_directory_path() / "libpep-columnar.test").string();
+  auto resultPath = path + ".result";
+  auto y1 = Scalar::Random();
+  auto y2 = Scalar::Random();
+  std::vector<ElGamal> tuples;
+  std::vector<uint64_t> rowIds;
+  for (uint64_t i = 0; i < 300; ++i) {
+    tuples.push_back(Encrypt(GroupElement::Random(), (i % 3 == 0 ? y1 : y2) * G));
+    rowIds.push_back(1000 + i);
+  }
+  {
+    ColumnarWriter writer(path, 64);
+    writer.write(std::span(tuples).first(100), std::span(rowIds).first(100));
+    writer.write(std::span(tuples).subspan(100), std::span(rowIds).subspan(100));
+  }
+  auto k = Scalar::Random();
+  auto n = Scalar::Random();
+  {
+    ColumnarReader reader(path);
+    CHECK(reader.rows() == tuples.size());
+    CHECK(reader.chunks() == 5);
+    CHECK(reader.chunkRows(4) == 300 - 4 * 64);
+    CHECK(reader.keys().size() == 2);
+    std::vector<ElGamal> chunk;
+    std::vector<uint64_t> ids;
+    reader.read(1, chunk, ids);
+    REQUIRE(chunk.size() == 64);
+    CHECK(chunk[0] == tuples[64]);
+    CHECK(ids[63] == 1127);
+
+    ColumnarWriter writer(resultPath);
+    TransformColumnar(reader, writer, [&](std::span<const ElGamal> in, std::span<ElGamal> out) {
+      RKS(in, k, n, out);
+    });
+    writer.close();
+  }
+  {
+    ColumnarReader reader(resultPath);
+    REQUIRE(reader.chunks() == 1);
+    std::vector<ElGamal> results;
+    std::vector<uint64_t> ids;
+    reader.read(0, results, ids);
+    CHECK(ids == rowIds);
+    for (size_t i = 0; i < tuples.size(); ++i)
+      CHECK(results[i] == RKS(tuples[i], k, n));
+  }
+
+  // corrupt a byte of the second chunk (flipped, so it always changes)
+  {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekg(64 + 64 * 76 + 10);
+    char c = char(file.get());
+    file.seekp(64 + 64 * 76 + 10);
+    file.put(char(c ^ 0xff));
+  }
+  {
+    ColumnarReader reader(path);
+    std::vector<ElGamal> chunk;
+    std::vector<uint64_t> ids;
+    CHECK_NOTHROW(reader.read(0, chunk, ids));
+    CHECK_THROWS_AS(reader.read(1, chunk, ids), std::runtime_error);
+  }
+  std::filesystem::resize_file(path, 100);
+  CHECK_THROWS_AS(ColumnarReader(path), std::runtime_error);
+  std::filesystem::remove(path);
+  std::filesystem::remove(resultPath);
+  CHECK_THROWS_AS(ColumnarReader(path), std::runtime_error);
+}
+
+TEST_CASE("PEP.IdentityDictionary", "[PEP]") {
+  auto path = (std::filesystem::temp_directory_path() / "libpep-identities.test").string();
+  std::filesystem::remove(path);
+  IdentityKey key;
+  RandomBytes(key);
+  std::vector<std::string> identities;
+  std::vector<uint64_t> rowIds;
+  for (uint64_t i = 0; i < 100; ++i) {
+    identities.push_back("identity-" + std::to_string(i));
+    rowIds.push_back(5000 + i);
+  }
+  std::vector<std::string_view> views(identities.begin(), identities.end());
+  auto pointOf = [](const std::string& identity) {
+    HashSHA512 hash;
+    SHA512(hash, identity);
+    return GroupElement::FromHash(hash);
+  };
+  {
+    IdentityDictionaryBuilder builder(path, key);
+    builder.add(std::span(views).first(60), std::span(rowIds).first(60));
+    builder.commit();
+  }
+  {
+    // incremental: the existing entries are kept, and duplicates keep their row id
+    IdentityDictionaryBuilder builder(path, key);
+    CHECK(builder.size() == 60);
+    std::vector<uint64_t> other(rowIds.size(), 1);
+    builder.add(std::span(views).first(10), std::span(other).first(10));
+    builder.add(std::span(views).subspan(60), std::span(rowIds).subspan(60));
+    CHECK(builder.size() == 100);
+    CHECK_THROWS_AS(builder.add(views, std::span(rowIds).first(3)), std::invalid_argument);
+    builder.commit();
+  }
+  IdentityDictionary dictionary(path, key);
+  CHECK(dictionary.size() == 100);
+  for (size_t i = 0; i < identities.size(); ++i) {
+    auto point = dictionary.find(identities[i]);
+    REQUIRE(point);
+    CHECK(*point == pointOf(identities[i]));
+    CHECK(dictionary.findRowId(*point) == rowIds[i]);
+  }
+  CHECK(!dictionary.find("unknown"));
+  CHECK(!dictionary.findRowId(GroupElement::Random()));
+
+  // pseudonyms from the dictionary decrypt to the same points, also for identities that are not in it
+  auto [pk, sk] = GenerateGlobalKeys();
+  views.push_back("unknown");
+  std::vector<GlobalEncryptedPseudonym> out(views.size());
+  GeneratePseudonyms(views, dictionary, PreparePublicKey(pk), out);
+  for (size_t i = 0; i < identities.size(); ++i)
+    CHECK(dictionary.findRowId(Decrypt(out[i], sk)) == rowIds[i]);
+  CHECK(Decrypt(out.back(), sk) == pointOf("unknown"));
+
+  // the file can only be used with its key
+  IdentityKey otherKey;
+  RandomBytes(otherKey);
+  CHECK_THROWS_AS(IdentityDictionary(path, otherKey), std::runtime_error);
+  CHECK_THROWS_AS(IdentityDictionaryBuilder(path, otherKey), std::runtime_error);
+
+  // lookups in a corrupt file without empty buckets end
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    IdentityDictionaryHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    std::vector<char> forward(header.buckets * (24 + sizeof(uint64_t) + GroupElement::BYTES), '\xff');
+    std::vector<uint64_t> reverse(header.buckets, 1);
+    file.seekp(sizeof(header));
+    file.write(forward.data(), std::streamsize(forward.size()));
+    file.write(reinterpret_cast<const char*>(reverse.data()), std::streamsize(reverse.size() * sizeof(uint64_t)));
+  }
+  IdentityDictionary corrupt(path, key);
+  CHECK(!corrupt.find("zzz"));
+  CHECK(!corrupt.findRowId(GroupElement::Random()));
+
+  std::filesystem::resize_file(path, 100);
+  CHECK_THROWS_AS(IdentityDictionary(path, key), std::runtime_error);
+  std::filesystem::remove(path);
+  CHECK_THROWS_AS(IdentityDictionary(path, key), std::runtime_error);
+}
+
+TEST_CASE("PEP.Executor", "[PEP]") {
+  WorkStealingExecutor executor(4);
+  CHECK(executor.concurrency() == 4);
+  std::vector<size_t> squares(1000);
+  executor.run(squares.size(), [&](size_t i) {
+    squares[i] = i * i;
+  });
+  for (size_t i = 0; i < squares.size(); ++i)
+    CHECK(squares[i] == i * i);
+
+  // nested
+  std::vector<std::atomic<size_t>> counts(10);
+  executor.run(counts.size(), [&](size_t i) {
+    executor.run(100, [&](size_t) {
+      ++counts[i];
+    });
+  });
+  for (auto& count : counts)
+    CHECK(count == 100);
+
+  CHECK_THROWS_AS(executor.run(50, [](size_t i) {
+    if (i == 17)
+      throw std::invalid_argument("failed");
+  }), std::invalid_argument);
+
+  // batch operations give the same results in the same order as without threads
+  InlineExecutor inlineExecutor;
+  auto [pk, sk] = GenerateGlobalKeys();
+  std::vector<GlobalEncryptedPseudonym> global;
+  for (int i = 0; i < 100; ++i)
+    global.push_back(GeneratePseudonym("user" + std::to_string(i), pk));
+  std::vector<LocalEncryptedPseudonym> local(global.size()), expected(global.size());
+  ConvertToLocalPseudonyms(global, "secret", "decryption", "pseudonym", local, executor);
+  ConvertToLocalPseudonyms(global, "secret", "decryption", "pseudonym", expected, inlineExecutor);
+  CHECK(local == expected);
+  std::vector<GlobalEncryptedPseudonym> back(global.size());
+  ConvertFromLocalPseudonyms(local, "secret", "decryption", "pseudonym", back, executor);
+  for (size_t i = 0; i < global.size(); ++i)
+    CHECK(back[i] == ConvertFromLocalPseudonym(local[i], "secret", "decryption", "pseudonym"));
+  auto key = MakeLocalDecryptionKey(sk, "secret", "decryption");
+  std::vector<LocalPseudonym> decrypted(local.size());
+  DecryptLocalPseudonyms(local, key, decrypted, executor);
+  for (size_t i = 0; i < local.size(); ++i)
+    CHECK(decrypted[i] == DecryptLocalPseudonym(local[i], key));
+
+  std::vector<ProvedRKS> proofs;
+  for (size_t i = 0; i < global.size(); ++i)
+    proofs.push_back(ProveRKS(global[i], Scalar::Random(), Scalar::Random()));
+  auto verified = VerifyRKS(global, proofs, executor);
+  for (size_t i = 0; i < global.size(); ++i)
+    CHECK(verified[i] == VerifyRKS(global[i], proofs[i]));
+}
+
+TEST_CASE("PEP.FactorCache", "[PEP]") {
+  FactorCache cache(4, 2);
+  auto a = cache.get("pseudonym", "secret", "context-a");
+  CHECK(a.value * a.inverse == Scalar::FromHex("0100000000000000000000000000000000000000000000000000000000000000"));
+  HashSHA512 hash;
+  SHA512(hash, "pseudonym|secret|context-a");
+  CHECK(a.value == Scalar::FromHash(hash));
+  CHECK(cache.get("pseudonym", "secret", "context-a").value == a.value);
+  CHECK(cache.get("decryption", "secret", "context-a").value != a.value);
+  auto stats = cache.statistics();
+  CHECK(stats.hits == 1);
+  CHECK(stats.misses == 2);
+  CHECK(stats.size == 2);
+
+  for (int i = 0; i < 32; ++i)
+    cache.get("pseudonym", "secret", "context-" + std::to_string(i));
+  stats = cache.statistics();
+  CHECK(stats.size <= 4);
+  CHECK(stats.evictions == stats.misses - stats.size);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t)
+    threads.emplace_back([&cache]() {
+      for (int i = 0; i < 200; ++i) {
+        auto f = cache.get("pseudonym", "secret", "context-" + std::to_string(i % 6));
+        ENSURE(f.value * f.inverse == Scalar::FromHex("0100000000000000000000000000000000000000000000000000000000000000"));
+      }
+    });
+  for (auto& thread : threads)
+    thread.join();
+  stats = cache.statistics();
+  CHECK(stats.hits + stats.misses == 3 + 32 + 800);
+
+  cache.clear();
+  CHECK(cache.statistics().size == 0);
+}
+
+TEST_CASE("PEP.BatchInvert", "[PEP]") {
+  std::vector<Scalar> values;
+  for (int i = 0; i < 10; ++i)
+    values.push_back(Scalar::Random());
+  values[3] = Scalar();
+  values[7] = Scalar();
+  auto original = values;
+  CHECK(Scalar::BatchInvert(values) == 2);
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (i == 3 || i == 7)
+      CHECK(values[i].is_zero());
+    else
+      CHECK(values[i] == original[i].invert());
+  }
+  std::vector<Scalar> empty;
+  CHECK(Scalar::BatchInvert(empty) == 0);
+
+  auto [pk, sk] = GenerateGlobalKeys();
+  std::vector<std::string_view> contexts = {"a", "b", "c", "a"};
+  std::vector<LocalDecryptionKey> keys(contexts.size());
+  MakeLocalDecryptionKeys(sk, "batch_secret", contexts, keys);
+  for (size_t i = 0; i < contexts.size(); ++i)
+    CHECK(keys[i] == MakeLocalDecryptionKey(sk, "batch_secret", contexts[i]));
+
+  FactorCache cache;
+  std::vector<Factor> factors(contexts.size());
+  cache.get("pseudonym", "batch_secret", contexts, factors);
+  for (size_t i = 0; i < contexts.size(); ++i) {
+    CHECK(factors[i].value == cache.get("pseudonym", "batch_secret", contexts[i]).value);
+    CHECK(factors[i].inverse == factors[i].value.invert());
+  }
+
+  // the prepared factors are in the default cache: using them afterwards only hits
+  std::vector<std::string_view> prepared = {"p", "q", "r"};
+  auto before = DefaultFactorCache().statistics();
+  PrepareFactors("prepare_secret", prepared, prepared);
+  auto after = DefaultFactorCache().statistics();
+  CHECK(after.misses - before.misses == 2 * prepared.size());
+  for (auto context : prepared) {
+    CHECK(MakeLocalDecryptionKey(sk, "prepare_secret", context) == DefaultFactorCache().get("decryption", "prepare_secret", context).value * sk);
+    DefaultFactorCache().get("pseudonym", "prepare_secret", context);
+  }
+  auto used = DefaultFactorCache().statistics();
+  CHECK(used.misses == after.misses);
+  CHECK(used.hits - after.hits == 3 * prepared.size());
+}
+
 TEST_CASE("PEP.PEPDerivedKey", "[PEP]") {
   auto y = Scalar::Random();
   auto Y = y * G;
@@ -492,6 +1186,24 @@ TEST_CASE("PEP.PEPSchnorrBasicOffline", "[PEP]") {
   CHECK(VerifyProof(A, Min, p));
 }
 
+TEST_CASE("PEP.PEPSchnorrZeroFactor", "[PEP]") {
+  // a proof for the factor zero (A = N = identity) satisfies the equations, but must not verify
+  GroupElement Z;
+  GroupElement M = GroupElement::Random();
+  Scalar s = Scalar::Random();
+  Proof p{Z, s * G, s * M, s};
+  CHECK(!VerifyProof(Z, M, p));
+  CHECK(!VerifyProof(Z, M, Compact(Z, M, p)));
+  auto [A, q] = CreateProof(Scalar::Random(), M);
+  CHECK(!VerifyProof(A, Z, q));
+
+  ElGamal in = Encrypt(M, GroupElement::Random());
+  Scalar s1 = Scalar::Random();
+  Scalar s2 = Scalar::Random();
+  ProvedReshuffle proved{Z, {Z, s1 * G, s1 * in.B, s1}, {Z, s2 * G, s2 * in.C, s2}};
+  CHECK(!VerifyReshuffle(in, proved));
+}
+
 TEST_CASE("PEP.PEPSchnorrRerandomize", "[PEP]") {
   // secret key of system
   auto y = Scalar::Random();
@@ -624,6 +1336,501 @@ TEST_CASE("PEP.PEPSchnorrRKSAlt", "[PEP]") {
   CHECK(proof2.N == msg2.C);
 }
 
+TEST_CASE("PEP.MultiScalarMul", "[PEP]") {
+  // 300 points uses Pippenger's method for the variable time version
+  for (size_t n : {0, 1, 3, 17, 300}) {
+    std::vector<Scalar> scalars;
+    std::vector<DecodedGroupElement> points;
+    DecodedGroupElement expected;
+    for (size_t i = 0; i < n; ++i) {
+      scalars.push_back(Scalar::Random());
+      points.push_back(DecodedGroupElement::Random());
+      expected = expected + scalars.back() * points.back();
+    }
+    CHECK(MultiScalarMul(scalars, points) == expected);
+    CHECK(MultiScalarMulVartime(scalars, points) == expected);
+  }
+  // extreme scalars: -1 has all digits at the edge of their range
+  std::vector<Scalar> scalars(256, -Scalar::FromHex("0100000000000000000000000000000000000000000000000000000000000000"));
+  std::vector<GroupElement> points;
+  GroupElement expected;
+  for (size_t i = 0; i < scalars.size(); ++i) {
+    points.push_back(GroupElement::Random());
+    expected = expected - points.back();
+  }
+  CHECK(MultiScalarMul(scalars, points) == expected);
+  CHECK(MultiScalarMulVartime(scalars, points) == expected);
+  CHECK(MultiScalarMulVartime(std::span(scalars).first(2), std::span(points).first(2)) == GroupElement() - points[0] - points[1]);
+  CHECK_THROWS_AS(MultiScalarMul(std::span(scalars).first(2), std::span(points).first(1)), std::invalid_argument);
+}
+
+TEST_CASE("PEP.Vartime", "[PEP]") {
+  auto one = Scalar::FromHex("0100000000000000000000000000000000000000000000000000000000000000");
+  std::vector<Scalar> scalars = {one, one + one, -one, Scalar::FromHex("0000000000000000000000000000000000000000000000000000000000000010")};
+  for (int i = 0; i < 16; ++i)
+    scalars.push_back(Scalar::Random());
+  auto P = DecodedGroupElement::Random();
+  for (const auto& s : scalars) {
+    CHECK(DecodedGroupElement::MultBaseVartime(s) == DecodedGroupElement::MultBase(s));
+    CHECK(ScalarMulVartime(s, P) == s * P);
+  }
+  // unlike the constant time versions, zero results are allowed
+  CHECK(DecodedGroupElement::MultBaseVartime(Scalar()).is_zero());
+  CHECK(ScalarMulVartime(Scalar(), P).is_zero());
+  CHECK(ScalarMulVartime(one, DecodedGroupElement()).is_zero());
+
+  auto Q = DecodedGroupElement::Random();
+  for (const auto& a : scalars) {
+    auto b = Scalar::Random();
+    CHECK(DoubleScalarMulVartime(a, P, b, Q) == DoubleScalarMul(a, P, b, Q));
+    CHECK(DoubleScalarMulVartime(a, G, b, Q) == DecodedGroupElement::MultBase(a) + b * Q);
+    CHECK(DoubleScalarMulVartime(a, P, -a, P).is_zero());
+  }
+  CHECK(DoubleScalarMulVartime(Scalar(), P, Scalar(), Q).is_zero());
+}
+
+TEST_CASE("PEP.DecodedEquality", "[PEP]") {
+  auto P = DecodedGroupElement::Random();
+  auto Q = DecodedGroupElement::Random();
+  CHECK(P == P);
+  CHECK(P != Q);
+  CHECK(P + Q - Q == P);
+  CHECK(DecodedGroupElement() == P - P);
+  CHECK(DecodedGroupElement() != P);
+  // (0, -1) has order 2 on the Edwards curve, so P + T is another representative of the same ristretto point
+  DecodedGroupElement T;
+  T.Y.v[0] = (uint64_t(1) << 51) - 20;
+  for (int i = 1; i < 5; ++i)
+    T.Y.v[i] = (uint64_t(1) << 51) - 1;
+  CHECK(T.is_zero());
+  CHECK(P + T == P);
+  CHECK((P + T).encode() == P.encode());
+  CHECK(P + T != Q);
+}
+
+TEST_CASE("PEP.CurveBackend", "[PEP]") {
+  auto original = ActiveCurveBackend();
+  auto backends = SupportedCurveBackends();
+  REQUIRE(!backends.empty());
+  CHECK(backends.front() == CurveBackend::Libsodium);
+  CHECK(Supported(original));
+  for (auto backend : {CurveBackend::Libsodium, CurveBackend::AVX2, CurveBackend::AVX512IFMA}) {
+    CHECK(std::string(Name(backend)) != "unknown");
+    if (!Supported(backend))
+      CHECK_THROWS_AS(SetCurveBackend(backend), std::invalid_argument);
+  }
+
+  auto one = Scalar::FromHex("0100000000000000000000000000000000000000000000000000000000000000");
+  std::vector<Scalar> scalars = {one, one + one, -one, Scalar::FromHex("0000000000000000000000000000000000000000000000000000000000000010")};
+  for (int i = 0; i < 8; ++i)
+    scalars.push_back(Scalar::Random());
+  // top bit set: ignored, like crypto_scalarmult_ristretto255() does
+  Scalar high = Scalar::Random();
+  high.value[31] |= 0x80;
+  auto P = DecodedGroupElement::Random();
+  auto Q = DecodedGroupElement::Random();
+  // another representative of P, see PEP.DecodedEquality
+  DecodedGroupElement T;
+  T.Y.v[0] = (uint64_t(1) << 51) - 20;
+  for (int i = 1; i < 5; ++i)
+    T.Y.v[i] = (uint64_t(1) << 51) - 1;
+  auto PT = P + T;
+
+  auto results = [&] {
+    std::vector<GroupElement> retval;
+    for (size_t i = 0; i < scalars.size(); ++i) {
+      const auto& a = scalars[i];
+      const auto& b = scalars[scalars.size() - 1 - i];
+      retval.push_back((a * P).encode());
+      retval.push_back((a * PT).encode());
+      retval.push_back(a * P.encode());
+      retval.push_back(P.encode() / a);
+      retval.push_back(ScalarMulVartime(a, P).encode());
+      retval.push_back(DoubleScalarMul(a, P, b, Q).encode());
+      retval.push_back(DoubleScalarMulVartime(a, PT, b, Q).encode());
+      retval.push_back(DoubleScalarMulVartime(a, G, b, Q).encode());
+    }
+    retval.push_back(high * P.encode());
+    retval.push_back((high * P).encode());
+    retval.push_back(ScalarMulVartime(Scalar(), P).encode());
+    retval.push_back(DoubleScalarMulVartime(Scalar(), P, Scalar(), Q).encode());
+    return retval;
+  };
+  SetCurveBackend(CurveBackend::Libsodium);
+  auto expected = results();
+  for (auto backend : backends) {
+    INFO(Name(backend));
+    SetCurveBackend(backend);
+    CHECK(ActiveCurveBackend() == backend);
+    CHECK(results() == expected);
+    CHECK_THROWS_AS(Scalar() * P, std::invalid_argument);
+    CHECK_THROWS_AS(Scalar() * P.encode(), std::invalid_argument);
+    CHECK_THROWS_AS(one * DecodedGroupElement(), std::invalid_argument);
+  }
+  SetCurveBackend(original);
+}
+
+TEST_CASE("PEP.PEPSchnorrBatch", "[PEP]") {
+  std::vector<Scalar> scalars;
+  std::vector<DecodedGroupElement> points;
+  DecodedGroupElement expected;
+  for (int i = 0; i < 5; ++i) {
+    scalars.push_back(Scalar::Random());
+    points.push_back(DecodedGroupElement::Random());
+    expected = expected + scalars.back() * points.back();
+  }
+  CHECK(MultiScalarMulVartime(scalars, points) == expected);
+
+  std::vector<GroupElement> A, M;
+  std::vector<Proof> proofs;
+  for (int i = 0; i < 9; ++i) {
+    M.push_back(GroupElement::Random());
+    auto [a, p] = CreateProof(Scalar::Random(), M.back());
+    A.push_back(a);
+    proofs.push_back(p);
+  }
+  CHECK(VerifyProofBatch(A, M, proofs) == std::vector<bool>(9, true));
+  proofs[2].s = proofs[2].s + proofs[2].s;
+  proofs[7].N = GroupElement::Random();
+  auto result = VerifyProofBatch(A, M, proofs);
+  for (size_t i = 0; i < proofs.size(); ++i)
+    CHECK(result[i] == VerifyProof(A[i], M[i], proofs[i]));
+  CHECK(!result[2]);
+  CHECK(!result[7]);
+  CHECK(result[3]);
+
+  // proofs for the factor zero fail in a batch just as they do alone
+  GroupElement Z;
+  std::vector<GroupElement> zeroA(3, Z);
+  std::vector<Proof> zeroProofs;
+  for (size_t i = 0; i < zeroA.size(); ++i) {
+    Scalar s = Scalar::Random();
+    zeroProofs.push_back({Z, s * G, s * M[i], s});
+  }
+  auto zeroResult = VerifyProofBatch(zeroA, std::span(M).first(3), zeroProofs);
+  for (size_t i = 0; i < zeroProofs.size(); ++i) {
+    CHECK(!zeroResult[i]);
+    CHECK(zeroResult[i] == VerifyProof(zeroA[i], M[i], zeroProofs[i]));
+  }
+
+  auto y = Scalar::Random();
+  auto Y = y * G;
+  std::vector<ElGamal> msgs;
+  std::vector<ProvedRKS> rks;
+  std::vector<ProvedRerandomize> rerandomize;
+  std::vector<ProvedReshuffle> reshuffle;
+  std::vector<ProvedRekey> rekey;
+  auto k = Scalar::Random();
+  auto n = Scalar::Random();
+  for (int i = 0; i < 6; ++i) {
+    msgs.push_back(Encrypt(GroupElement::Random(), Y));
+    rks.push_back(ProveRKS(msgs.back(), k, n));
+    rerandomize.push_back(ProveRerandomize(msgs.back()));
+    reshuffle.push_back(ProveReshuffle(msgs.back(), n));
+    rekey.push_back(ProveRekey(msgs.back(), k));
+  }
+  std::get<3>(rks[4]).s = Scalar::Random();
+  std::get<1>(reshuffle[1]).C1 = GroupElement::Random();
+  auto checkedRKS = VerifyRKS(msgs, rks);
+  auto checkedRerandomize = VerifyRerandomize(msgs, rerandomize);
+  auto checkedReshuffle = VerifyReshuffle(msgs, reshuffle);
+  auto checkedRekey = VerifyRekey(msgs, rekey);
+  for (size_t i = 0; i < msgs.size(); ++i) {
+    CHECK(checkedRKS[i] == VerifyRKS(msgs[i], rks[i]));
+    CHECK(checkedRerandomize[i] == VerifyRerandomize(msgs[i], rerandomize[i]));
+    CHECK(checkedReshuffle[i] == VerifyReshuffle(msgs[i], reshuffle[i]));
+    CHECK(checkedRekey[i] == VerifyRekey(msgs[i], rekey[i]));
+  }
+  CHECK(!checkedRKS[4]);
+  CHECK(checkedRKS[0] == RKS(msgs[0], k, n));
+  CHECK(!checkedReshuffle[1]);
+  CHECK(checkedRekey[1]);
+}
+
+TEST_CASE("PEP.CompactProof", "[PEP]") {
+  auto a = Scalar::Random();
+  auto M = GroupElement::Random();
+  auto [A, p] = CreateProof(a, M);
+  auto compact = Compact(A, M, p);
+  CHECK(VerifyProof(A, M, compact));
+  CHECK(compact.value() == p.value());
+  CHECK(!VerifyProof(GroupElement::Random(), M, compact));
+  CHECK(!VerifyProof(A, GroupElement::Random(), compact));
+  auto wrong = compact;
+  wrong.N = GroupElement::Random();
+  CHECK(!VerifyProof(A, M, wrong));
+  wrong = compact;
+  wrong.s = Scalar::Random();
+  CHECK(!VerifyProof(A, M, wrong));
+  wrong = compact;
+  wrong.e = Scalar::Random();
+  CHECK(!VerifyProof(A, M, wrong));
+
+  auto y = Scalar::Random();
+  auto in = Encrypt(GroupElement::Random(), y * G);
+  auto k = Scalar::Random();
+  auto n = Scalar::Random();
+  auto s = Scalar::Random();
+  CHECK(VerifyRerandomize(in, Compact(in, ProveRerandomize(in, s))) == Rerandomize(in, s));
+  CHECK(VerifyReshuffle(in, Compact(in, ProveReshuffle(in, n))) == Reshuffle(in, n));
+  CHECK(VerifyRekey(in, Compact(in, ProveRekey(in, k))) == Rekey(in, k));
+  auto rks = Compact(in, ProveRKS(in, k, n));
+  CHECK(VerifyRKS(in, rks) == RKS(in, k, n));
+  std::get<3>(rks).s = Scalar::Random();
+  CHECK(!VerifyRKS(in, rks));
+}
+
+TEST_CASE("PEP.SerialiseProofs", "[PEP]") {
+  auto y = Scalar::Random();
+  auto in = Encrypt(GroupElement::Random(), y * G);
+  auto k = Scalar::Random();
+  auto n = Scalar::Random();
+
+  auto [A, p] = CreateProof(k, in.B);
+  auto encoded = Serialize(p);
+  CHECK(encoded.size() == 128);
+  CHECK(VerifyProof(A, in.B, Deserialize<Proof>(encoded)));
+  CHECK(Serialize(Compact(A, in.B, p)).size() == 96);
+
+  auto rks = ProveRKS(in, k, n);
+  encoded = Serialize(rks);
+  CHECK(encoded.size() == 3 * 32 + 3 * 128);
+  CHECK(VerifyRKS(in, Deserialize<ProvedRKS>(encoded)) == RKS(in, k, n));
+  auto compact = Compact(in, rks);
+  auto compactEncoded = Serialize(compact);
+  CHECK(compactEncoded.size() == 3 * 32 + 3 * 96);
+  CHECK(VerifyRKS(in, Deserialize<CompactProvedRKS>(compactEncoded)) == RKS(in, k, n));
+  auto s = Scalar::Random();
+  CHECK(VerifyRerandomize(in, Deserialize<ProvedRerandomize>(Serialize(ProveRerandomize(in, s)))) == Rerandomize(in, s));
+  CHECK(VerifyReshuffle(in, Deserialize<ProvedReshuffle>(Serialize(ProveReshuffle(in, n)))) == Reshuffle(in, n));
+  CHECK(VerifyRekey(in, Deserialize<CompactProvedRekey>(Serialize(Compact(in, ProveRekey(in, k))))) == Rekey(in, k));
+
+  std::vector<ElGamal> batch = {in, Encrypt(GroupElement::Random(), y * G)};
+  std::vector<ElGamal> out(batch.size());
+  auto aggregate = ProveRKSBatch(batch, k, n, out);
+  CHECK(VerifyRKSBatch(batch, out, Deserialize<ProvedRKSBatch>(Serialize(aggregate))));
+  // the proofs of an empty batch have a zero C2
+  std::vector<ElGamal> none;
+  CHECK(VerifyRKSBatch(none, none, Deserialize<ProvedRKSBatch>(Serialize(ProveRKSBatch(none, k, n, none)))));
+  CHECK(VerifyRekeyBatch(none, none, Deserialize<ProvedRekeyBatch>(Serialize(ProveRekeyBatch(none, k, none)))));
+  CHECK(VerifyReshuffleBatch(none, none, Deserialize<ProvedReshuffleBatch>(Serialize(ProveReshuffleBatch(none, n, none)))));
+  auto [emptyA, emptyProof] = CreateAggregateProof(k, {}, {});
+  CHECK(VerifyAggregateProof(emptyA, {}, {}, Deserialize<AggregateProof>(Serialize(emptyProof))));
+
+  CHECK_THROWS_AS(Deserialize<ProvedRKS>(encoded.substr(1)), std::invalid_argument);
+  CHECK_THROWS_AS(Deserialize<ProvedRKS>(encoded + "x"), std::invalid_argument);
+  encoded[0] |= 1; // negative, so not canonical
+  CHECK_THROWS_AS(Deserialize<ProvedRKS>(encoded), std::invalid_argument);
+}
+
+TEST_CASE("PEP.AggregateProof", "[PEP]") {
+  auto a = Scalar::Random();
+  std::vector<GroupElement> M, N;
+  for (int i = 0; i < 50; ++i) {
+    M.push_back(GroupElement::Random());
+    N.push_back(a * M.back());
+  }
+  M.push_back(M[3]); // equal points are combined
+  N.push_back(N[3]);
+  auto [A, p] = CreateAggregateProof(a, M, N);
+  CHECK(A == a * G);
+  CHECK(VerifyAggregateProof(A, M, N, p));
+  CHECK(!VerifyAggregateProof(Scalar::Random() * G, M, N, p));
+  std::swap(N[1], N[2]);
+  CHECK(!VerifyAggregateProof(A, M, N, p));
+  std::swap(N[1], N[2]);
+  N[7] = N[7] + N[7];
+  CHECK(!VerifyAggregateProof(A, M, N, p));
+  N[7] = a * M[7];
+  p.s = p.s + p.s;
+  CHECK(!VerifyAggregateProof(A, M, N, p));
+  CHECK_THROWS_AS(VerifyAggregateProof(A, M, std::span(N).first(3), p), std::invalid_argument);
+
+  // zero A, M or N (as for the factor zero) never verify
+  GroupElement Z;
+  std::vector<GroupElement> zeroN(M.size(), Z);
+  CHECK(!VerifyAggregateProof(Z, M, zeroN, p));
+  CHECK(!VerifyAggregateProof(Z, M, N, p));
+  CHECK(!VerifyAggregateProof(A, zeroN, zeroN, p));
+
+  // empty batches
+  auto [emptyA, empty] = CreateAggregateProof(a, {}, {});
+  CHECK(emptyA == a * G);
+  CHECK(VerifyAggregateProof(emptyA, {}, {}, empty));
+  CHECK(!VerifyAggregateProof(Scalar::Random() * G, {}, {}, empty));
+
+  auto y = Scalar::Random();
+  auto Y = y * G;
+  auto k = Scalar::Random();
+  auto n = Scalar::Random();
+  std::vector<ElGamal> in;
+  for (int i = 0; i < 200; ++i)
+    in.push_back(Encrypt(GroupElement::Random(), Y));
+  std::vector<ElGamal> out(in.size());
+
+  auto rks = ProveRKSBatch(in, k, n, out);
+  for (size_t i = 0; i < in.size(); ++i)
+    CHECK(out[i] == RKS(in[i], k, n));
+  CHECK(VerifyRKSBatch(in, out, rks));
+  CHECK(RekeyBy(rks) == k * G);
+  CHECK(ReshuffledBy(rks) == n * G);
+  auto tampered = out;
+  tampered[5].B = GroupElement::Random();
+  CHECK(!VerifyRKSBatch(in, tampered, rks));
+  tampered = out;
+  std::swap(tampered[10], tampered[11]);
+  CHECK(!VerifyRKSBatch(in, tampered, rks));
+  CHECK(!VerifyRKSBatch(in, out, ProveRKSBatch(in, k, Scalar::Random(), tampered)));
+
+  auto reshuffle = ProveReshuffleBatch(in, n, out);
+  CHECK(VerifyReshuffleBatch(in, out, reshuffle));
+  CHECK(out[0] == Reshuffle(in[0], n));
+  CHECK(ReshuffledBy(reshuffle) == n * G);
+  out[1].Y = GroupElement::Random();
+  CHECK(!VerifyReshuffleBatch(in, out, reshuffle));
+
+  auto rekey = ProveRekeyBatch(in, k, out);
+  CHECK(VerifyRekeyBatch(in, out, rekey));
+  CHECK(out[0] == Rekey(in[0], k));
+  CHECK(RekeyBy(rekey) == k * G);
+
+  std::vector<ElGamal> none;
+  CHECK(VerifyReshuffleBatch(none, none, ProveReshuffleBatch(none, n, none)));
+  CHECK(VerifyRKSBatch(none, none, ProveRKSBatch(none, k, n, none)));
+
+  // in place
+  auto copy = in;
+  auto inPlace = ProveRKSBatch(copy, k, n, copy);
+  CHECK(VerifyRKSBatch(in, copy, inPlace));
+}
+
+TEST_CASE("PEP.Metrics", "[PEP]") {
+  // bucket boundaries
+  for (uint64_t v : {0ull, 1ull, 7ull, 8ull, 9ull, 15ull, 16ull, 17ull, 1000ull, 123456789ull, 1ull << 40, (1ull << 41) - 1}) {
+    auto bucket = Histogram::BucketOf(v);
+    CHECK(bucket < Histogram::BUCKETS);
+    CHECK(v <= Histogram::UpperBound(bucket));
+    CHECK((bucket == 0 || Histogram::UpperBound(bucket - 1) < v));
+    // relative width of at most 1/8
+    CHECK(Histogram::UpperBound(bucket) - v <= v / 8);
+  }
+  CHECK(Histogram::BucketOf(UINT64_MAX) == Histogram::BUCKETS - 1);
+  Histogram h;
+  CHECK(h.quantile(0.5) == 0);
+  for (uint64_t v = 1; v <= 100; ++v) {
+    ++h.buckets[Histogram::BucketOf(v * 1000)];
+    ++h.count;
+  }
+  CHECK(h.quantile(0) == Histogram::UpperBound(Histogram::BucketOf(1000)));
+  CHECK(h.quantile(0.5) >= 50000);
+  CHECK(h.quantile(0.5) <= 50000 + 50000 / 8);
+  CHECK(h.quantile(1) >= 100000);
+
+#if !defined(LIBPEP_NO_METRICS)
+  InlineExecutor executor;
+  ResetMetrics();
+  auto y = Scalar::Random();
+  auto Y = y * G;
+  auto M = GroupElement::Random();
+  auto encrypted = Encrypt(M, Y);
+  CHECK(Decrypt(encrypted, y) == M);
+  std::vector<ElGamal> in(10, encrypted);
+  std::vector<ElGamal> out(in.size());
+  Rekey(in, Scalar::Random(), out, executor);
+  auto [A, p] = CreateProof(Scalar::Random(), M);
+  CHECK(VerifyProof(A, M, p));
+  CHECK(!VerifyProof(A, Y, p));
+
+  auto snapshot = Metrics();
+  CHECK(snapshot[Counter::Encryptions] == 1);
+  CHECK(snapshot[Counter::Decryptions] == 1);
+  CHECK(snapshot[Counter::Rekeys] == 10);
+  CHECK(snapshot[Counter::ProofsCreated] == 1);
+  CHECK(snapshot[Counter::ProofsVerified] == 2);
+  CHECK(snapshot[Counter::ProofVerificationFailures] == 1);
+  CHECK(snapshot[Counter::FixedBaseMultiplications] > 0);
+  CHECK(snapshot[Counter::Decodings] > 0);
+  CHECK(snapshot[Operation::Encrypt].count == 1);
+  CHECK(snapshot[Operation::RekeyBatch].count == 1);
+  CHECK(snapshot[Operation::VerifyProof].count == 2);
+  CHECK(snapshot[Operation::Rekey].count == 0);
+  CHECK(snapshot[Operation::Encrypt].sum > 0);
+  CHECK(snapshot[Operation::Encrypt].quantile(0.5) > 0);
+
+  // counts of threads that have ended are kept
+  std::thread([&] {
+    for (int i = 0; i < 3; ++i)
+      (void)Reshuffle(encrypted, Scalar::Random());
+  }).join();
+  CHECK(Metrics()[Counter::Reshuffles] == 3);
+  CHECK(Metrics()[Operation::Reshuffle].count == 3);
+  ResetMetrics();
+  CHECK(Metrics()[Counter::Reshuffles] == 0);
+  CHECK(Metrics()[Operation::Encrypt].count == 0);
+
+  (void)Encrypt(M, Y);
+  auto text = ToPrometheus(Metrics());
+  CHECK(text.find("# TYPE libpep_encryptions_total counter\nlibpep_encryptions_total 1\n") != std::string::npos);
+  CHECK(text.find("libpep_operation_duration_seconds_bucket{operation=\"encrypt\",le=\"+Inf\"} 1\n") != std::string::npos);
+  CHECK(text.find("libpep_operation_duration_seconds_count{operation=\"encrypt\"} 1\n") != std::string::npos);
+  CHECK(text.find("libpep_operation_duration_seconds_count{operation=\"decrypt\"} 0\n") != std::string::npos);
+
+  auto path = (std::filesystem::temp_directory_path() / "libpep-metrics.prom").string();
+  WriteMetrics(path);
+  std::ifstream file(path);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  CHECK(contents.str().find("libpep_encryptions_total 1\n") != std::string::npos);
+  std::filesystem::remove(path);
+  // the snapshot that is passed is written, not a new one
+  MetricsSnapshot empty;
+  WriteMetrics(path, empty);
+  std::ifstream emptyFile(path);
+  std::stringstream emptyContents;
+  emptyContents << emptyFile.rdbuf();
+  CHECK(emptyContents.str().find("libpep_encryptions_total 0\n") != std::string::npos);
+  std::filesystem::remove(path);
+
+  // randomizer pools: counters, and a depth gauge per live pool
+  ResetMetrics();
+  {
+    RandomizerPool pool(Y, 4);
+    while (pool.statistics().depth < 4)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    auto pools = Metrics().randomizerPools;
+    REQUIRE(pools.size() == 1);
+    CHECK(pools[0].depth == 4);
+    CHECK(pools[0].capacity == 4);
+    for (int i = 0; i < 4; ++i)
+      (void)Encrypt(M, pool);
+    auto statistics = pool.statistics();
+    snapshot = Metrics();
+    CHECK(snapshot[Counter::RandomizerPoolPairsTaken] == statistics.taken);
+    CHECK(snapshot[Counter::RandomizerPoolFallbacks] == statistics.fallbacks);
+    CHECK(snapshot[Counter::RandomizerPoolPairsTaken] + snapshot[Counter::RandomizerPoolFallbacks] == 4);
+    CHECK(snapshot[Counter::RandomizerPoolPairsProduced] >= 4);
+    text = ToPrometheus(snapshot);
+    auto id = std::to_string(snapshot.randomizerPools[0].id);
+    CHECK(text.find("libpep_randomizer_pool_capacity{pool=\"" + id + "\"} 4\n") != std::string::npos);
+    CHECK(text.find("libpep_randomizer_pool_depth{pool=\"" + id + "\"} ") != std::string::npos);
+    CHECK(text.find("# TYPE libpep_randomizer_pool_fallbacks_total counter\n") != std::string::npos);
+  }
+  CHECK(Metrics().randomizerPools.empty());
+
+  std::atomic<int> exported = 0;
+  {
+    MetricsExporter exporter(std::chrono::milliseconds(1), [&](const MetricsSnapshot& s) {
+      if (s[Counter::Encryptions] >= 1)
+        ++exported;
+    });
+    while (exported == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+#else
+  CHECK(Metrics()[Counter::Encryptions] == 0);
+#endif
+}
+
 TEST_CASE("PEP.RistrettoExampleFromLibSodium", "[PEP]") {
   // Perform a secure two-party computation of f(x) = p(x)^k.
   // x is the input sent to the second party by the first party
@@ -679,12 +1886,15 @@ TEST_CASE("PEP.HighLevelAPI", "[PEP]") {
   std::cout << "encrypted local pseudonym for '" << id << "': " << lep.hex() << std::endl;
   lep = RerandomizeLocal(lep);
   std::cout << "encrypted local pseudonym for '" << id << "': " << lep.hex() << " (after randomize)" << std::endl;
+  auto lep2 = ConvertToRerandomizedLocalPseudonym(gep, "very_secret_on_server", "login_session_of_user", "access_group_of_user");
+  CHECK(lep2 != lep);
 
   auto decryptionKey = MakeLocalDecryptionKey(secretKey, "very_secret_on_server", "login_session_of_user");
   auto lp = DecryptLocalPseudonym(lep, decryptionKey);
   auto expected = LocalPseudonym::FromHex("be26a708fcf722db8d19f6d8c8443794156af30b17c44bcf4bb41791c0708945");
   CHECK(lp.hex() == expected.hex());
   CHECK(lp == expected);
+  CHECK(DecryptLocalPseudonym(lep2, decryptionKey) == expected);
   std::cout << "(decrypted local pseudonym) for '" << id << "': " << lp.hex() << std::endl;
 }
 